@@ -25,14 +25,30 @@
  *
  *********************************************************************/
 
+#include <assert.h>
 #include <string.h>
+#include <limits.h> // for CHAR_MAX
+#include <getopt.h>
+#ifndef _WIN32
+#include <unistd.h> // for isatty()
+#endif
+
+#include <algorithm>
 #include <iostream>
+#include <sstream>
+#include <vector>
 
 #include "cli.hpp"
+#include "cli_pager.hpp"
 #include "os_string.hpp"
 #include "os_process.hpp"
 #include "cli_resources.hpp"
 
+#include "trace_parser.hpp"
+#include "trace_dump.hpp"
+#include "trace_callset.hpp"
+
+
 static const char *synopsis = "Identify differences between two traces.";
 
 static os::String
@@ -44,25 +60,820 @@ find_command(void)
 static void
 usage(void)
 {
-    os::String command = find_command();
-    if (!command.length()) {
-        exit(1);
+    std::cout
+        << "usage: apitrace diff [OPTIONS] TRACE TRACE\n"
+        << synopsis << "\n"
+        "\n"
+        "    -h, --help             show this help message and exit\n"
+        "    -d, --diff=TOOL        diff program: native, diff, sdiff, or wdiff [default: native]\n"
+        "    -c, --calls=CALLSET    calls to compare [default: all]\n"
+        "    --ref-calls=CALLSET    calls to compare from reference trace\n"
+        "    --src-calls=CALLSET    calls to compare from source trace\n"
+        "    --call-nos             dump call numbers\n"
+        "    -w, --width=NUM        columns, for sdiff [default: auto]\n"
+        "\n"
+        "The native differ compares calls by name and argument values, and\n"
+        "highlights the arguments that changed.  The other tools diff the\n"
+        "output of `apitrace dump` with tracediff.py, and need python.\n"
+    ;
+}
+
+enum {
+    REF_CALLS_OPT = CHAR_MAX + 1,
+    SRC_CALLS_OPT,
+    CALL_NOS_OPT,
+};
+
+const static char *
+shortOptions = "hd:c:w:";
+
+const static struct option
+longOptions[] = {
+    {"help", no_argument, 0, 'h'},
+    {"diff", required_argument, 0, 'd'},
+    {"calls", required_argument, 0, 'c'},
+    {"ref-calls", required_argument, 0, REF_CALLS_OPT},
+    {"src-calls", required_argument, 0, SRC_CALLS_OPT},
+    {"call-nos", no_argument, 0, CALL_NOS_OPT},
+    {"width", required_argument, 0, 'w'},
+    {0, 0, 0, 0}
+};
+
+
+/*
+ * Calls which are expected to differ between runs, and are left out.
+ */
+static const char *
+ignoredFunctionNames[] = {
+    "glGetString",
+    "glXGetClientString",
+    "glXGetCurrentDisplay",
+    "glXGetCurrentContext",
+    "glXGetProcAddress",
+    "glXGetProcAddressARB",
+    "wglGetProcAddress",
+};
+
+static bool
+isIgnored(const trace::Call *call)
+{
+    for (unsigned i = 0; i < sizeof ignoredFunctionNames / sizeof ignoredFunctionNames[0]; ++i) {
+        if (strcmp(call->name(), ignoredFunctionNames[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/*
+ * 64-bit FNV-1a hash.
+ */
+static const unsigned long long HASH_SEED = 0xcbf29ce484222325ULL;
+
+static inline unsigned long long
+hashBytes(unsigned long long hash, const void *data, size_t size)
+{
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+template< class T >
+static inline unsigned long long
+hashValue(unsigned long long hash, const T &value)
+{
+    return hashBytes(hash, &value, sizeof value);
+}
+
+static inline unsigned long long
+hashString(unsigned long long hash, const char *str)
+{
+    return hashBytes(hash, str, strlen(str) + 1);
+}
+
+
+/**
+ * Hashes values so that calls can be compared without keeping them around.
+ * Blobs are hashed by contents.
+ */
+class ValueHasher : public trace::Visitor
+{
+public:
+    unsigned long long hash;
+
+    ValueHasher() : hash(HASH_SEED) {}
+
+    void hashTag(unsigned char tag) {
+        hash = hashValue(hash, tag);
+    }
+
+    void visitValue(trace::Value *value) {
+        if (value) {
+            _visit(value);
+        } else {
+            hashTag(0);
+        }
+    }
+
+    void visit(trace::Null *) {
+        hashTag(1);
+    }
+
+    void visit(trace::Bool *node) {
+        hashTag(node->value ? 3 : 2);
+    }
+
+    void visit(trace::SInt *node) {
+        hashTag(4);
+        hash = hashValue(hash, node->value);
+    }
+
+    void visit(trace::UInt *node) {
+        hashTag(5);
+        hash = hashValue(hash, node->value);
     }
 
-    char *args[4];
-    args[0] = (char *) "python";
-    args[1] = (char *) command.str();
-    args[2] = (char *) "--help";
-    args[3] = NULL;
+    void visit(trace::Float *node) {
+        hashTag(6);
+        hash = hashValue(hash, node->value);
+    }
+
+    void visit(trace::Double *node) {
+        hashTag(7);
+        hash = hashValue(hash, node->value);
+    }
+
+    void visit(trace::String *node) {
+        hashTag(8);
+        hash = hashString(hash, node->value);
+    }
+
+    void visit(trace::Enum *node) {
+        hashTag(9);
+        hash = hashValue(hash, node->value);
+    }
+
+    void visit(trace::Bitmask *node) {
+        hashTag(10);
+        hash = hashValue(hash, node->value);
+    }
 
-    os::execute(args);
+    void visit(trace::Struct *node) {
+        hashTag(11);
+        hash = hashString(hash, node->sig->name);
+        for (unsigned i = 0; i < node->members.size(); ++i) {
+            visitValue(node->members[i]);
+        }
+    }
+
+    void visit(trace::Array *node) {
+        hashTag(12);
+        hash = hashValue(hash, node->values.size());
+        for (unsigned i = 0; i < node->values.size(); ++i) {
+            visitValue(node->values[i]);
+        }
+    }
+
+    void visit(trace::Blob *node) {
+        hashTag(13);
+        hash = hashValue(hash, node->size);
+        hash = hashBytes(hash, node->buf, node->size);
+    }
+
+    void visit(trace::Pointer *node) {
+        hashTag(14);
+        hash = hashValue(hash, node->value);
+    }
+
+    void visit(trace::Repr *node) {
+        hashTag(15);
+        visitValue(node->humanValue);
+        visitValue(node->machineValue);
+    }
+};
+
+static unsigned long long
+hashValue(trace::Value *value)
+{
+    ValueHasher hasher;
+    hasher.visitValue(value);
+    return hasher.hash;
 }
 
+static inline unsigned long long
+hashName(const trace::Call *call)
+{
+    return hashString(HASH_SEED, call->name());
+}
+
+static unsigned long long
+hashCall(const trace::Call *call)
+{
+    ValueHasher hasher;
+    hasher.hash = hashName(call);
+    for (unsigned i = 0; i < call->args.size(); ++i) {
+        hasher.visitValue(call->args[i].value);
+    }
+    hasher.visitValue(call->ret);
+    return hasher.hash;
+}
+
+
+/**
+ * Sequential reader of the calls of a trace which are to be compared.
+ */
+class CallReader
+{
+    trace::Parser parser;
+    trace::CallSet calls;
+
+public:
+    bool
+    open(const char *filename, const char *callset) {
+        calls = trace::CallSet(callset);
+        return parser.open(filename);
+    }
+
+    trace::Call *
+    next(void) {
+        trace::Call *call;
+        while ((call = parser.parse_call())) {
+            if (call->no > calls.getLast()) {
+                delete call;
+                return NULL;
+            }
+            if (calls.contains(*call) && !isIgnored(call)) {
+                return call;
+            }
+            delete call;
+        }
+        return NULL;
+    }
+};
+
+
+/**
+ * Hashes of the calls of a trace, by value and by name, in order.
+ */
+struct CallHashes
+{
+    std::vector<unsigned long long> calls;
+    std::vector<unsigned> names;
+
+    void
+    read(CallReader &reader) {
+        trace::Call *call;
+        while ((call = reader.next())) {
+            calls.push_back(hashCall(call));
+            names.push_back((unsigned)hashName(call));
+            delete call;
+        }
+    }
+};
+
+
+/**
+ * Finds which elements of two sequences are not part of a shortest edit
+ * script, with Myers' linear space O((N+M)D) algorithm, as done by GNU diff.
+ *
+ * When the edit distance gets too large, the search for the middle snake is
+ * cut short, trading minimality for speed.
+ */
+template< class T >
+class SequenceDiffer
+{
+    const T *xv;
+    const T *yv;
+
+    /* Furthest reaching x on each diagonal, indexed by x - y + offset */
+    std::vector<int> fdiag;
+    std::vector<int> bdiag;
+    long offset;
+
+    long tooExpensive;
+
+    struct Partition {
+        long xmid, ymid;
+        bool loMinimal, hiMinimal;
+    };
+
+    struct Range {
+        long xoff, xlim, yoff, ylim;
+        bool findMinimal;
+    };
+
+    void
+    diag(long xoff, long xlim, long yoff, long ylim, bool findMinimal,
+         Partition &part)
+    {
+        int *fd = &fdiag[0] + offset;
+        int *bd = &bdiag[0] + offset;
+        const long dmin = xoff - ylim;
+        const long dmax = xlim - yoff;
+        const long fmid = xoff - yoff;
+        const long bmid = xlim - ylim;
+        long fmin = fmid, fmax = fmid;
+        long bmin = bmid, bmax = bmid;
+        const bool odd = (fmid - bmid) & 1;
+
+        fd[fmid] = xoff;
+        bd[bmid] = xlim;
+
+        for (long c = 1;; ++c) {
+            long d;
+
+            /* Extend the forward search by one edit */
+            if (fmin > dmin) {
+                fd[--fmin - 1] = -1;
+            } else {
+                ++fmin;
+            }
+            if (fmax < dmax) {
+                fd[++fmax + 1] = -1;
+            } else {
+                --fmax;
+            }
+            for (d = fmax; d >= fmin; d -= 2) {
+                long tlo = fd[d - 1];
+                long thi = fd[d + 1];
+                long x = tlo >= thi ? tlo + 1 : thi;
+                long y = x - d;
+                while (x < xlim && y < ylim && xv[x] == yv[y]) {
+                    ++x;
+                    ++y;
+                }
+                fd[d] = x;
+                if (odd && bmin <= d && d <= bmax && bd[d] <= x) {
+                    part.xmid = x;
+                    part.ymid = y;
+                    part.loMinimal = part.hiMinimal = true;
+                    return;
+                }
+            }
+
+            /* Extend the backward search by one edit */
+            if (bmin > dmin) {
+                bd[--bmin - 1] = INT_MAX;
+            } else {
+                ++bmin;
+            }
+            if (bmax < dmax) {
+                bd[++bmax + 1] = INT_MAX;
+            } else {
+                --bmax;
+            }
+            for (d = bmax; d >= bmin; d -= 2) {
+                long tlo = bd[d - 1];
+                long thi = bd[d + 1];
+                long x = tlo < thi ? tlo : thi - 1;
+                long y = x - d;
+                while (x > xoff && y > yoff && xv[x - 1] == yv[y - 1]) {
+                    --x;
+                    --y;
+                }
+                bd[d] = x;
+                if (!odd && fmin <= d && d <= fmax && x <= fd[d]) {
+                    part.xmid = x;
+                    part.ymid = y;
+                    part.loMinimal = part.hiMinimal = true;
+                    return;
+                }
+            }
+
+            if (findMinimal || c < tooExpensive) {
+                continue;
+            }
+
+            /*
+             * Too expensive: settle for the diagonal which got furthest,
+             * either forward or backward.
+             */
+            long fxybest = -1, fxbest = xoff;
+            for (d = fmax; d >= fmin; d -= 2) {
+                long x = std::min<long>(fd[d], xlim);
+                long y = x - d;
+                if (ylim < y) {
+                    x = ylim + d;
+                    y = ylim;
+                }
+                if (fxybest < x + y) {
+                    fxybest = x + y;
+                    fxbest = x;
+                }
+            }
+
+            long bxybest = INT_MAX, bxbest = xlim;
+            for (d = bmax; d >= bmin; d -= 2) {
+                long x = std::max<long>(xoff, bd[d]);
+                long y = x - d;
+                if (y < yoff) {
+                    x = yoff + d;
+                    y = yoff;
+                }
+                if (x + y < bxybest) {
+                    bxybest = x + y;
+                    bxbest = x;
+                }
+            }
+
+            if ((xlim + ylim) - bxybest < fxybest - (xoff + yoff)) {
+                part.xmid = fxbest;
+                part.ymid = fxybest - fxbest;
+                part.loMinimal = true;
+                part.hiMinimal = false;
+            } else {
+                part.xmid = bxbest;
+                part.ymid = bxybest - bxbest;
+                part.loMinimal = false;
+                part.hiMinimal = true;
+            }
+            return;
+        }
+    }
+
+public:
+    /* Whether each element of x was deleted, or of y inserted */
+    std::vector<bool> xchanged;
+    std::vector<bool> ychanged;
+
+    void
+    diff(const T *x, long xsize,
+         const T *y, long ysize)
+    {
+        xv = x;
+        yv = y;
+        xchanged.assign(xsize, false);
+        ychanged.assign(ysize, false);
+
+        long diags = xsize + ysize + 3;
+        fdiag.resize(diags);
+        bdiag.resize(diags);
+        offset = ysize + 1;
+
+        tooExpensive = 1;
+        for (long d = diags; d != 0; d >>= 2) {
+            tooExpensive <<= 1;
+        }
+        tooExpensive = std::max(tooExpensive, 4096L);
+
+        /*
+         * Divide and conquer with an explicit stack, as the recursion depth
+         * grows with the number of differences.
+         */
+        std::vector<Range> stack;
+        Range whole = {0, xsize, 0, ysize, false};
+        stack.push_back(whole);
+        while (!stack.empty()) {
+            Range r = stack.back();
+            stack.pop_back();
+
+            /* Skip common prefix and suffix */
+            while (r.xoff < r.xlim && r.yoff < r.ylim && xv[r.xoff] == yv[r.yoff]) {
+                ++r.xoff;
+                ++r.yoff;
+            }
+            while (r.xoff < r.xlim && r.yoff < r.ylim && xv[r.xlim - 1] == yv[r.ylim - 1]) {
+                --r.xlim;
+                --r.ylim;
+            }
+
+            if (r.xoff == r.xlim) {
+                for (long i = r.yoff; i < r.ylim; ++i) {
+                    ychanged[i] = true;
+                }
+            } else if (r.yoff == r.ylim) {
+                for (long i = r.xoff; i < r.xlim; ++i) {
+                    xchanged[i] = true;
+                }
+            } else {
+                Partition part;
+                diag(r.xoff, r.xlim, r.yoff, r.ylim, r.findMinimal, part);
+
+                Range lo = {r.xoff, part.xmid, r.yoff, part.ymid, part.loMinimal};
+                Range hi = {part.xmid, r.xlim, part.ymid, r.ylim, part.hiMinimal};
+                stack.push_back(hi);
+                stack.push_back(lo);
+            }
+        }
+    }
+};
+
+
+/**
+ * Writes the differences in the same format as tracediff.py's python
+ * differ.
+ */
+class DiffWriter
+{
+    CallReader &refReader;
+    CallReader &srcReader;
+    std::ostream &os;
+    bool color;
+    bool callNos;
+    size_t aSpace;
+    size_t bSpace;
+
+    const char *normal;
+    const char *bold;
+    const char *strike;
+    const char *red;
+    const char *green;
+
+    trace::Call *
+    nextRef(void) {
+        trace::Call *call = refReader.next();
+        assert(call);
+        return call;
+    }
+
+    trace::Call *
+    nextSrc(void) {
+        trace::Call *call = srcReader.next();
+        assert(call);
+        return call;
+    }
+
+    void
+    writeValue(trace::Value *value) {
+        if (value) {
+            trace::dump(value, os, trace::DUMP_FLAG_NO_COLOR);
+        } else {
+            os << "?";
+        }
+    }
+
+    void
+    writeCallNos(const trace::Call *a, const trace::Call *b) {
+        if (!callNos) {
+            return;
+        }
+
+        if (a) {
+            std::ostringstream no;
+            no << a->no;
+            os << strike << red << no.str() << normal;
+            aSpace = no.str().length();
+        } else {
+            os << std::string(aSpace, ' ');
+        }
+        os << " ";
+        if (b) {
+            std::ostringstream no;
+            no << b->no;
+            os << green << no.str() << normal;
+            bSpace = no.str().length();
+        } else {
+            os << std::string(bSpace, ' ');
+        }
+        os << " ";
+    }
+
+    void
+    writeCall(const trace::Call *call) {
+        os << bold << call->name() << normal;
+        os << "(";
+        for (unsigned i = 0; i < call->args.size(); ++i) {
+            if (i) {
+                os << ", ";
+            }
+            writeValue(call->args[i].value);
+        }
+        os << ")";
+        if (call->ret) {
+            os << " = ";
+            writeValue(call->ret);
+        }
+        os << normal << "\n";
+    }
+
+    void
+    replaceValue(trace::Value *a, trace::Value *b) {
+        if (hashValue(a) == hashValue(b)) {
+            writeValue(b);
+        } else {
+            os << strike << red;
+            writeValue(a);
+            os << normal << " " << green;
+            writeValue(b);
+            os << normal;
+        }
+    }
+
+    void
+    equal(long count) {
+        for (long i = 0; i < count; ++i) {
+            trace::Call *a = nextRef();
+            trace::Call *b = nextSrc();
+            os << "  ";
+            writeCallNos(a, b);
+            writeCall(b);
+            delete a;
+            delete b;
+        }
+    }
+
+    void
+    remove(long count) {
+        for (long i = 0; i < count; ++i) {
+            trace::Call *a = nextRef();
+            os << "- ";
+            writeCallNos(a, NULL);
+            os << strike << red;
+            writeCall(a);
+            delete a;
+        }
+    }
+
+    void
+    insert(long count) {
+        for (long i = 0; i < count; ++i) {
+            trace::Call *b = nextSrc();
+            os << "+ ";
+            writeCallNos(NULL, b);
+            os << green;
+            writeCall(b);
+            delete b;
+        }
+    }
+
+    /* Same calls with different arguments */
+    void
+    replaceSimilar(long count) {
+        for (long i = 0; i < count; ++i) {
+            trace::Call *a = nextRef();
+            trace::Call *b = nextSrc();
+            os << "| ";
+            writeCallNos(a, b);
+            os << bold << b->name() << normal;
+            os << "(";
+            size_t numArgs = std::max(a->args.size(), b->args.size());
+            for (size_t j = 0; j < numArgs; ++j) {
+                if (j) {
+                    os << ", ";
+                }
+                replaceValue(j < a->args.size() ? a->args[j].value : NULL,
+                             j < b->args.size() ? b->args[j].value : NULL);
+            }
+            os << ")";
+            if (a->ret || b->ret) {
+                os << " = ";
+                replaceValue(a->ret, b->ret);
+            }
+            os << "\n";
+            delete a;
+            delete b;
+        }
+    }
+
+    void
+    replaceDissimilar(long acount, long bcount) {
+        if (bcount < acount) {
+            insert(bcount);
+            remove(acount);
+        } else {
+            remove(acount);
+            insert(bcount);
+        }
+    }
+
+    /*
+     * Pair up the calls of a changed block by name, to tell changed
+     * arguments apart from different calls.
+     */
+    void
+    replace(const CallHashes &ref, long alo, long ahi,
+            const CallHashes &src, long blo, long bhi)
+    {
+        SequenceDiffer<unsigned> differ;
+        differ.diff(&ref.names[alo], ahi - alo, &src.names[blo], bhi - blo);
+
+        long i = 0, j = 0;
+        const long n = ahi - alo, m = bhi - blo;
+        while (i < n || j < m) {
+            long i0 = i, j0 = j;
+            while (i < n && j < m && !differ.xchanged[i] && !differ.ychanged[j]) {
+                ++i;
+                ++j;
+            }
+            if (i > i0) {
+                replaceSimilar(i - i0);
+                continue;
+            }
+            while (i < n && differ.xchanged[i]) {
+                ++i;
+            }
+            while (j < m && differ.ychanged[j]) {
+                ++j;
+            }
+            replaceDissimilar(i - i0, j - j0);
+        }
+    }
+
+public:
+    DiffWriter(CallReader &ref, CallReader &src, std::ostream &_os,
+               bool _color, bool _callNos) :
+        refReader(ref),
+        srcReader(src),
+        os(_os),
+        color(_color),
+        callNos(_callNos),
+        aSpace(0),
+        bSpace(0)
+    {
+        if (color) {
+            normal = "\33[0m";
+            bold = "\33[1m";
+            strike = "\33[9m";
+            red = "\33[31m";
+            green = "\33[32m";
+        } else {
+            normal = bold = strike = red = green = "";
+        }
+    }
+
+    void
+    write(const CallHashes &ref, const CallHashes &src) {
+        SequenceDiffer<unsigned long long> differ;
+        differ.diff(ref.calls.empty() ? NULL : &ref.calls[0], ref.calls.size(),
+                    src.calls.empty() ? NULL : &src.calls[0], src.calls.size());
+
+        long i = 0, j = 0;
+        const long n = ref.calls.size(), m = src.calls.size();
+        while (i < n || j < m) {
+            long i0 = i, j0 = j;
+            while (i < n && j < m && !differ.xchanged[i] && !differ.ychanged[j]) {
+                ++i;
+                ++j;
+            }
+            if (i > i0) {
+                equal(i - i0);
+                continue;
+            }
+            while (i < n && differ.xchanged[i]) {
+                ++i;
+            }
+            while (j < m && differ.ychanged[j]) {
+                ++j;
+            }
+            if (i == i0) {
+                insert(j - j0);
+            } else if (j == j0) {
+                remove(i - i0);
+            } else {
+                replace(ref, i0, i, src, j0, j);
+            }
+        }
+    }
+};
+
+
 static int
-command(int argc, char *argv[])
+nativeDiff(const char *refTrace, const char *refCalls,
+           const char *srcTrace, const char *srcCalls,
+           bool callNos)
 {
-    int i;
+    /* First pass: hash every call */
+    CallHashes ref, src;
+    {
+        CallReader refReader, srcReader;
+        if (!refReader.open(refTrace, refCalls) ||
+            !srcReader.open(srcTrace, srcCalls)) {
+            return 1;
+        }
+        ref.read(refReader);
+        src.read(srcReader);
+    }
+
+    bool color = false;
+#ifndef _WIN32
+    if (isatty(STDOUT_FILENO)) {
+        color = true;
+        pipepager();
+    }
+#endif
 
+    /* Second pass: stream the calls again while writing the differences */
+    CallReader refReader, srcReader;
+    if (!refReader.open(refTrace, refCalls) ||
+        !srcReader.open(srcTrace, srcCalls)) {
+        return 1;
+    }
+
+    DiffWriter writer(refReader, srcReader, std::cout, color, callNos);
+    writer.write(ref, src);
+    std::cout.flush();
+
+    return 0;
+}
+
+
+static int
+scriptDiff(int argc, char *argv[])
+{
     os::String command = find_command();
     if (!command.length()) {
         return 1;
@@ -75,7 +886,7 @@ command(int argc, char *argv[])
     args.push_back(command.str());
     args.push_back("--apitrace");
     args.push_back(apitracePath.str());
-    for (i = 1; i < argc; i++) {
+    for (int i = 1; i < argc; i++) {
         args.push_back(argv[i]);
     }
     args.push_back(NULL);
@@ -83,6 +894,66 @@ command(int argc, char *argv[])
     return os::execute((char * const *)&args[0]);
 }
 
+
+static int
+command(int argc, char *argv[])
+{
+    /* getopt permutes argv, so keep the original for the script */
+    std::vector<char *> originalArgv(argv, argv + argc);
+
+    const char *tool = "native";
+    const char *calls = "*";
+    const char *refCalls = NULL;
+    const char *srcCalls = NULL;
+    bool callNos = false;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, shortOptions, longOptions, NULL)) != -1) {
+        switch (opt) {
+        case 'h':
+            usage();
+            return 0;
+        case 'd':
+            tool = optarg;
+            break;
+        case 'c':
+            calls = optarg;
+            break;
+        case REF_CALLS_OPT:
+            refCalls = optarg;
+            break;
+        case SRC_CALLS_OPT:
+            srcCalls = optarg;
+            break;
+        case CALL_NOS_OPT:
+            callNos = true;
+            break;
+        case 'w':
+            break;
+        default:
+            std::cerr << "error: unexpected option `" << (char)opt << "`\n";
+            usage();
+            return 1;
+        }
+    }
+
+    /* The python differ is superseded by the native one */
+    if (strcmp(tool, "native") != 0 &&
+        strcmp(tool, "python") != 0) {
+        return scriptDiff(argc, &originalArgv[0]);
+    }
+
+    if (argc - optind != 2) {
+        std::cerr << "error: two trace files expected\n";
+        usage();
+        return 1;
+    }
+
+    return nativeDiff(argv[optind], refCalls ? refCalls : calls,
+                      argv[optind + 1], srcCalls ? srcCalls : calls,
+                      callNos);
+}
+
 const Command diff_command = {
     "diff",
     synopsis,
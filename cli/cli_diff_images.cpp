@@ -25,58 +25,961 @@
  *
  *********************************************************************/
 
+/*
+ * Native replacement for scripts/snapdiff.py.
+ *
+ * Image pairs are compared by a pool of worker threads; the main thread
+ * emits the HTML report rows in order as the results become available, so
+ * the report is identical to the one the script produced.
+ */
+
+
+#include <assert.h>
 #include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <limits.h> // for CHAR_MAX
+#include <getopt.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+
+#include <algorithm>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
 
 #include "cli.hpp"
-#include "os_string.hpp"
-#include "os_process.hpp"
-#include "cli_resources.hpp"
+#include "os_thread.hpp"
+#include "image.hpp"
+
 
 static const char *synopsis = "Identify differences between two image dumps.";
 
-static os::String
-find_command(void)
+static const unsigned thumbSize = 320;
+
+
+static void
+usage(void)
+{
+    std::cout
+        << "usage: apitrace diff-images [OPTIONS] REF_PREFIX SRC_PREFIX\n"
+        << synopsis << "\n"
+        "\n"
+        "    -h, --help             show this help message and exit\n"
+        "    -v, --verbose          verbose output\n"
+        "    -o, --output=FILE      output filename [default: index.html]\n"
+        "    -f, --fuzz=FUZZ        fuzz ratio [default: 0.05]\n"
+        "    -a, --alpha            take alpha channel in consideration\n"
+        "        --overwrite        overwrite images\n"
+        "        --show-all         show all images, including similar ones\n"
+        "    -j, --jobs=N           number of images to compare in parallel\n"
+        "                           [default: number of processors]\n"
+        "\n";
+}
+
+enum {
+    OVERWRITE_OPT = CHAR_MAX + 1,
+    SHOW_ALL_OPT,
+};
+
+const static char *
+shortOptions = "hvo:f:aj:";
+
+const static struct option
+longOptions[] = {
+    {"help", no_argument, 0, 'h'},
+    {"verbose", no_argument, 0, 'v'},
+    {"output", required_argument, 0, 'o'},
+    {"fuzz", required_argument, 0, 'f'},
+    {"alpha", no_argument, 0, 'a'},
+    {"overwrite", no_argument, 0, OVERWRITE_OPT},
+    {"show-all", no_argument, 0, SHOW_ALL_OPT},
+    {"jobs", required_argument, 0, 'j'},
+    {0, 0, 0, 0}
+};
+
+
+static bool verbose = false;
+static double fuzz = 0.05;
+static bool alpha = false;
+static bool overwrite = false;
+static bool showAll = false;
+
+
+/*
+ * File system helpers.
+ */
+
+static bool
+getMtime(const std::string &path, double &mtime)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return false;
+    }
+#if defined(__linux__)
+    mtime = st.st_mtim.tv_sec + st.st_mtim.tv_nsec * 1e-9;
+#else
+    mtime = st.st_mtime;
+#endif
+    return true;
+}
+
+static inline bool
+fileExists(const std::string &path)
+{
+    double mtime;
+    return getMtime(path, mtime);
+}
+
+/**
+ * Whether the file derived from source needs to be (re)generated.
+ */
+static bool
+isStale(const std::string &derived, const std::string &source)
 {
-    return findScript("snapdiff.py");
+    double derivedMtime, sourceMtime;
+    if (!getMtime(source, sourceMtime)) {
+        return false;
+    }
+    return !getMtime(derived, derivedMtime) || derivedMtime < sourceMtime;
+}
+
+static bool
+isDirectory(const std::string &path)
+{
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && (st.st_mode & S_IFMT) == S_IFDIR;
+}
+
+static inline bool
+isSep(char c)
+{
+#ifdef _WIN32
+    return c == '/' || c == '\\';
+#else
+    return c == '/';
+#endif
+}
+
+static std::string
+joinPath(const std::string &dirname, const std::string &basename)
+{
+    if (dirname.empty()) {
+        return basename;
+    }
+    if (isSep(dirname[dirname.length() - 1])) {
+        return dirname + basename;
+    }
+    return dirname + '/' + basename;
+}
+
+/**
+ * Split the extension (including the dot) from a path.
+ */
+static std::string
+splitExt(const std::string &path, std::string &ext)
+{
+    size_t dot = path.rfind('.');
+    size_t sep = path.length();
+    while (sep > 0 && !isSep(path[sep - 1])) {
+        --sep;
+    }
+    if (dot == std::string::npos || dot <= sep) {
+        ext.clear();
+        return path;
+    }
+    ext = path.substr(dot);
+    return path.substr(0, dot);
 }
 
 static void
-usage(void)
+listDirectory(const std::string &dirname,
+              std::vector<std::string> &names)
+{
+#ifdef _WIN32
+    WIN32_FIND_DATAA data;
+    HANDLE hFind = FindFirstFileA(joinPath(dirname.empty() ? "." : dirname, "*").c_str(), &data);
+    if (hFind == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    do {
+        names.push_back(data.cFileName);
+    } while (FindNextFileA(hFind, &data));
+    FindClose(hFind);
+#else
+    DIR *dir = opendir(dirname.empty() ? "." : dirname.c_str());
+    if (!dir) {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        names.push_back(entry->d_name);
+    }
+    closedir(dir);
+#endif
+}
+
+
+static bool
+isImage(const std::string &path)
 {
-    os::String command = find_command();
-    if (!command.length()) {
-        exit(1);
+    size_t sep = path.length();
+    while (sep > 0 && !isSep(path[sep - 1])) {
+        --sep;
     }
+    std::string ext1, ext2;
+    std::string name = splitExt(path.substr(sep), ext1);
+    splitExt(name, ext2);
+    return (ext1 == ".png" || ext1 == ".bmp" || ext1 == ".qoi") &&
+           ext2 != ".diff" && ext2 != ".thumb" && ext2 != ".qoi";
+}
 
-    char *args[4];
-    args[0] = (char *) "python";
-    args[1] = (char *) command.str();
-    args[2] = (char *) "--help";
-    args[3] = NULL;
+static void
+walkImages(const std::string &dirname,
+           const std::string &prefix,
+           std::vector<std::string> &images)
+{
+    std::vector<std::string> names;
+    listDirectory(dirname, names);
+    std::sort(names.begin(), names.end());
 
-    os::execute(args);
+    for (size_t i = 0; i < names.size(); ++i) {
+        const std::string &name = names[i];
+        if (name == "." || name == "..") {
+            continue;
+        }
+        std::string path = joinPath(dirname, name);
+        if (isDirectory(path)) {
+            walkImages(path, prefix, images);
+        } else if (path.compare(0, prefix.length(), prefix) == 0 &&
+                   isImage(path)) {
+            images.push_back(path.substr(prefix.length()));
+        }
+    }
 }
 
+/**
+ * Find all images whose path starts with prefix, returning the paths with
+ * the prefix stripped.
+ */
+static void
+findImages(const std::string &prefix,
+           std::vector<std::string> &images)
+{
+    std::string dirname;
+    if (isDirectory(prefix)) {
+        dirname = prefix;
+    } else {
+        size_t sep = prefix.length();
+        while (sep > 0 && !isSep(prefix[sep - 1])) {
+            --sep;
+        }
+        dirname = prefix.substr(0, sep);
+        while (dirname.length() > 1 && isSep(dirname[dirname.length() - 1])) {
+            dirname.resize(dirname.length() - 1);
+        }
+    }
+
+    walkImages(dirname, prefix, images);
+
+    std::sort(images.begin(), images.end());
+}
+
+
+/*
+ * Image helpers.
+ */
+
+static bool
+hasExtension(const std::string &path, const char *ext)
+{
+    size_t len = strlen(ext);
+    return path.length() >= len &&
+           path.compare(path.length() - len, len, ext) == 0;
+}
+
+static image::Image *
+readImage(const std::string &filename)
+{
+    if (hasExtension(filename, ".qoi")) {
+        return image::readQOI(filename.c_str());
+    }
+    if (hasExtension(filename, ".png")) {
+        return image::readPNG(filename.c_str());
+    }
+    return NULL;
+}
+
+static bool
+writeImage(const image::Image &image, const std::string &filename)
+{
+    if (hasExtension(filename, ".bmp")) {
+        return image.writeBMP(filename.c_str());
+    }
+    return image.writePNG(filename.c_str());
+}
+
+/**
+ * Convert an 8bit image to RGB (or RGBA), like PIL's Image.convert does,
+ * taking ownership of the original.
+ */
+static image::Image *
+convertImage(image::Image *src, unsigned channels)
+{
+    assert(channels == 3 || channels == 4);
+
+    if (!src || src->channels == channels) {
+        return src;
+    }
+
+    image::Image *dst = new image::Image(src->width, src->height, channels);
+
+    const unsigned char *srcRow = src->start();
+    unsigned char *dstRow = dst->start();
+    for (unsigned y = 0; y < src->height; ++y) {
+        const unsigned char *s = srcRow;
+        unsigned char *d = dstRow;
+        for (unsigned x = 0; x < src->width; ++x) {
+            unsigned char r, g, b, a;
+            switch (src->channels) {
+            case 1:
+                r = g = b = s[0];
+                a = 0xff;
+                break;
+            case 2:
+                r = g = b = s[0];
+                a = s[1];
+                break;
+            case 3:
+                r = s[0];
+                g = s[1];
+                b = s[2];
+                a = 0xff;
+                break;
+            default:
+                r = s[0];
+                g = s[1];
+                b = s[2];
+                a = s[3];
+                break;
+            }
+            d[0] = r;
+            d[1] = g;
+            d[2] = b;
+            if (channels == 4) {
+                d[3] = a;
+            }
+            s += src->channels;
+            d += channels;
+        }
+        srcRow += src->stride();
+        dstRow += dst->stride();
+    }
+
+    delete src;
+    return dst;
+}
+
+/**
+ * Downscale with a box filter to fit in a size x size box, preserving the
+ * aspect ratio like PIL's Image.thumbnail.
+ */
+static image::Image *
+thumbnail(const image::Image &src, unsigned size)
+{
+    unsigned width = src.width;
+    unsigned height = src.height;
+    if (width > size) {
+        height = std::max(height * size / width, 1U);
+        width = size;
+    }
+    if (height > size) {
+        width = std::max(width * size / height, 1U);
+        height = size;
+    }
+
+    const unsigned channels = src.channels;
+    image::Image *dst = new image::Image(width, height, channels);
+
+    std::vector<unsigned> sums(channels);
+    unsigned char *dstRow = dst->start();
+    for (unsigned y = 0; y < height; ++y) {
+        unsigned y0 = y * src.height / height;
+        unsigned y1 = std::max((y + 1) * src.height / height, y0 + 1);
+        unsigned char *d = dstRow;
+        for (unsigned x = 0; x < width; ++x) {
+            unsigned x0 = x * src.width / width;
+            unsigned x1 = std::max((x + 1) * src.width / width, x0 + 1);
+            std::fill(sums.begin(), sums.end(), 0);
+            for (unsigned sy = y0; sy < y1; ++sy) {
+                const unsigned char *s = src.start() + sy*src.stride() + x0*channels;
+                for (unsigned sx = x0; sx < x1; ++sx) {
+                    for (unsigned c = 0; c < channels; ++c) {
+                        sums[c] += s[c];
+                    }
+                    s += channels;
+                }
+            }
+            unsigned count = (y1 - y0) * (x1 - x0);
+            for (unsigned c = 0; c < channels; ++c) {
+                d[c] = (sums[c] + count/2) / count;
+            }
+            d += channels;
+        }
+        dstRow += dst->stride();
+    }
+
+    return dst;
+}
+
+
+/*
+ * Comparison kernels.
+ *
+ * These are written as straight loops over bytes without branches or
+ * cross-iteration dependencies so that the compiler vectorizes them.
+ */
+
+static void
+absDiffRow(const unsigned char *a,
+           const unsigned char *b,
+           unsigned char *diff,
+           unsigned n)
+{
+    for (unsigned i = 0; i < n; ++i) {
+        unsigned char x = a[i];
+        unsigned char y = b[i];
+        diff[i] = x > y ? x - y : y - x;
+    }
+}
+
+/**
+ * Luminance as computed by PIL's RGB to L conversion.
+ */
+static inline unsigned
+luminance(unsigned r, unsigned g, unsigned b)
+{
+    return (r*19595 + g*38470 + b*7471 + 0x8000) >> 16;
+}
+
+/**
+ * Same as PIL's DIV255 macro.
+ */
+static inline unsigned
+div255(unsigned v)
+{
+    v += 128;
+    return ((v >> 8) + v) >> 8;
+}
+
+
+struct Stats
+{
+    unsigned long long mismatches;
+    unsigned max[4];
+    unsigned long long sum[4];
+};
+
+
+class Comparer
+{
+public:
+    image::Image *ref;
+    image::Image *src;
+    unsigned channels;
+
+    Comparer(const std::string &refFilename,
+             const std::string &srcFilename)
+    {
+        channels = alpha ? 4 : 3;
+        ref = convertImage(readImage(refFilename), channels);
+        src = convertImage(readImage(srcFilename), channels);
+    }
+
+    ~Comparer() {
+        delete ref;
+        delete src;
+    }
+
+    bool
+    sizeMismatch(void) const {
+        return ref->width != src->width || ref->height != src->height;
+    }
+
+    /**
+     * Count the pixels whose difference exceeds the fuzz, and gather per
+     * channel statistics.
+     */
+    void
+    compare(Stats &stats) const;
+
+    /**
+     * Make a difference image similar to ImageMagick's compare utility.
+     */
+    bool
+    writeDiff(const std::string &filename) const;
+};
+
+
+void
+Comparer::compare(Stats &stats) const
+{
+    memset(&stats, 0, sizeof stats);
+
+    assert(!sizeMismatch());
+
+    const unsigned threshold = unsigned(255 * fuzz);
+    const unsigned width = src->width;
+    const unsigned rowSize = width * channels;
+
+    std::vector<unsigned char> diff(rowSize);
+
+    const unsigned char *refRow = ref->start();
+    const unsigned char *srcRow = src->start();
+    for (unsigned y = 0; y < src->height; ++y) {
+        // Rendering regressions rarely touch most rows
+        if (memcmp(refRow, srcRow, rowSize) != 0) {
+            absDiffRow(srcRow, refRow, &diff[0], rowSize);
+
+            unsigned rowMax[4] = {0, 0, 0, 0};
+            unsigned rowSum[4] = {0, 0, 0, 0};
+            unsigned rowMismatches = 0;
+            const unsigned char *d = &diff[0];
+            for (unsigned x = 0; x < width; ++x) {
+                unsigned level = luminance(d[0], d[1], d[2]);
+                if (channels == 4) {
+                    level = std::max(level, (unsigned)d[3]);
+                }
+                rowMismatches += level > threshold;
+                for (unsigned c = 0; c < channels; ++c) {
+                    rowMax[c] = std::max(rowMax[c], (unsigned)d[c]);
+                    rowSum[c] += d[c];
+                }
+                d += channels;
+            }
+
+            stats.mismatches += rowMismatches;
+            for (unsigned c = 0; c < channels; ++c) {
+                stats.max[c] = std::max(stats.max[c], rowMax[c]);
+                stats.sum[c] += rowSum[c];
+            }
+        }
+        refRow += ref->stride();
+        srcRow += src->stride();
+    }
+}
+
+
+bool
+Comparer::writeDiff(const std::string &filename) const
+{
+    if (sizeMismatch()) {
+        return false;
+    }
+
+    static const unsigned char highlight[3] = {0xf1, 0x00, 0x1e};
+    const float factor = fuzz > 0 ? float(1.0/fuzz) : 0.0f;
+    const float opacity = 0xcc/255.0f;
+    const unsigned width = src->width;
+    const unsigned rowSize = width * channels;
+
+    image::Image out(width, src->height, 3);
+    std::vector<unsigned char> diff(rowSize);
+
+    const unsigned char *refRow = ref->start();
+    const unsigned char *srcRow = src->start();
+    unsigned char *outRow = out.start();
+    for (unsigned y = 0; y < src->height; ++y) {
+        absDiffRow(srcRow, refRow, &diff[0], rowSize);
+
+        const unsigned char *d = &diff[0];
+        const unsigned char *s = srcRow;
+        unsigned char *o = outRow;
+        for (unsigned x = 0; x < width; ++x) {
+            // Brighten the difference by 1/fuzz, and use it as the mask
+            unsigned bright[3];
+            for (unsigned c = 0; c < 3; ++c) {
+                float v = fuzz > 0 ? d[c] * factor : (d[c] ? 255 : 0);
+                bright[c] = v <= 0 ? 0 : v < 256 ? unsigned(v) : 255;
+            }
+            unsigned mask = luminance(bright[0], bright[1], bright[2]);
+
+            for (unsigned c = 0; c < 3; ++c) {
+                // Composite the highlight over white
+                unsigned overlay = div255(0xff*(255 - mask) + highlight[c]*mask);
+
+                // Blend with the source image
+                float v = s[c] + opacity*((int)overlay - (int)s[c]);
+                o[c] = v <= 0 ? 0 : v < 256 ? (unsigned char)v : 255;
+            }
+
+            d += channels;
+            s += channels;
+            o += 3;
+        }
+
+        refRow += ref->stride();
+        srcRow += src->stride();
+        outRow += out.stride();
+    }
+
+    return writeImage(out, filename);
+}
+
+
+/*
+ * Report.
+ */
+
+static void
+surface(std::ostream &html, std::string image)
+{
+    if (hasExtension(image, ".qoi")) {
+        // Browsers can't show QOI images, so link to a PNG copy instead
+        std::string png = image + ".png";
+        if (isStale(png, image)) {
+            image::Image *im = image::readQOI(image.c_str());
+            if (im) {
+                im->writePNG(png.c_str());
+                delete im;
+            }
+        }
+        image = png;
+    }
+
+    std::string ext;
+    std::string thumb = splitExt(image, ext) + ".thumb" + ext;
+    if (isStale(thumb, image)) {
+        image::Image *im = readImage(image);
+        if (im) {
+            unsigned imageWidth = im->width;
+            unsigned imageHeight = im->height;
+            if (imageWidth <= thumbSize && imageHeight <= thumbSize) {
+                delete im;
+                if (imageWidth >= imageHeight) {
+                    imageHeight = imageHeight*thumbSize/imageWidth;
+                    imageWidth = thumbSize;
+                } else {
+                    imageWidth = imageWidth*thumbSize/imageHeight;
+                    imageHeight = thumbSize;
+                }
+                html << "        <td><img src=\"" << image << "\" width=\"" << imageWidth << "\" height=\"" << imageHeight << "\"/></td>\n";
+                return;
+            }
+
+            image::Image *th = thumbnail(*im, thumbSize);
+            writeImage(*th, thumb);
+            delete th;
+            delete im;
+        }
+    }
+    html << "        <td><a href=\"" << image << "\"><img src=\"" << thumb << "\"/></a></td>\n";
+}
+
+
+struct Job
+{
+    std::string name;
+    bool done;
+    bool match;
+    std::string row;
+    std::string log;
+};
+
+
+class DiffPool
+{
+    const std::string &refPrefix;
+    const std::string &srcPrefix;
+
+    std::vector<Job> &jobs;
+    size_t nextJob;
+
+    os::mutex mutex;
+    os::condition_variable doneCond;
+
+    std::vector<os::thread> threads;
+
+    static void *
+    workerThread(DiffPool *_this);
+
+    void
+    runWorker(void);
+
+    void
+    run(Job &job);
+
+public:
+    DiffPool(const std::string &refPrefix,
+             const std::string &srcPrefix,
+             std::vector<Job> &jobs,
+             unsigned numThreads);
+
+    ~DiffPool();
+
+    /**
+     * Wait for the given job to complete.
+     */
+    Job &
+    wait(size_t i);
+};
+
+
+DiffPool::DiffPool(const std::string &_refPrefix,
+                   const std::string &_srcPrefix,
+                   std::vector<Job> &_jobs,
+                   unsigned numThreads) :
+    refPrefix(_refPrefix),
+    srcPrefix(_srcPrefix),
+    jobs(_jobs),
+    nextJob(0)
+{
+    for (unsigned i = 0; i < numThreads; ++i) {
+        threads.push_back(os::thread(workerThread, this));
+    }
+}
+
+
+DiffPool::~DiffPool() {
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+    }
+}
+
+
+void *
+DiffPool::workerThread(DiffPool *_this) {
+    _this->runWorker();
+    return 0;
+}
+
+
+void
+DiffPool::runWorker(void) {
+    while (true) {
+        size_t i;
+        {
+            os::unique_lock<os::mutex> lock(mutex);
+            if (nextJob >= jobs.size()) {
+                break;
+            }
+            i = nextJob++;
+        }
+
+        run(jobs[i]);
+
+        {
+            os::unique_lock<os::mutex> lock(mutex);
+            jobs[i].done = true;
+        }
+        doneCond.signal();
+    }
+}
+
+
+Job &
+DiffPool::wait(size_t i) {
+    os::unique_lock<os::mutex> lock(mutex);
+    while (!jobs[i].done) {
+        doneCond.wait(lock);
+    }
+    return jobs[i];
+}
+
+
+void
+DiffPool::run(Job &job) {
+    std::string refImage = refPrefix + job.name;
+    std::string srcImage = srcPrefix + job.name;
+    std::string ext;
+    std::string deltaImage = splitExt(srcImage, ext) + ".diff.png";
+
+    std::ostringstream log;
+    if (verbose) {
+        log << "Comparing " << refImage << " and " << srcImage << " ...";
+    }
+
+    Comparer comparer(refImage, srcImage);
+
+    if (!comparer.ref || !comparer.src) {
+        std::cerr << "error: failed to read " << (comparer.ref ? srcImage : refImage) << "\n";
+        job.match = false;
+    } else if (comparer.sizeMismatch()) {
+        job.match = false;
+        if (verbose) {
+            log << " MISMATCH (" << comparer.ref->width << "x" << comparer.ref->height
+                << " vs " << comparer.src->width << "x" << comparer.src->height << ")";
+        }
+    } else {
+        Stats stats;
+        comparer.compare(stats);
+        job.match = stats.mismatches == 0;
+        if (verbose) {
+            if (job.match) {
+                log << " MATCH";
+            } else {
+                double pixels = double(comparer.src->width) * comparer.src->height;
+                log << " MISMATCH (" << stats.mismatches << " pixels differ; max error";
+                for (unsigned c = 0; c < comparer.channels; ++c) {
+                    log << (c ? "/" : " ") << stats.max[c];
+                }
+                log << ", mean error";
+                for (unsigned c = 0; c < comparer.channels; ++c) {
+                    char buf[32];
+                    snprintf(buf, sizeof buf, "%.3f", pixels ? stats.sum[c] / pixels : 0.0);
+                    log << (c ? "/" : " ") << buf;
+                }
+                log << ")";
+            }
+        }
+    }
+    if (verbose) {
+        log << "\n";
+    }
+
+    const char *bgcolor = job.match ? "#20ff20" : "#ff2020";
+
+    std::ostringstream html;
+    html << "      <tr>\n";
+    html << "        <td bgcolor=\"" << bgcolor << "\"><a href=\"" << refImage << "\">" << job.name << "<a/></td>\n";
+    if (!job.match || showAll) {
+        if (comparer.ref && comparer.src) {
+            double deltaMtime, refMtime, srcMtime;
+            if (overwrite ||
+                !getMtime(deltaImage, deltaMtime) ||
+                (getMtime(refImage, refMtime) && deltaMtime < refMtime &&
+                 getMtime(srcImage, srcMtime) && deltaMtime < srcMtime)) {
+                comparer.writeDiff(deltaImage);
+            }
+        }
+        surface(html, refImage);
+        surface(html, srcImage);
+        surface(html, deltaImage);
+    }
+    html << "      </tr>\n";
+
+    job.row = html.str();
+    job.log = log.str();
+}
+
+
 static int
 command(int argc, char *argv[])
 {
-    int i;
+    const char *output = "index.html";
+    unsigned numThreads = os::thread::hardware_concurrency();
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, shortOptions, longOptions, NULL)) != -1) {
+        switch (opt) {
+        case 'h':
+            usage();
+            return 0;
+        case 'v':
+            verbose = true;
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'f':
+            fuzz = atof(optarg);
+            break;
+        case 'a':
+            alpha = true;
+            break;
+        case OVERWRITE_OPT:
+            overwrite = true;
+            break;
+        case SHOW_ALL_OPT:
+            showAll = true;
+            break;
+        case 'j':
+            numThreads = atoi(optarg);
+            break;
+        default:
+            std::cerr << "error: unexpected option `" << (char)opt << "`\n";
+            usage();
+            return 1;
+        }
+    }
 
-    os::String command = find_command();
-    if (!command.length()) {
+    if (argc - optind != 2) {
+        std::cerr << "error: incorrect number of arguments\n";
+        usage();
         return 1;
     }
 
-    std::vector<const char *> args;
-    args.push_back("python");
-    args.push_back(command.str());
-    for (i = 1; i < argc; i++) {
-        args.push_back(argv[i]);
+    std::string refPrefix = argv[optind];
+    std::string srcPrefix = argv[optind + 1];
+
+    std::vector<std::string> refImages;
+    std::vector<std::string> srcImages;
+    findImages(refPrefix, refImages);
+    findImages(srcPrefix, srcImages);
+
+    std::vector<std::string> images;
+    std::set_intersection(refImages.begin(), refImages.end(),
+                          srcImages.begin(), srcImages.end(),
+                          std::back_inserter(images));
+
+    std::ofstream file;
+    if (output[0]) {
+        file.open(output);
+        if (!file) {
+            std::cerr << "error: failed to open " << output << "\n";
+            return 1;
+        }
+    }
+    std::ostream &html = output[0] ? file : std::cout;
+
+    html << "<html>\n";
+    html << "  <body>\n";
+    html << "    <table border=\"1\">\n";
+    html << "      <tr><th>File</th><th>" << refPrefix << "</th><th>" << srcPrefix << "</th><th>&Delta;</th></tr>\n";
+
+    std::vector<Job> jobs(images.size());
+    for (size_t i = 0; i < images.size(); ++i) {
+        jobs[i].name = images[i];
+        jobs[i].done = false;
+        jobs[i].match = false;
     }
-    args.push_back(NULL);
 
-    return os::execute((char * const *)&args[0]);
+    unsigned failures = 0;
+    {
+        DiffPool pool(refPrefix, srcPrefix, jobs,
+                      std::max(std::min(numThreads, (unsigned)jobs.size()), 1U));
+
+        for (size_t i = 0; i < jobs.size(); ++i) {
+            Job &job = pool.wait(i);
+            if (!job.match) {
+                ++failures;
+            }
+            std::cout << job.log;
+            std::cout.flush();
+            html << job.row;
+            html.flush();
+
+            // Release the memory early
+            std::string().swap(job.row);
+            std::string().swap(job.log);
+        }
+    }
+
+    html << "    </table>\n";
+    html << "  </body>\n";
+    html << "</html>\n";
+
+    return failures ? 1 : 0;
 }
 
 const Command diff_images_command = {
@@ -25,15 +25,37 @@
  *
  *********************************************************************/
 
+/*
+ * Native replacement for scripts/jsondiff.py.
+ *
+ * Both state dumps are read in lockstep with a pull parser, so only the
+ * members that differ (or that appear in a different order) are ever held
+ * in memory.  Embedded images are compared by the hash of their data, and
+ * only decoded when the hashes differ.
+ *
+ * The output follows jsondiff.py's, so that existing tooling and habits keep
+ * working.
+ */
+
+
+#include <assert.h>
 #include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h> // for CHAR_MAX
+#include <math.h>
 #include <getopt.h>
 
+#include <algorithm>
 #include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
 
 #include "cli.hpp"
-#include "os_string.hpp"
-#include "os_process.hpp"
-#include "cli_resources.hpp"
+#include "image.hpp"
+
 
 static const char *synopsis = "Identify differences between two state dumps.";
 
@@ -41,21 +63,1518 @@ static void
 usage(void)
 {
     std::cout
-        << "usage: apitrace diff-state <state-1> <state-2>\n"
+        << "usage: apitrace diff-state [OPTIONS] <state-1> <state-2>\n"
         << synopsis << "\n"
         "\n"
-        "    Both input files should be the result of running 'glretrace -D XYZ <trace>'.\n";
+        "    Both input files should be the result of running 'glretrace -D XYZ <trace>'.\n"
+        "\n"
+        "    -h, --help             show this help message and exit\n"
+        "        --ignore-images    do not compare embedded images\n"
+        "\n";
 }
 
+enum {
+    IGNORE_IMAGES_OPT = CHAR_MAX + 1,
+};
+
 const static char *
 shortOptions = "h";
 
 const static struct option
 longOptions[] = {
     {"help", no_argument, 0, 'h'},
+    {"ignore-images", no_argument, 0, IGNORE_IMAGES_OPT},
     {0, 0, 0, 0}
 };
 
+
+static bool ignoreImages = false;
+
+/* Same relative tolerance as jsondiff.py */
+static const double tolerance = 1.0 / (1 << 24);
+
+
+static inline bool
+isReserved(const std::string &name)
+{
+    return name.length() >= 4 &&
+           name.compare(0, 2, "__") == 0 &&
+           name.compare(name.length() - 2, 2, "__") == 0;
+}
+
+
+/*
+ * Pull parser.
+ *
+ * Lenient in the same ways as jsondiff.py: it accepts // comments, raw
+ * control characters inside strings, and NaN/Infinity.  Commas are treated
+ * as whitespace.
+ */
+
+enum TokenType {
+    TOKEN_EOF = 0,
+    TOKEN_ERROR,
+    TOKEN_BEGIN_OBJECT,
+    TOKEN_END_OBJECT,
+    TOKEN_BEGIN_ARRAY,
+    TOKEN_END_ARRAY,
+    TOKEN_KEY,
+    TOKEN_STRING,
+    TOKEN_INT,
+    TOKEN_FLOAT,
+    TOKEN_TRUE,
+    TOKEN_FALSE,
+    TOKEN_NULL,
+};
+
+
+class Reader
+{
+public:
+    const char *filename;
+
+private:
+    FILE *file;
+    char buf[64 * 1024];
+    size_t pos;
+    size_t len;
+    long long bufOffset;
+
+    bool peeked;
+    TokenType type;
+    std::string text;
+    double number;
+
+    std::string error;
+
+    inline int
+    getChar(void) {
+        if (pos >= len) {
+            bufOffset += len;
+            pos = 0;
+            len = fread(buf, 1, sizeof buf, file);
+            if (!len) {
+                return EOF;
+            }
+        }
+        return (unsigned char)buf[pos++];
+    }
+
+    inline int
+    peekChar(void) {
+        int c = getChar();
+        if (c != EOF) {
+            --pos;
+        }
+        return c;
+    }
+
+    int
+    skipSpace(void);
+
+    bool
+    readString(std::string *s, unsigned long long *hash, size_t *size);
+
+    bool
+    readWord(void);
+
+    void
+    lex(void);
+
+    void
+    fail(const char *message);
+
+public:
+    Reader(const char *_filename) :
+        filename(_filename),
+        pos(0),
+        len(0),
+        bufOffset(0),
+        peeked(false),
+        type(TOKEN_EOF),
+        number(0)
+    {
+        file = fopen(filename, "rb");
+        if (!file) {
+            error = "failed to open";
+        }
+    }
+
+    ~Reader() {
+        if (file) {
+            fclose(file);
+        }
+    }
+
+    bool
+    ok(void) const {
+        return error.empty();
+    }
+
+    const std::string &
+    getError(void) const {
+        return error;
+    }
+
+    inline TokenType
+    peek(void) {
+        if (!peeked) {
+            lex();
+            peeked = true;
+        }
+        return type;
+    }
+
+    /**
+     * Consume the current token.
+     */
+    inline void
+    next(void) {
+        peek();
+        peeked = false;
+    }
+
+    inline const std::string &
+    getText(void) {
+        peek();
+        return text;
+    }
+
+    inline double
+    getNumber(void) {
+        peek();
+        return number;
+    }
+
+    /**
+     * Consume a string value, hashing it instead of keeping it, and
+     * returning where it started so that it can be read back later with
+     * readStringAt().
+     */
+    bool
+    hashString(unsigned long long &hash, size_t &size, long long &offset);
+
+    bool
+    readStringAt(long long offset, std::string &s);
+
+    void
+    skipValue(void);
+};
+
+
+void
+Reader::fail(const char *message)
+{
+    if (error.empty()) {
+        std::ostringstream ss;
+        ss << "offset " << (bufOffset + pos) << ": " << message;
+        error = ss.str();
+    }
+    type = TOKEN_ERROR;
+}
+
+
+int
+Reader::skipSpace(void)
+{
+    while (true) {
+        int c = getChar();
+        switch (c) {
+        case ' ':
+        case '\t':
+        case '\r':
+        case '\n':
+        case ',':
+            break;
+        case '/':
+            if (peekChar() != '/') {
+                return c;
+            }
+            do {
+                c = getChar();
+            } while (c != EOF && c != '\n' && c != '\r');
+            break;
+        default:
+            return c;
+        }
+    }
+}
+
+
+static void
+appendUtf8(std::string &s, unsigned long c)
+{
+    if (c < 0x80) {
+        s += (char)c;
+    } else if (c < 0x800) {
+        s += (char)(0xc0 | (c >> 6));
+        s += (char)(0x80 | (c & 0x3f));
+    } else if (c < 0x10000) {
+        s += (char)(0xe0 | (c >> 12));
+        s += (char)(0x80 | ((c >> 6) & 0x3f));
+        s += (char)(0x80 | (c & 0x3f));
+    } else {
+        s += (char)(0xf0 | (c >> 18));
+        s += (char)(0x80 | ((c >> 12) & 0x3f));
+        s += (char)(0x80 | ((c >> 6) & 0x3f));
+        s += (char)(0x80 | (c & 0x3f));
+    }
+}
+
+
+/**
+ * Read the rest of a string, after the opening quote, either into s or
+ * into a FNV-1a hash.
+ */
+bool
+Reader::readString(std::string *s, unsigned long long *hash, size_t *size)
+{
+    unsigned long long h = 0xcbf29ce484222325ULL;
+    size_t n = 0;
+    unsigned long surrogate = 0;
+
+    while (true) {
+        int c = getChar();
+        if (c == EOF) {
+            fail("unterminated string");
+            return false;
+        }
+        if (c == '"') {
+            break;
+        }
+
+        unsigned long code = c;
+        bool utf8 = false;
+        if (c == '\\') {
+            c = getChar();
+            switch (c) {
+            case 'b': code = '\b'; break;
+            case 'f': code = '\f'; break;
+            case 'n': code = '\n'; break;
+            case 'r': code = '\r'; break;
+            case 't': code = '\t'; break;
+            case 'u':
+                code = 0;
+                for (unsigned i = 0; i < 4; ++i) {
+                    c = getChar();
+                    unsigned digit;
+                    if (c >= '0' && c <= '9') {
+                        digit = c - '0';
+                    } else if (c >= 'a' && c <= 'f') {
+                        digit = c - 'a' + 10;
+                    } else if (c >= 'A' && c <= 'F') {
+                        digit = c - 'A' + 10;
+                    } else {
+                        fail("invalid \\u escape");
+                        return false;
+                    }
+                    code = code*16 + digit;
+                }
+                if (code >= 0xd800 && code < 0xdc00) {
+                    surrogate = code;
+                    continue;
+                }
+                if (code >= 0xdc00 && code < 0xe000 && surrogate) {
+                    code = 0x10000 + ((surrogate - 0xd800) << 10) + (code - 0xdc00);
+                }
+                utf8 = true;
+                break;
+            case EOF:
+                fail("unterminated string");
+                return false;
+            default:
+                code = c;
+                break;
+            }
+        }
+        surrogate = 0;
+
+        if (s) {
+            if (utf8) {
+                appendUtf8(*s, code);
+            } else {
+                *s += (char)code;
+            }
+        } else {
+            h ^= code;
+            h *= 0x100000001b3ULL;
+            ++n;
+        }
+    }
+
+    if (hash) {
+        *hash = h;
+        *size = n;
+    }
+    return true;
+}
+
+
+bool
+Reader::readWord(void)
+{
+    while (true) {
+        int c = peekChar();
+        if ((c >= '0' && c <= '9') ||
+            (c >= 'a' && c <= 'z') ||
+            (c >= 'A' && c <= 'Z') ||
+            c == '+' || c == '-' || c == '.') {
+            text += (char)getChar();
+        } else {
+            return true;
+        }
+    }
+}
+
+
+void
+Reader::lex(void)
+{
+    text.clear();
+
+    if (!ok()) {
+        type = TOKEN_ERROR;
+        return;
+    }
+
+    int c = skipSpace();
+    switch (c) {
+    case EOF:
+        type = TOKEN_EOF;
+        return;
+    case '{':
+        type = TOKEN_BEGIN_OBJECT;
+        return;
+    case '}':
+        type = TOKEN_END_OBJECT;
+        return;
+    case '[':
+        type = TOKEN_BEGIN_ARRAY;
+        return;
+    case ']':
+        type = TOKEN_END_ARRAY;
+        return;
+    case '"':
+        if (!readString(&text, NULL, NULL)) {
+            return;
+        }
+        c = skipSpace();
+        if (c == ':') {
+            type = TOKEN_KEY;
+        } else {
+            if (c != EOF) {
+                --pos;
+            }
+            type = TOKEN_STRING;
+        }
+        return;
+    default:
+        break;
+    }
+
+    text += (char)c;
+    readWord();
+
+    if (text == "true") {
+        type = TOKEN_TRUE;
+    } else if (text == "false") {
+        type = TOKEN_FALSE;
+    } else if (text == "null") {
+        type = TOKEN_NULL;
+    } else if (text == "NaN") {
+        type = TOKEN_FLOAT;
+        number = NAN;
+    } else if (text == "Infinity") {
+        type = TOKEN_FLOAT;
+        number = INFINITY;
+    } else if (text == "-Infinity") {
+        type = TOKEN_FLOAT;
+        number = -INFINITY;
+    } else {
+        char *end = NULL;
+        number = strtod(text.c_str(), &end);
+        if (end != text.c_str() + text.length() ||
+            !(text[0] == '-' || (text[0] >= '0' && text[0] <= '9'))) {
+            fail("unexpected token");
+            return;
+        }
+        type = text.find_first_of(".eE") == std::string::npos ? TOKEN_INT : TOKEN_FLOAT;
+    }
+}
+
+
+bool
+Reader::hashString(unsigned long long &hash, size_t &size, long long &offset)
+{
+    assert(!peeked);
+    int c = skipSpace();
+    offset = bufOffset + pos - 1;
+    if (c != '"') {
+        fail("expected string");
+        peeked = true;
+        return false;
+    }
+    return readString(NULL, &hash, &size);
+}
+
+
+bool
+Reader::readStringAt(long long offset, std::string &s)
+{
+    FILE *f = fopen(filename, "rb");
+    if (!f) {
+        return false;
+    }
+    bool ret = false;
+    if (fseek(f, (long)offset, SEEK_SET) == 0 && fgetc(f) == '"') {
+        int c;
+        while ((c = fgetc(f)) != EOF && c != '"') {
+            // base64 data never contains escapes other than raw newlines
+            s += (char)c;
+        }
+        ret = c == '"';
+    }
+    fclose(f);
+    return ret;
+}
+
+
+void
+Reader::skipValue(void)
+{
+    unsigned depth = 0;
+    do {
+        switch (peek()) {
+        case TOKEN_BEGIN_OBJECT:
+        case TOKEN_BEGIN_ARRAY:
+            ++depth;
+            break;
+        case TOKEN_END_OBJECT:
+        case TOKEN_END_ARRAY:
+            --depth;
+            break;
+        case TOKEN_KEY:
+            next();
+            continue;
+        case TOKEN_EOF:
+        case TOKEN_ERROR:
+            return;
+        default:
+            break;
+        }
+        next();
+    } while (depth);
+}
+
+
+/*
+ * Values which do not match up in lockstep are parsed into this minimal
+ * DOM.
+ */
+
+struct Blob
+{
+    Blob(Reader *_reader) :
+        reader(_reader),
+        width(0),
+        height(0),
+        depth(0),
+        hasData(false),
+        hash(0),
+        size(0),
+        offset(0)
+    {}
+
+    Reader *reader;
+    std::string className;
+    long long width;
+    long long height;
+    long long depth;
+    std::string format;
+    bool hasData;
+    unsigned long long hash;
+    size_t size;
+    long long offset;
+};
+
+
+struct Value
+{
+    enum Kind {
+        KIND_NULL = 0,
+        KIND_BOOL,
+        KIND_INT,
+        KIND_FLOAT,
+        KIND_STRING,
+        KIND_ARRAY,
+        KIND_OBJECT,
+        KIND_BLOB,
+    };
+
+    typedef std::vector<Value *> Elements;
+    typedef std::map<std::string, Value *> Members;
+
+    Kind kind;
+    bool boolean;
+    double number;
+
+    // String value, or the integer's text
+    std::string text;
+
+    Elements elements;
+    Members members;
+    Blob *blob;
+
+    Value(Kind k) :
+        kind(k),
+        boolean(false),
+        number(0),
+        blob(NULL)
+    {}
+
+    ~Value() {
+        for (Elements::iterator it = elements.begin(); it != elements.end(); ++it) {
+            delete *it;
+        }
+        for (Members::iterator it = members.begin(); it != members.end(); ++it) {
+            delete it->second;
+        }
+        delete blob;
+    }
+
+    inline bool
+    isNumber(void) const {
+        return kind == KIND_BOOL || kind == KIND_INT || kind == KIND_FLOAT;
+    }
+
+    inline double
+    toDouble(void) const {
+        return kind == KIND_BOOL ? (double)boolean : number;
+    }
+};
+
+
+static Value *
+parseValue(Reader &reader);
+
+
+/**
+ * Parse the members of an object, after its opening brace.
+ */
+static Value *
+parseObjectBody(Reader &reader)
+{
+    Value *value = new Value(Value::KIND_OBJECT);
+    Blob *blob = NULL;
+
+    while (reader.peek() == TOKEN_KEY) {
+        std::string name = reader.getText();
+        reader.next();
+
+        if (!blob && (name == "__class__" || name == "__data__")) {
+            blob = new Blob(&reader);
+        }
+
+        if (name == "__data__") {
+            // Potentially huge, so hash it rather than keep it around
+            blob->hasData = reader.hashString(blob->hash, blob->size, blob->offset);
+            continue;
+        }
+
+        Value *member = parseValue(reader);
+        if (isReserved(name)) {
+            if (blob) {
+                if (name == "__class__") {
+                    blob->className = member->text;
+                } else if (name == "__width__") {
+                    blob->width = (long long)member->number;
+                } else if (name == "__height__") {
+                    blob->height = (long long)member->number;
+                } else if (name == "__depth__") {
+                    blob->depth = (long long)member->number;
+                } else if (name == "__format__") {
+                    blob->format = member->text;
+                }
+            }
+            delete member;
+            continue;
+        }
+
+        Value::Members::iterator it = value->members.find(name);
+        if (it != value->members.end()) {
+            delete it->second;
+            it->second = member;
+        } else {
+            value->members[name] = member;
+        }
+    }
+
+    if (reader.peek() == TOKEN_END_OBJECT) {
+        reader.next();
+    }
+
+    if (blob) {
+        // Like jsondiff.py, objects with a class are opaque
+        delete value;
+        if (ignoreImages) {
+            delete blob;
+            return new Value(Value::KIND_NULL);
+        }
+        value = new Value(Value::KIND_BLOB);
+        value->blob = blob;
+    }
+
+    return value;
+}
+
+
+static Value *
+parseValue(Reader &reader)
+{
+    Value *value;
+
+    switch (reader.peek()) {
+    case TOKEN_BEGIN_OBJECT:
+        reader.next();
+        return parseObjectBody(reader);
+    case TOKEN_BEGIN_ARRAY:
+        reader.next();
+        value = new Value(Value::KIND_ARRAY);
+        while (true) {
+            TokenType type = reader.peek();
+            if (type == TOKEN_END_ARRAY) {
+                reader.next();
+                break;
+            }
+            if (type == TOKEN_EOF || type == TOKEN_ERROR) {
+                break;
+            }
+            value->elements.push_back(parseValue(reader));
+        }
+        return value;
+    case TOKEN_STRING:
+        value = new Value(Value::KIND_STRING);
+        value->text = reader.getText();
+        break;
+    case TOKEN_INT:
+        value = new Value(Value::KIND_INT);
+        value->text = reader.getText();
+        value->number = reader.getNumber();
+        break;
+    case TOKEN_FLOAT:
+        value = new Value(Value::KIND_FLOAT);
+        value->number = reader.getNumber();
+        break;
+    case TOKEN_TRUE:
+    case TOKEN_FALSE:
+        value = new Value(Value::KIND_BOOL);
+        value->boolean = reader.peek() == TOKEN_TRUE;
+        break;
+    case TOKEN_NULL:
+        value = new Value(Value::KIND_NULL);
+        break;
+    default:
+        // Unexpected token; leave error reporting to the caller
+        if (reader.peek() != TOKEN_EOF && reader.peek() != TOKEN_ERROR) {
+            reader.next();
+        }
+        return new Value(Value::KIND_NULL);
+    }
+
+    reader.next();
+    return value;
+}
+
+
+/*
+ * Images.
+ */
+
+static std::string
+decodeBase64(const std::string &s)
+{
+    std::string bytes;
+    bytes.reserve(s.length() / 4 * 3);
+
+    unsigned bits = 0;
+    unsigned count = 0;
+    for (size_t i = 0; i < s.length(); ++i) {
+        char c = s[i];
+        unsigned v;
+        if (c >= 'A' && c <= 'Z') {
+            v = c - 'A';
+        } else if (c >= 'a' && c <= 'z') {
+            v = c - 'a' + 26;
+        } else if (c >= '0' && c <= '9') {
+            v = c - '0' + 52;
+        } else if (c == '+') {
+            v = 62;
+        } else if (c == '/') {
+            v = 63;
+        } else {
+            continue;
+        }
+        bits = (bits << 6) | v;
+        count += 6;
+        if (count >= 8) {
+            count -= 8;
+            bytes += (char)((bits >> count) & 0xff);
+        }
+    }
+
+    return bytes;
+}
+
+
+static image::Image *
+decodeImage(const Blob &blob)
+{
+    std::string data;
+    if (!blob.hasData || !blob.reader->readStringAt(blob.offset, data)) {
+        return NULL;
+    }
+
+    std::string bytes = decodeBase64(data);
+    std::string().swap(data);
+
+    if (bytes.compare(0, 4, "\x89PNG") == 0) {
+        std::istringstream is(bytes);
+        return image::readPNG(is);
+    }
+    if (bytes.compare(0, 1, "P") == 0) {
+        return image::readPNM(bytes.data(), bytes.size());
+    }
+    return NULL;
+}
+
+
+/**
+ * Compare two blobs, decoding them only if their hashes differ.  When they
+ * are images of the same size, a summary of the differences is returned in
+ * note.
+ */
+static bool
+compareBlobs(const Blob &a, const Blob &b, std::string *note)
+{
+    if (a.className != b.className ||
+        a.width != b.width ||
+        a.height != b.height ||
+        a.depth != b.depth ||
+        a.format != b.format) {
+        return false;
+    }
+
+    if (a.size == b.size && a.hash == b.hash) {
+        return true;
+    }
+
+    if (a.className != "image") {
+        return false;
+    }
+
+    // Same pixels may still be encoded differently
+    image::Image *ia = decodeImage(a);
+    image::Image *ib = decodeImage(b);
+
+    bool equal = false;
+    if (ia && ib &&
+        ia->width == ib->width &&
+        ia->height == ib->height &&
+        ia->channels == ib->channels &&
+        ia->channelType == ib->channelType) {
+        unsigned long long pixels = 0;
+        double maxError = 0;
+        const unsigned bpp = ia->bytesPerPixel;
+        const unsigned char *pa = ia->pixels;
+        const unsigned char *pb = ib->pixels;
+        const unsigned char *end = pa + (size_t)ia->width * ia->height * bpp;
+        for (; pa < end; pa += bpp, pb += bpp) {
+            if (memcmp(pa, pb, bpp) == 0) {
+                continue;
+            }
+            ++pixels;
+            for (unsigned c = 0; c < ia->channels; ++c) {
+                double error;
+                if (ia->channelType == image::TYPE_FLOAT) {
+                    float fa, fb;
+                    memcpy(&fa, pa + c*4, 4);
+                    memcpy(&fb, pb + c*4, 4);
+                    error = fabs(fa - fb);
+                } else {
+                    error = abs((int)pa[c] - (int)pb[c]);
+                }
+                maxError = std::max(maxError, error);
+            }
+        }
+        equal = pixels == 0;
+        if (!equal && note) {
+            std::ostringstream ss;
+            ss << pixels << " pixels differ, max error " << maxError;
+            *note = ss.str();
+        }
+    }
+
+    delete ia;
+    delete ib;
+
+    return equal;
+}
+
+
+/*
+ * Comparison and dumping, mirroring jsondiff.py's Comparer, Dumper and
+ * Differ classes.  A NULL Value pointer stands for a missing member, which
+ * jsondiff.py treats as None.
+ */
+
+static inline void
+indent(std::string &out, unsigned level)
+{
+    out.append(2*level, ' ');
+}
+
+
+static bool
+equalValues(const Value *a, const Value *b);
+
+
+static bool
+equalNumbers(const Value &a, const Value &b)
+{
+    if (a.kind == Value::KIND_FLOAT || b.kind == Value::KIND_FLOAT) {
+        double x = a.toDouble();
+        double y = b.toDouble();
+        if (x == 0) {
+            return fabs(y) < tolerance;
+        } else {
+            return fabs((y - x)/x) < tolerance;
+        }
+    }
+    if (a.kind == Value::KIND_INT && b.kind == Value::KIND_INT) {
+        // Exact, as Python integers have arbitrary precision
+        return a.text == b.text || (a.number == 0 && b.number == 0);
+    }
+    return a.toDouble() == b.toDouble();
+}
+
+
+static bool
+equalValues(const Value *a, const Value *b)
+{
+    Value::Kind ka = a ? a->kind : Value::KIND_NULL;
+    Value::Kind kb = b ? b->kind : Value::KIND_NULL;
+
+    if (ka == Value::KIND_NULL || kb == Value::KIND_NULL) {
+        return ka == kb;
+    }
+
+    if (a->isNumber() && b->isNumber()) {
+        return equalNumbers(*a, *b);
+    }
+
+    if (ka != kb) {
+        return false;
+    }
+
+    switch (ka) {
+    case Value::KIND_STRING:
+        return a->text == b->text;
+    case Value::KIND_ARRAY:
+        if (a->elements.size() != b->elements.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < a->elements.size(); ++i) {
+            if (!equalValues(a->elements[i], b->elements[i])) {
+                return false;
+            }
+        }
+        return true;
+    case Value::KIND_OBJECT:
+        if (a->members.size() != b->members.size()) {
+            return false;
+        }
+        for (Value::Members::const_iterator ia = a->members.begin(), ib = b->members.begin();
+             ia != a->members.end(); ++ia, ++ib) {
+            if (ia->first != ib->first ||
+                !equalValues(ia->second, ib->second)) {
+                return false;
+            }
+        }
+        return true;
+    case Value::KIND_BLOB:
+        return compareBlobs(*a->blob, *b->blob, NULL);
+    default:
+        assert(0);
+        return false;
+    }
+}
+
+
+/**
+ * Same as Python's repr() of a float, as used by json.dumps.
+ */
+static void
+dumpFloat(std::string &out, double x)
+{
+    if (x != x) {
+        out += "NaN";
+        return;
+    }
+    if (x == INFINITY) {
+        out += "Infinity";
+        return;
+    }
+    if (x == -INFINITY) {
+        out += "-Infinity";
+        return;
+    }
+
+    // Shortest representation that round-trips
+    char buf[32];
+    for (int precision = 1; precision <= 17; ++precision) {
+        snprintf(buf, sizeof buf, "%.*e", precision - 1, x);
+        if (strtod(buf, NULL) == x) {
+            break;
+        }
+    }
+
+    const char *p = buf;
+    bool negative = *p == '-';
+    if (negative) {
+        ++p;
+    }
+    std::string digits;
+    while (*p && *p != 'e') {
+        if (*p != '.') {
+            digits += *p;
+        }
+        ++p;
+    }
+    int exponent = *p == 'e' ? atoi(p + 1) : 0;
+    while (digits.length() > 1 && digits[digits.length() - 1] == '0') {
+        digits.resize(digits.length() - 1);
+    }
+
+    if (negative) {
+        out += '-';
+    }
+
+    int decpt = exponent + 1;
+    if (decpt > -4 && decpt <= 16) {
+        if (decpt <= 0) {
+            out += "0.";
+            out.append(-decpt, '0');
+            out += digits;
+        } else if ((size_t)decpt >= digits.length()) {
+            out += digits;
+            out.append(decpt - digits.length(), '0');
+            out += ".0";
+        } else {
+            out.append(digits, 0, decpt);
+            out += '.';
+            out.append(digits, decpt, std::string::npos);
+        }
+    } else {
+        out += digits[0];
+        if (digits.length() > 1) {
+            out += '.';
+            out.append(digits, 1, std::string::npos);
+        }
+        snprintf(buf, sizeof buf, "e%c%02d", exponent < 0 ? '-' : '+', abs(exponent));
+        out += buf;
+    }
+}
+
+
+/**
+ * Same as json.dumps of a string, i.e., with non-ASCII characters escaped.
+ */
+static void
+dumpString(std::string &out, const std::string &s)
+{
+    out += '"';
+    for (size_t i = 0; i < s.length(); ) {
+        unsigned char c = s[i];
+        unsigned long code = c;
+        size_t n = 1;
+        if (c >= 0xf0 && i + 3 < s.length()) {
+            code = ((c & 0x07) << 18) | ((s[i+1] & 0x3f) << 12) | ((s[i+2] & 0x3f) << 6) | (s[i+3] & 0x3f);
+            n = 4;
+        } else if (c >= 0xe0 && i + 2 < s.length()) {
+            code = ((c & 0x0f) << 12) | ((s[i+1] & 0x3f) << 6) | (s[i+2] & 0x3f);
+            n = 3;
+        } else if (c >= 0xc0 && i + 1 < s.length()) {
+            code = ((c & 0x1f) << 6) | (s[i+1] & 0x3f);
+            n = 2;
+        }
+        i += n;
+
+        char buf[16];
+        switch (code) {
+        case '"':  out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        case '\b': out += "\\b"; break;
+        case '\f': out += "\\f"; break;
+        default:
+            if (code >= 0x20 && code < 0x7f) {
+                out += (char)code;
+            } else if (code >= 0x10000) {
+                code -= 0x10000;
+                snprintf(buf, sizeof buf, "\\u%04lx\\u%04lx",
+                         0xd800 + (code >> 10), 0xdc00 + (code & 0x3ff));
+                out += buf;
+            } else {
+                snprintf(buf, sizeof buf, "\\u%04lx", code);
+                out += buf;
+            }
+            break;
+        }
+    }
+    out += '"';
+}
+
+
+static void
+dumpValue(std::string &out, const Value *value, unsigned level)
+{
+    if (!value) {
+        out += "null";
+        return;
+    }
+
+    switch (value->kind) {
+    case Value::KIND_NULL:
+        out += "null";
+        break;
+    case Value::KIND_BOOL:
+        out += value->boolean ? "true" : "false";
+        break;
+    case Value::KIND_INT:
+        out += value->text == "-0" ? "0" : value->text;
+        break;
+    case Value::KIND_FLOAT:
+        dumpFloat(out, value->number);
+        break;
+    case Value::KIND_STRING:
+        dumpString(out, value->text);
+        break;
+    case Value::KIND_ARRAY:
+        out += "[\n";
+        for (size_t i = 0; i < value->elements.size(); ++i) {
+            indent(out, level + 1);
+            dumpValue(out, value->elements[i], level + 1);
+            if (i != value->elements.size() - 1) {
+                out += ',';
+            }
+            out += '\n';
+        }
+        indent(out, level);
+        out += ']';
+        break;
+    case Value::KIND_OBJECT:
+        out += "{\n";
+        for (Value::Members::const_iterator it = value->members.begin();
+             it != value->members.end(); ++it) {
+            indent(out, level + 1);
+            out += it->first;
+            out += ": ";
+            dumpValue(out, it->second, level + 1);
+            Value::Members::const_iterator next = it;
+            if (++next != value->members.end()) {
+                out += ',';
+            }
+            out += '\n';
+        }
+        indent(out, level);
+        out += '}';
+        if (level == 0) {
+            out += '\n';
+        }
+        break;
+    case Value::KIND_BLOB:
+        {
+            const Blob &blob = *value->blob;
+            std::ostringstream ss;
+            ss << "<" << blob.className << " " << blob.width << "x" << blob.height;
+            if (blob.depth > 1) {
+                ss << "x" << blob.depth;
+            }
+            if (!blob.format.empty()) {
+                ss << " " << blob.format;
+            }
+            ss << ">";
+            out += ss.str();
+        }
+        break;
+    }
+}
+
+
+static void
+replaceValue(std::string &out, const Value *a, const Value *b, unsigned level)
+{
+    dumpValue(out, a, level);
+    out += " -> ";
+    dumpValue(out, b, level);
+
+    if (a && b && a->kind == Value::KIND_BLOB && b->kind == Value::KIND_BLOB) {
+        std::string note;
+        compareBlobs(*a->blob, *b->blob, &note);
+        if (!note.empty()) {
+            out += " (";
+            out += note;
+            out += ")";
+        }
+    }
+}
+
+
+/**
+ * Python's == operator on scalars.  It differs from equalValues for
+ * infinities, which fail the relative tolerance test.
+ */
+static bool
+identicalScalars(const Value *a, const Value *b)
+{
+    Value::Kind ka = a ? a->kind : Value::KIND_NULL;
+    Value::Kind kb = b ? b->kind : Value::KIND_NULL;
+
+    if (a && b && a->isNumber() && b->isNumber()) {
+        if (ka == Value::KIND_INT && kb == Value::KIND_INT) {
+            return equalNumbers(*a, *b);
+        }
+        return a->toDouble() == b->toDouble();
+    }
+    if (ka != kb) {
+        return false;
+    }
+    if (ka == Value::KIND_STRING) {
+        return a->text == b->text;
+    }
+    return ka == Value::KIND_NULL;
+}
+
+
+/**
+ * Write the differences between two values which are known to differ.
+ */
+static void
+diffValues(std::string &out, const Value *a, const Value *b, unsigned level)
+{
+    Value::Kind ka = a ? a->kind : Value::KIND_NULL;
+    Value::Kind kb = b ? b->kind : Value::KIND_NULL;
+
+    if (ka == Value::KIND_OBJECT && kb == Value::KIND_OBJECT) {
+        std::vector<std::string> names;
+        for (Value::Members::const_iterator it = a->members.begin(); it != a->members.end(); ++it) {
+            names.push_back(it->first);
+        }
+        for (Value::Members::const_iterator it = b->members.begin(); it != b->members.end(); ++it) {
+            names.push_back(it->first);
+        }
+        std::sort(names.begin(), names.end());
+        names.erase(std::unique(names.begin(), names.end()), names.end());
+
+        out += "{\n";
+        for (size_t i = 0; i < names.size(); ++i) {
+            Value::Members::const_iterator ia = a->members.find(names[i]);
+            Value::Members::const_iterator ib = b->members.find(names[i]);
+            const Value *ae = ia != a->members.end() ? ia->second : NULL;
+            const Value *be = ib != b->members.end() ? ib->second : NULL;
+            if (!equalValues(ae, be)) {
+                indent(out, level + 1);
+                out += names[i];
+                out += ": ";
+                diffValues(out, ae, be, level + 1);
+                if (i != names.size() - 1) {
+                    out += ',';
+                }
+                out += '\n';
+            }
+        }
+        indent(out, level);
+        out += '}';
+        if (level == 0) {
+            out += '\n';
+        }
+    } else if (ka == Value::KIND_ARRAY && kb == Value::KIND_ARRAY) {
+        size_t maxLen = std::max(a->elements.size(), b->elements.size());
+        out += "[\n";
+        for (size_t i = 0; i < maxLen; ++i) {
+            const Value *ae = i < a->elements.size() ? a->elements[i] : NULL;
+            const Value *be = i < b->elements.size() ? b->elements[i] : NULL;
+            indent(out, level + 1);
+            if (equalValues(ae, be)) {
+                dumpValue(out, ae, level + 1);
+            } else {
+                diffValues(out, ae, be, level + 1);
+            }
+            if (i != maxLen - 1) {
+                out += ',';
+            }
+            out += '\n';
+        }
+        indent(out, level);
+        out += ']';
+    } else if (ka == Value::KIND_ARRAY || ka == Value::KIND_OBJECT ||
+               kb == Value::KIND_ARRAY || kb == Value::KIND_OBJECT ||
+               !identicalScalars(a, b)) {
+        replaceValue(out, a, b, level);
+    }
+}
+
+
+/*
+ * Lockstep differ.
+ */
+
+class Differ
+{
+    Reader &a;
+    Reader &b;
+
+    bool
+    diffObjects(std::string &out, unsigned level);
+
+    bool
+    diffArrays(std::string &out, unsigned level);
+
+    static bool
+    diffParsed(std::string &out, Value *va, Value *vb, unsigned level) {
+        bool differ = !equalValues(va, vb);
+        if (differ) {
+            diffValues(out, va, vb, level);
+        }
+        delete va;
+        delete vb;
+        return differ;
+    }
+
+public:
+    Differ(Reader &_a, Reader &_b) :
+        a(_a), b(_b)
+    {}
+
+    /**
+     * Compare the next value of both readers, writing the differences, if
+     * any, to out.
+     */
+    bool
+    diff(std::string &out, unsigned level);
+};
+
+
+bool
+Differ::diff(std::string &out, unsigned level)
+{
+    TokenType ta = a.peek();
+    TokenType tb = b.peek();
+
+    if (ta == TOKEN_BEGIN_OBJECT && tb == TOKEN_BEGIN_OBJECT) {
+        a.next();
+        b.next();
+        if ((a.peek() == TOKEN_KEY && a.getText() == "__class__") ||
+            (b.peek() == TOKEN_KEY && b.getText() == "__class__")) {
+            // Images are small enough once their data is hashed
+            Value *va = parseObjectBody(a);
+            Value *vb = parseObjectBody(b);
+            return diffParsed(out, va, vb, level);
+        }
+        return diffObjects(out, level);
+    }
+
+    if (ta == TOKEN_BEGIN_ARRAY && tb == TOKEN_BEGIN_ARRAY) {
+        a.next();
+        b.next();
+        return diffArrays(out, level);
+    }
+
+    Value *va = parseValue(a);
+    Value *vb = parseValue(b);
+    return diffParsed(out, va, vb, level);
+}
+
+
+bool
+Differ::diffObjects(std::string &out, unsigned level)
+{
+    typedef std::map<std::string, std::string> Diffs;
+    Diffs diffs;
+    std::vector<std::string> names;
+    Value::Members pendingA;
+    Value::Members pendingB;
+    bool keysDiffer = false;
+
+    while (true) {
+        bool hasA = a.peek() == TOKEN_KEY;
+        bool hasB = b.peek() == TOKEN_KEY;
+        if (!hasA && !hasB) {
+            break;
+        }
+
+        if (hasA && isReserved(a.getText())) {
+            a.next();
+            a.skipValue();
+            continue;
+        }
+        if (hasB && isReserved(b.getText())) {
+            b.next();
+            b.skipValue();
+            continue;
+        }
+
+        if (hasA && hasB && a.getText() == b.getText()) {
+            std::string name = a.getText();
+            names.push_back(name);
+            a.next();
+            b.next();
+            std::string text;
+            if (diff(text, level + 1)) {
+                diffs[name].swap(text);
+            }
+            continue;
+        }
+
+        // Members are out of step: park them until their counterpart shows
+        // up, or the object ends.
+        bool takeA = hasA && !(hasB && pendingA.count(b.getText()));
+        Reader &reader = takeA ? a : b;
+        Value::Members &pending = takeA ? pendingA : pendingB;
+        Value::Members &other = takeA ? pendingB : pendingA;
+
+        std::string name = reader.getText();
+        names.push_back(name);
+        reader.next();
+        Value *value = parseValue(reader);
+
+        Value::Members::iterator it = other.find(name);
+        if (it != other.end()) {
+            Value *va = takeA ? value : it->second;
+            Value *vb = takeA ? it->second : value;
+            other.erase(it);
+            std::string text;
+            if (diffParsed(text, va, vb, level + 1)) {
+                diffs[name].swap(text);
+            }
+        } else {
+            delete pending[name];
+            pending[name] = value;
+        }
+    }
+
+    if (a.peek() == TOKEN_END_OBJECT) {
+        a.next();
+    }
+    if (b.peek() == TOKEN_END_OBJECT) {
+        b.next();
+    }
+
+    for (Value::Members::iterator it = pendingA.begin(); it != pendingA.end(); ++it) {
+        keysDiffer = true;
+        std::string text;
+        if (diffParsed(text, it->second, NULL, level + 1)) {
+            diffs[it->first].swap(text);
+        }
+    }
+    for (Value::Members::iterator it = pendingB.begin(); it != pendingB.end(); ++it) {
+        keysDiffer = true;
+        std::string text;
+        if (diffParsed(text, NULL, it->second, level + 1)) {
+            diffs[it->first].swap(text);
+        }
+    }
+
+    if (diffs.empty() && !keysDiffer) {
+        return false;
+    }
+
+    std::sort(names.begin(), names.end());
+    const std::string &last = names.back();
+
+    out += "{\n";
+    for (Diffs::const_iterator it = diffs.begin(); it != diffs.end(); ++it) {
+        indent(out, level + 1);
+        out += it->first;
+        out += ": ";
+        out += it->second;
+        if (it->first != last) {
+            out += ',';
+        }
+        out += '\n';
+    }
+    indent(out, level);
+    out += '}';
+    if (level == 0) {
+        out += '\n';
+    }
+
+    return true;
+}
+
+
+bool
+Differ::diffArrays(std::string &out, unsigned level)
+{
+    std::vector<std::string> elements;
+    bool differ = false;
+
+    while (true) {
+        bool hasA = a.peek() != TOKEN_END_ARRAY && a.peek() != TOKEN_EOF && a.peek() != TOKEN_ERROR;
+        bool hasB = b.peek() != TOKEN_END_ARRAY && b.peek() != TOKEN_EOF && b.peek() != TOKEN_ERROR;
+        if (!hasA && !hasB) {
+            break;
+        }
+
+        Value *va = hasA ? parseValue(a) : NULL;
+        Value *vb = hasB ? parseValue(b) : NULL;
+
+        // Equal elements are listed too, in case the array differs
+        std::string text;
+        if (hasA != hasB) {
+            differ = true;
+        }
+        if (equalValues(va, vb)) {
+            dumpValue(text, va, level + 1);
+        } else {
+            diffValues(text, va, vb, level + 1);
+            differ = true;
+        }
+        elements.push_back(text);
+
+        delete va;
+        delete vb;
+    }
+
+    if (a.peek() == TOKEN_END_ARRAY) {
+        a.next();
+    }
+    if (b.peek() == TOKEN_END_ARRAY) {
+        b.next();
+    }
+
+    if (!differ) {
+        return false;
+    }
+
+    out += "[\n";
+    for (size_t i = 0; i < elements.size(); ++i) {
+        indent(out, level + 1);
+        out += elements[i];
+        if (i != elements.size() - 1) {
+            out += ',';
+        }
+        out += '\n';
+    }
+    indent(out, level);
+    out += ']';
+
+    return true;
+}
+
+
 static int
 command(int argc, char *argv[])
 {
@@ -65,6 +1584,9 @@ command(int argc, char *argv[])
         case 'h':
             usage();
             return 0;
+        case IGNORE_IMAGES_OPT:
+            ignoreImages = true;
+            break;
         default:
             std::cerr << "error: unexpected option `" << (char)opt << "`\n";
             usage();
@@ -78,22 +1600,26 @@ command(int argc, char *argv[])
         return 1;
     }
 
-    char *file1, *file2;
-
-    file1 = argv[optind];
-    file2 = argv[optind + 1];
+    Reader a(argv[optind]);
+    Reader b(argv[optind + 1]);
 
-    os::String command = findScript("jsondiff.py");
+    std::string out;
+    if (a.ok() && b.ok()) {
+        Differ(a, b).diff(out, 0);
+    }
 
-    char *args[5];
+    std::cout << out;
+    std::cout.flush();
 
-    args[0] = const_cast<char *>("python");
-    args[1] = const_cast<char *>(command.str());
-    args[2] = file1;
-    args[3] = file2;
-    args[4] = NULL;
+    for (unsigned i = 0; i < 2; ++i) {
+        Reader &reader = i ? b : a;
+        if (!reader.ok()) {
+            std::cerr << "error: " << reader.filename << ": " << reader.getError() << "\n";
+            return 1;
+        }
+    }
 
-    return os::execute(args);
+    return 0;
 }
 
 const Command diff_state_command = {
@@ -71,6 +71,7 @@ usage(void)
         "    --thread-ids=[=BOOL] dump thread ids [default: no]\n"
         "    --call-nos[=BOOL]    dump call numbers[default: yes]\n"
         "    --arg-names[=BOOL]   dump argument names [default: yes]\n"
+        "    --call-times[=BOOL]  dump cpu times recorded with APITRACE_CALL_TIMES, in ns [default: no]\n"
         "\n"
     ;
 }
@@ -81,6 +82,7 @@ enum {
     THREAD_IDS_OPT,
     CALL_NOS_OPT,
     ARG_NAMES_OPT,
+    CALL_TIMES_OPT,
 };
 
 const static char *
@@ -96,6 +98,7 @@ longOptions[] = {
     {"thread-ids", optional_argument, 0, THREAD_IDS_OPT},
     {"call-nos", optional_argument, 0, CALL_NOS_OPT},
     {"arg-names", optional_argument, 0, ARG_NAMES_OPT},
+    {"call-times", optional_argument, 0, CALL_TIMES_OPT},
     {0, 0, 0, 0}
 };
 
@@ -147,6 +150,13 @@ command(int argc, char *argv[])
                 dumpFlags |= trace::DUMP_FLAG_NO_ARG_NAMES;
             }
             break;
+        case CALL_TIMES_OPT:
+            if (trace::boolOption(optarg)) {
+                dumpFlags |= trace::DUMP_FLAG_CALL_TIMES;
+            } else {
+                dumpFlags &= ~trace::DUMP_FLAG_CALL_TIMES;
+            }
+            break;
         default:
             std::cerr << "error: unexpected option `" << (char)opt << "`\n";
             usage();
@@ -54,12 +54,15 @@ usage(void)
         "                           otherwise use sequental numbers (default=yes)\n"
         "    -o, --output=PREFIX    prefix to use in naming output files\n"
         "                           (default is trace filename without extension)\n"
+        "        --format=FMT       image file format, PNG or QOI (default is PNG);\n"
+        "                           QOI is much faster to write and read\n"
         "\n";
 }
 
 enum {
     CALLS_OPT = CHAR_MAX + 1,
     CALL_NOS_OPT,
+    FORMAT_OPT,
 };
 
 const static char *
@@ -71,6 +74,7 @@ longOptions[] = {
     {"calls", required_argument, 0, CALLS_OPT},
     {"call-nos", optional_argument, 0, CALL_NOS_OPT},
     {"output", required_argument, 0, 'o'},
+    {"format", required_argument, 0, FORMAT_OPT},
     {0, 0, 0, 0}
 };
 
@@ -82,6 +86,7 @@ command(int argc, char *argv[])
     const char *traceName = NULL;
     const char *output = NULL;
     std::string call_nos;
+    std::string format;
 
     int opt;
     while ((opt = getopt_long(argc, argv, shortOptions, longOptions, NULL)) != -1) {
@@ -99,6 +104,14 @@ command(int argc, char *argv[])
         case 'o':
             output = optarg;
             break;
+        case FORMAT_OPT:
+            if (strcmp(optarg, "PNG") != 0 && strcmp(optarg, "QOI") != 0) {
+                std::cerr << "error: unsupported image format `" << optarg << "`\n";
+                return 1;
+            }
+            format = "--snapshot-format=";
+            format.append(optarg);
+            break;
         default:
             std::cerr << "error: unexpected option `" << (char)opt << "`\n";
             usage();
@@ -140,6 +153,9 @@ command(int argc, char *argv[])
     if (!call_nos.empty()) {
         opts.push_back(call_nos.c_str());
     }
+    if (!format.empty()) {
+        opts.push_back(format.c_str());
+    }
 
     return executeRetrace(opts, traceName);
 }
@@ -0,0 +1,144 @@
+/**************************************************************************
+ *
+ * Copyright 2014 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+#include <string.h>
+#include <getopt.h>
+
+#include <iostream>
+
+#include "cli.hpp"
+
+#include "trace_file.hpp"
+#include "trace_index.hpp"
+#include "trace_parser.hpp"
+
+
+static const char *synopsis = "Add a seek index to a trace file.";
+
+static void
+usage(void)
+{
+    std::cout
+        << "usage: apitrace index <trace-file>\n"
+        << synopsis << "\n"
+        << "\n"
+        << "The index records where each frame and signature starts, allowing the\n"
+        << "GUI, trim, and other tools to jump straight to any frame without\n"
+        << "scanning the whole trace first.  Traces written by current versions of\n"
+        << "apitrace are indexed already.\n"
+        << "\n";
+}
+
+const static char *
+shortOptions = "h";
+
+const static struct option
+longOptions[] = {
+    {"help", no_argument, 0, 'h'},
+    {0, 0, 0, 0}
+};
+
+static int
+index_trace(const char *filename)
+{
+    trace::Parser p;
+    if (!p.open(filename)) {
+        std::cerr << "error: failed to open " << filename << "\n";
+        return 1;
+    }
+
+    if (!p.supportsOffsets()) {
+        std::cerr << "error: " << filename << " doesn't support seeking (use `apitrace repack` first)\n";
+        return 1;
+    }
+
+    if (p.getIndex()) {
+        std::cerr << filename << " is already indexed\n";
+        return 0;
+    }
+
+    trace::Index index;
+    trace::ParseBookmark bookmark;
+
+    p.getBookmark(bookmark);
+    index.addFrame(bookmark.next_call_no, bookmark.offset);
+
+    trace::Call *call;
+    while ((call = p.scan_call())) {
+        if ((call->flags & trace::CALL_FLAG_END_FRAME) &&
+            !(call->flags & trace::CALL_FLAG_INCOMPLETE)) {
+            p.getBookmark(bookmark);
+            index.addFrame(bookmark.next_call_no, bookmark.offset);
+        }
+        delete call;
+    }
+
+    p.getBookmark(bookmark);
+    index.numCalls = bookmark.next_call_no;
+
+    p.getSigIndex(index);
+
+    p.close();
+
+    if (!trace::File::appendIndex(filename, index)) {
+        std::cerr << "error: failed to write index to " << filename << "\n";
+        return 1;
+    }
+
+    return 0;
+}
+
+static int
+command(int argc, char *argv[])
+{
+    int opt;
+    while ((opt = getopt_long(argc, argv, shortOptions, longOptions, NULL)) != -1) {
+        switch (opt) {
+        case 'h':
+            usage();
+            return 0;
+        default:
+            std::cerr << "error: unexpected option `" << (char)opt << "`\n";
+            usage();
+            return 1;
+        }
+    }
+
+    if (argc != optind + 1) {
+        std::cerr << "error: insufficient number of arguments\n";
+        usage();
+        return 1;
+    }
+
+    return index_trace(argv[optind]);
+}
+
+const Command index_command = {
+    "index",
+    synopsis,
+    usage,
+    command
+};
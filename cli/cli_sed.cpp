@@ -183,7 +183,7 @@ sed_trace(Replacements &replacements, const char *inFileName, std::string &outFi
     }
 
     trace::Writer writer;
-    if (!writer.open(outFileName.c_str())) {
+    if (!writer.open(outFileName.c_str(), p.version >= TRACE_VERSION_CALL_TIME)) {
         std::cerr << "error: failed to create " << outFileName << "\n";
         return 1;
     }
@@ -204,7 +204,7 @@ trim_trace(const char *filename, struct trim_options *options)
     trace::Parser p;
     TraceAnalyzer analyzer(options->trim_flags);
     trace::FastCallSet *required;
-    unsigned frame;
+    unsigned frame, first_frame;
     int call_range_first, call_range_last;
 
     if (!p.open(filename)) {
@@ -215,8 +215,23 @@ trim_trace(const char *filename, struct trim_options *options)
     /* Mark the beginning so we can return here for pass 2. */
     p.getBookmark(beginning);
 
+    /* Without dependency analysis nothing before the first requested frame
+     * is needed, so if the trace has an index, start right there. */
+    first_frame = 0;
+    const trace::Index *index = p.getIndex();
+    if (index &&
+        !options->dependency_analysis &&
+        options->calls.empty() &&
+        !options->frames.empty() &&
+        options->frames.getFirst() < index->frames.size()) {
+        first_frame = options->frames.getFirst();
+        beginning.offset = index->frames[first_frame].offset;
+        beginning.next_call_no = index->frames[first_frame].callNo;
+        p.setBookmark(beginning);
+    }
+
     /* In pass 1, analyze which calls are needed. */
-    frame = 0;
+    frame = first_frame;
     trace::Call *call;
     while ((call = p.parse_call())) {
 
@@ -272,7 +287,7 @@ trim_trace(const char *filename, struct trim_options *options)
     }
 
     trace::Writer writer;
-    if (!writer.open(options->output.c_str())) {
+    if (!writer.open(options->output.c_str(), p.version >= TRACE_VERSION_CALL_TIME)) {
         std::cerr << "error: failed to create " << options->output << "\n";
         return 1;
     }
@@ -283,7 +298,7 @@ trim_trace(const char *filename, struct trim_options *options)
     /* In pass 2, emit the calls that are required. */
     required = analyzer.get_required();
 
-    frame = 0;
+    frame = first_frame;
     call_range_first = -1;
     call_range_last = -1;
     while ((call = p.parse_call())) {
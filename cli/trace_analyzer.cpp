@@ -23,7 +23,7 @@
  *
  **************************************************************************/
 
-#include <sstream>
+#include <algorithm>
 
 #include "trace_analyzer.hpp"
 
@@ -39,130 +39,211 @@ TraceAnalyzer::renderingHasSideEffect(void)
     return transformFeedbackActive || framebufferObjectActive;
 }
 
-/* Provide: Record that the given call affects the given resource
- * as a side effect. */
+/* Intern the resource with the given kind and numbers. */
+TraceAnalyzer::ResourceId
+TraceAnalyzer::lookup(ResourceKind kind, long long a, long long b)
+{
+    ResourceKey key;
+    key.kind = kind;
+    key.a = a;
+    key.b = b;
+
+    std::map<ResourceKey, ResourceId>::iterator it = resourceIds.lower_bound(key);
+    if (it != resourceIds.end() && !(key < it->first)) {
+        return it->second;
+    }
+
+    ResourceId id = resources.size();
+    resources.push_back(Resource());
+    resourceIds.insert(it, std::make_pair(key, id));
+    return id;
+}
+
 void
-TraceAnalyzer::provide(std::string resource, trace::CallNo call_no)
+TraceAnalyzer::CallList::add(unsigned call_no)
 {
-    resources[resource].insert(call_no);
+    if (sorted == calls.size() &&
+        (calls.empty() || call_no > calls.back())) {
+        ++sorted;
+    }
+    calls.push_back(call_no);
+
+    /* Keep duplicates from piling up. */
+    if (calls.size() - sorted > sorted + 1024) {
+        normalize();
+    }
 }
 
-/* Like provide, but with a simply-formatted string, (appending an
- * integer to the given string). */
+/* Merge a sorted list of calls without duplicates, such as the ones
+ * returned by resolve(). */
 void
-TraceAnalyzer::providef(std::string resource,
-                        int resource_no,
-                        trace::CallNo call_no)
+TraceAnalyzer::CallList::add(const std::vector<unsigned> &other)
 {
-    std::stringstream ss;
-    ss << resource << resource_no;
-    provide(ss.str(), call_no);
+    normalize();
+
+    /* Append only the calls we don't have yet, which are usually few. */
+    size_t count = calls.size();
+    size_t i = 0;
+    for (std::vector<unsigned>::const_iterator call = other.begin(); call != other.end(); call++) {
+        while (i < count && calls[i] < *call) {
+            ++i;
+        }
+        if (i == count || calls[i] != *call) {
+            calls.push_back(*call);
+        }
+    }
+
+    if (calls.size() != count) {
+        std::inplace_merge(calls.begin(), calls.begin() + count, calls.end());
+        sorted = calls.size();
+    }
 }
 
-/* Link: Establish a dependency between resource 'resource' and
- * resource 'dependency'. This dependency is captured by name so
- * that if the list of calls that provide 'dependency' grows
- * before 'resource' is consumed, those calls will still be
- * captured. */
 void
-TraceAnalyzer::link(std::string resource, std::string dependency)
+TraceAnalyzer::CallList::normalize(void)
 {
-    dependencies[resource].insert(dependency);
+    if (sorted == calls.size()) {
+        return;
+    }
+
+    std::vector<unsigned>::iterator middle = calls.begin() + sorted;
+    std::sort(middle, calls.end());
+    std::inplace_merge(calls.begin(), middle, calls.end());
+    calls.erase(std::unique(calls.begin(), calls.end()), calls.end());
+    sorted = calls.size();
 }
 
-/* Like link, but with a simply-formatted string, (appending an
- * integer to the given string). */
+/* Provide: Record that the given call affects the given resource
+ * as a side effect. */
 void
-TraceAnalyzer::linkf(std::string resource, std::string dependency, int dep_no)
+TraceAnalyzer::provide(ResourceId resource, trace::CallNo call_no)
 {
+    resources[resource].calls.add(call_no);
+}
 
-    std::stringstream ss;
-    ss << dependency << dep_no;
-    link(resource, ss.str());
+/* Like provide, but for several calls at once, as sorted by resolve(). */
+void
+TraceAnalyzer::provide(ResourceId resource, const std::vector<unsigned> &calls)
+{
+    resources[resource].calls.add(calls);
 }
 
-/* Unlink: Remove dependency from 'resource' on 'dependency'. */
+/* Link: Establish a dependency between resource 'resource' and
+ * resource 'dependency'. This dependency is captured by id so
+ * that if the list of calls that provide 'dependency' grows
+ * before 'resource' is consumed, those calls will still be
+ * captured. */
 void
-TraceAnalyzer::unlink(std::string resource, std::string dependency)
+TraceAnalyzer::link(ResourceId resource, ResourceId dependency)
 {
-    dependencies[resource].erase(dependency);
-    if (dependencies[resource].size() == 0) {
-        dependencies.erase(resource);
+    std::vector<ResourceId> &deps = resources[resource].dependencies;
+    std::vector<ResourceId>::iterator dep = std::lower_bound(deps.begin(), deps.end(), dependency);
+    if (dep == deps.end() || *dep != dependency) {
+        deps.insert(dep, dependency);
     }
 }
 
-/* Like unlink, but with a simply-formated string, (appending an
- * integer to the given string). */
+/* Unlink: Remove dependency from 'resource' on 'dependency'. */
 void
-TraceAnalyzer::unlinkf(std::string resource, std::string dependency, int dep_no)
+TraceAnalyzer::unlink(ResourceId resource, ResourceId dependency)
 {
-
-    std::stringstream ss;
-    ss << dependency << dep_no;
-    unlink(resource, ss.str());
+    std::vector<ResourceId> &deps = resources[resource].dependencies;
+    std::vector<ResourceId>::iterator dep = std::lower_bound(deps.begin(), deps.end(), dependency);
+    if (dep != deps.end() && *dep == dependency) {
+        deps.erase(dep);
+    }
 }
 
 /* Unlink all: Remove dependencies from 'resource' to all other
  * resources. */
 void
-TraceAnalyzer::unlinkAll(std::string resource)
+TraceAnalyzer::unlinkAll(ResourceId resource)
 {
-    dependencies.erase(resource);
+    resources[resource].dependencies.clear();
 }
 
-/* Resolve: Recursively compute all calls providing 'resource',
- * (including linked dependencies of 'resource' on other
- * resources). */
-std::set<unsigned>
-TraceAnalyzer::resolve(std::string resource)
+/* Resolve: Compute all calls providing 'resource', (including
+ * linked dependencies of 'resource' on other resources, followed
+ * transitively). The result is sorted and without duplicates. */
+void
+TraceAnalyzer::resolve(ResourceId resource, std::vector<unsigned> &calls)
 {
-    std::set<std::string> *deps;
-    std::set<std::string>::iterator dep;
+    std::vector<const std::vector<unsigned> *> lists;
+    size_t largest = 0;
+
+    calls.clear();
 
-    std::set<unsigned> *calls;
-    std::set<unsigned>::iterator call;
+    ++resolvePass;
+    resources[resource].visited = resolvePass;
+    resolveStack.push_back(resource);
 
-    std::set<unsigned> result, deps_set;
+    while (!resolveStack.empty()) {
+        Resource &res = resources[resolveStack.back()];
+        resolveStack.pop_back();
 
-    /* Recursively chase dependencies. */
-    if (dependencies.count(resource)) {
-        deps = &dependencies[resource];
-        for (dep = deps->begin(); dep != deps->end(); dep++) {
-            deps_set = resolve(*dep);
-            for (call = deps_set.begin(); call != deps_set.end(); call++) {
-                result.insert(*call);
+        /* Chase dependencies, visiting each resource only once. */
+        for (std::vector<ResourceId>::const_iterator dep = res.dependencies.begin();
+             dep != res.dependencies.end(); dep++) {
+            if (resources[*dep].visited != resolvePass) {
+                resources[*dep].visited = resolvePass;
+                resolveStack.push_back(*dep);
             }
         }
+
+        /* Also collect calls that directly provide the resource. */
+        if (!res.calls.empty()) {
+            res.calls.normalize();
+            if (!lists.empty() &&
+                res.calls.get().size() > lists[largest]->size()) {
+                largest = lists.size();
+            }
+            lists.push_back(&res.calls.get());
+        }
     }
 
-    /* Also look for calls that directly provide 'resource' */
-    if (resources.count(resource)) {
-        calls = &resources[resource];
-        for (call = calls->begin(); call != calls->end(); call++) {
-            result.insert(*call);
+    /* One list (typically the global state) tends to dwarf the others,
+     * so sort the rest together and merge them into it in one go. */
+    for (size_t i = 0; i < lists.size(); i++) {
+        if (i != largest) {
+            calls.insert(calls.end(), lists[i]->begin(), lists[i]->end());
         }
     }
 
-    return result;
+    if (lists.size() > 1) {
+        std::sort(calls.begin(), calls.end());
+        size_t middle = calls.size();
+        calls.insert(calls.end(), lists[largest]->begin(), lists[largest]->end());
+        std::inplace_merge(calls.begin(), calls.begin() + middle, calls.end());
+        calls.erase(std::unique(calls.begin(), calls.end()), calls.end());
+    } else if (lists.size() == 1) {
+        calls = *lists[0];
+    }
 }
 
 /* Consume: Resolve all calls that provide the given resource, and
  * add them to the required list. Then clear the call list for
  * 'resource' along with any dependencies. */
 void
-TraceAnalyzer::consume(std::string resource)
+TraceAnalyzer::consume(ResourceId resource)
 {
 
-    std::set<unsigned> calls;
-    std::set<unsigned>::iterator call;
+    std::vector<unsigned> calls;
+    std::vector<unsigned>::iterator call;
 
-    calls = resolve(resource);
+    resolve(resource, calls);
 
-    dependencies.erase(resource);
-    resources.erase(resource);
+    resources[resource].dependencies.clear();
+    resources[resource].calls.clear();
 
-    for (call = calls.begin(); call != calls.end(); call++) {
-        required.add(*call);
+    /* The calls are sorted, so add them as ranges. */
+    call = calls.begin();
+    while (call != calls.end()) {
+        trace::CallNo first = *call;
+        trace::CallNo last = *call;
+        for (call++; call != calls.end() && *call == last + 1; call++) {
+            last = *call;
+        }
+        required.add(first, last);
     }
 }
 
@@ -253,8 +334,8 @@ TraceAnalyzer::stateTrackPostCall(trace::Call *call)
      * next frame. */
     if (call->flags & trace::CALL_FLAG_SWAP_RENDERTARGET &&
         call->flags & trace::CALL_FLAG_END_FRAME) {
-        dependencies.erase("framebuffer");
-        resources.erase("framebuffer");
+        unlinkAll(RESOURCE_FRAMEBUFFER);
+        resources[RESOURCE_FRAMEBUFFER].calls.clear();
         return;
     }
 
@@ -286,7 +367,7 @@ TraceAnalyzer::recordTextureSideEffects(trace::Call *call, const char *name)
         if (textures) {
             for (i = 0; i < textures->size(); i++) {
                 texture = textures->values[i]->toUInt();
-                providef("texture-", texture, call->no);
+                provide(this->texture((int)texture), call->no);
             }
         }
         return true;
@@ -301,28 +382,25 @@ TraceAnalyzer::recordTextureSideEffects(trace::Call *call, const char *name)
 
         texture = call->arg(3).toUInt();
 
-        linkf("render-state", "texture-", texture);
+        link(RESOURCE_RENDER_STATE, this->texture((int)texture));
 
-        provide("state", call->no);
+        provide(RESOURCE_STATE, call->no);
     }
 
     if (strcmp(name, "glBindTexture") == 0) {
         GLenum target;
         GLuint texture;
 
-        std::stringstream ss_target, ss_texture;
-
         target = static_cast<GLenum>(call->arg(0).toSInt());
         texture = call->arg(1).toUInt();
 
-        ss_target << "texture-unit-" << activeTextureUnit << "-target-" << target;
-        ss_texture << "texture-" << texture;
+        ResourceId res_target = textureUnitTarget(activeTextureUnit, target);
 
-        resources.erase(ss_target.str());
-        provide(ss_target.str(), call->no);
+        resources[res_target].calls.clear();
+        provide(res_target, call->no);
 
-        unlinkAll(ss_target.str());
-        link(ss_target.str(), ss_texture.str());
+        unlinkAll(res_target);
+        link(res_target, this->texture(texture));
 
         /* FIXME: This really shouldn't be necessary. The effect
          * this provide() has is that all glBindTexture calls will
@@ -336,7 +414,7 @@ TraceAnalyzer::recordTextureSideEffects(trace::Call *call, const char *name)
          *
          * More investigation is necessary, but for now, be
          * conservative and don't trim. */
-        provide("state", call->no);
+        provide(RESOURCE_STATE, call->no);
 
         return true;
     }
@@ -351,24 +429,19 @@ TraceAnalyzer::recordTextureSideEffects(trace::Call *call, const char *name)
         strcmp(name, "glInvalidateTexImage") == 0 ||
         strcmp(name, "glInvalidateTexSubImage") == 0) {
 
-        std::set<unsigned> *calls;
-        std::set<unsigned>::iterator c;
-        std::stringstream ss_target, ss_texture;
-
         GLenum target = static_cast<GLenum>(call->arg(0).toSInt());
 
-        ss_target << "texture-unit-" << activeTextureUnit << "-target-" << target;
-        ss_texture << "texture-" << texture_map[target];
+        ResourceId res_target = textureUnitTarget(activeTextureUnit, target);
+        ResourceId res_texture = this->texture(texture_map[target]);
 
         /* The texture resource depends on this call and any calls
          * providing the given texture target. */
-        provide(ss_texture.str(), call->no);
+        provide(res_texture, call->no);
 
-        if (resources.count(ss_target.str())) {
-            calls = &resources[ss_target.str()];
-            for (c = calls->begin(); c != calls->end(); c++) {
-                provide(ss_texture.str(), *c);
-            }
+        CallList &calls = resources[res_target].calls;
+        if (!calls.empty()) {
+            calls.normalize();
+            provide(res_texture, calls.get());
         }
 
         return true;
@@ -384,14 +457,10 @@ TraceAnalyzer::recordTextureSideEffects(trace::Call *call, const char *name)
             cap == GL_TEXTURE_3D ||
             cap == GL_TEXTURE_CUBE_MAP)
         {
-            std::stringstream ss;
-
-            ss << "texture-unit-" << activeTextureUnit << "-target-" << cap;
-
-            link("render-state", ss.str());
+            link(RESOURCE_RENDER_STATE, textureUnitTarget(activeTextureUnit, cap));
         }
 
-        provide("state", call->no);
+        provide(RESOURCE_STATE, call->no);
         return true;
     }
 
@@ -405,14 +474,10 @@ TraceAnalyzer::recordTextureSideEffects(trace::Call *call, const char *name)
             cap == GL_TEXTURE_3D ||
             cap == GL_TEXTURE_CUBE_MAP)
         {
-            std::stringstream ss;
-
-            ss << "texture-unit-" << activeTextureUnit << "-target-" << cap;
-
-            unlink("render-state", ss.str());
+            unlink(RESOURCE_RENDER_STATE, textureUnitTarget(activeTextureUnit, cap));
         }
 
-        provide("state", call->no);
+        provide(RESOURCE_STATE, call->no);
         return true;
     }
 
@@ -427,7 +492,7 @@ TraceAnalyzer::recordShaderSideEffects(trace::Call *call, const char *name)
         strcmp(name, "glCreateShaderObjectARB") == 0) {
 
         GLuint shader = call->ret->toUInt();
-        providef("shader-", shader, call->no);
+        provide(this->shader((int)shader), call->no);
         return true;
     }
 
@@ -439,7 +504,7 @@ TraceAnalyzer::recordShaderSideEffects(trace::Call *call, const char *name)
         strcmp(name, "glGetShaderInfoLog") == 0) {
 
         GLuint shader = call->arg(0).toUInt();
-        providef("shader-", shader, call->no);
+        provide(this->shader((int)shader), call->no);
         return true;
     }
 
@@ -447,7 +512,7 @@ TraceAnalyzer::recordShaderSideEffects(trace::Call *call, const char *name)
         strcmp(name, "glCreateProgramObjectARB") == 0) {
 
         GLuint program = call->ret->toUInt();
-        providef("program-", program, call->no);
+        provide(this->program((int)program), call->no);
         return true;
     }
 
@@ -455,16 +520,12 @@ TraceAnalyzer::recordShaderSideEffects(trace::Call *call, const char *name)
         strcmp(name, "glAttachObjectARB") == 0) {
 
         GLuint program, shader;
-        std::stringstream ss_program, ss_shader;
 
         program = call->arg(0).toUInt();
         shader = call->arg(1).toUInt();
 
-        ss_program << "program-" << program;
-        ss_shader << "shader-" << shader;
-
-        link(ss_program.str(), ss_shader.str());
-        provide(ss_program.str(), call->no);
+        link(this->program(program), this->shader(shader));
+        provide(this->program(program), call->no);
 
         return true;
     }
@@ -473,15 +534,11 @@ TraceAnalyzer::recordShaderSideEffects(trace::Call *call, const char *name)
         strcmp(name, "glDetachObjectARB") == 0) {
 
         GLuint program, shader;
-        std::stringstream ss_program, ss_shader;
 
         program = call->arg(0).toUInt();
         shader = call->arg(1).toUInt();
 
-        ss_program << "program-" << program;
-        ss_shader << "shader-" << shader;
-
-        unlink(ss_program.str(), ss_shader.str());
+        unlink(this->program(program), this->shader(shader));
 
         return true;
     }
@@ -493,20 +550,16 @@ TraceAnalyzer::recordShaderSideEffects(trace::Call *call, const char *name)
 
         program = call->arg(0).toUInt();
 
-        unlinkAll("render-program-state");
+        unlinkAll(RESOURCE_RENDER_PROGRAM_STATE);
 
         if (program == 0) {
-            unlink("render-state", "render-program-state");
-            provide("state", call->no);
+            unlink(RESOURCE_RENDER_STATE, RESOURCE_RENDER_PROGRAM_STATE);
+            provide(RESOURCE_STATE, call->no);
         } else {
-            std::stringstream ss;
-
-            ss << "program-" << program;
-
-            link("render-state", "render-program-state");
-            link("render-program-state", ss.str());
+            link(RESOURCE_RENDER_STATE, RESOURCE_RENDER_PROGRAM_STATE);
+            link(RESOURCE_RENDER_PROGRAM_STATE, this->program(program));
 
-            provide(ss.str(), call->no);
+            provide(this->program(program), call->no);
         }
 
         return true;
@@ -523,7 +576,7 @@ TraceAnalyzer::recordShaderSideEffects(trace::Call *call, const char *name)
 
         GLuint program = call->arg(0).toUInt();
 
-        providef("program-", program, call->no);
+        provide(this->program((int)program), call->no);
 
         return true;
     }
@@ -534,7 +587,7 @@ TraceAnalyzer::recordShaderSideEffects(trace::Call *call, const char *name)
     if (call->sig->num_args > 0 &&
         strcmp(call->sig->arg_names[0], "location") == 0) {
 
-        providef("program-", activeProgram, call->no);
+        provide(program((int)activeProgram), call->no);
 
         /* We can't easily tell if this uniform is being used to
          * associate a sampler in the shader with a texture
@@ -550,23 +603,21 @@ TraceAnalyzer::recordShaderSideEffects(trace::Call *call, const char *name)
             GLint max_unit = MAX(GL_MAX_TEXTURE_COORDS, GL_MAX_COMBINED_TEXTURE_IMAGE_UNITS);
 
             GLint unit = call->arg(1).toSInt();
-            std::stringstream ss_program;
-            std::stringstream ss_texture;
 
             if (unit < max_unit) {
 
-                ss_program << "program-" << activeProgram;
+                ResourceId res_program = program(activeProgram);
 
-                ss_texture << "texture-unit-" << GL_TEXTURE0 + unit << "-target-";
+                int texture_unit = GL_TEXTURE0 + unit;
 
                 /* We don't know what target(s) might get bound to
                  * this texture unit, so conservatively link to
                  * all. Only bound textures will actually get inserted
                  * into the output call stream. */
-                linkf(ss_program.str(), ss_texture.str(), GL_TEXTURE_1D);
-                linkf(ss_program.str(), ss_texture.str(), GL_TEXTURE_2D);
-                linkf(ss_program.str(), ss_texture.str(), GL_TEXTURE_3D);
-                linkf(ss_program.str(), ss_texture.str(), GL_TEXTURE_CUBE_MAP);
+                link(res_program, textureUnitTarget(texture_unit, GL_TEXTURE_1D));
+                link(res_program, textureUnitTarget(texture_unit, GL_TEXTURE_2D));
+                link(res_program, textureUnitTarget(texture_unit, GL_TEXTURE_3D));
+                link(res_program, textureUnitTarget(texture_unit, GL_TEXTURE_CUBE_MAP));
             }
         }
 
@@ -589,7 +640,7 @@ TraceAnalyzer::recordShaderSideEffects(trace::Call *call, const char *name)
           strcmp(call->sig->arg_names[0], "programObj") == 0))) {
 
         GLuint program = call->arg(0).toUInt();
-        providef("program-", program, call->no);
+        provide(this->program((int)program), call->no);
         return true;
     }
 
@@ -606,24 +657,19 @@ TraceAnalyzer::recordDrawingSideEffects(trace::Call *call, const char *name)
     if (call->flags & trace::CALL_FLAG_RENDER ||
         insideBeginEnd) {
 
-        std::set<unsigned> calls;
-        std::set<unsigned>::iterator c;
+        std::vector<unsigned> calls;
 
-        provide("framebuffer", call->no);
+        provide(RESOURCE_FRAMEBUFFER, call->no);
 
-        calls = resolve("render-state");
+        resolve(RESOURCE_RENDER_STATE, calls);
 
-        for (c = calls.begin(); c != calls.end(); c++) {
-            provide("framebuffer", *c);
-        }
+        provide(RESOURCE_FRAMEBUFFER, calls);
 
         /* In some cases, rendering has side effects beyond the
          * framebuffer update. */
         if (renderingHasSideEffect()) {
-            provide("state", call->no);
-            for (c = calls.begin(); c != calls.end(); c++) {
-                provide("state", *c);
-            }
+            provide(RESOURCE_STATE, call->no);
+            provide(RESOURCE_STATE, calls);
         }
 
         return true;
@@ -656,14 +702,14 @@ TraceAnalyzer::recordSideEffects(trace::Call *call)
      * lists will work, but does not trim out unused display
      * lists. */
     if (insideNewEndList != 0) {
-        provide("state", call->no);
+        provide(RESOURCE_STATE, call->no);
 
         /* Also, any texture bound inside a display list is
          * conservatively considered required. */
         if (strcmp(name, "glBindTexture") == 0) {
             GLuint texture = call->arg(1).toUInt();
 
-            linkf("state", "texture-", texture);
+            link(RESOURCE_STATE, this->texture((int)texture));
         }
 
         return;
@@ -698,7 +744,7 @@ TraceAnalyzer::recordSideEffects(trace::Call *call)
     }
 
     /* By default, assume this call affects the state somehow. */
-    resources["state"].insert(call->no);
+    provide(RESOURCE_STATE, call->no);
 }
 
 void
@@ -708,22 +754,29 @@ TraceAnalyzer::requireDependencies(trace::Call *call)
     /* Swap-buffers calls depend on framebuffer state. */
     if (call->flags & trace::CALL_FLAG_SWAP_RENDERTARGET &&
         call->flags & trace::CALL_FLAG_END_FRAME) {
-        consume("framebuffer");
+        consume(RESOURCE_FRAMEBUFFER);
     }
 
     /* By default, just assume this call depends on generic state. */
-    consume("state");
+    consume(RESOURCE_STATE);
 }
 
 TraceAnalyzer::TraceAnalyzer(TrimFlags trimFlagsOpt):
+    resolvePass(0),
     transformFeedbackActive(false),
     framebufferObjectActive(false),
     insideBeginEnd(false),
     insideNewEndList(0),
     activeTextureUnit(GL_TEXTURE0),
+    activeProgram(0),
     trimFlags(trimFlagsOpt)
 {
-    /* Nothing needed. */
+    /* Intern the singleton resources first, so that their ids are
+     * the same as their kinds. */
+    lookup(RESOURCE_STATE);
+    lookup(RESOURCE_FRAMEBUFFER);
+    lookup(RESOURCE_RENDER_STATE);
+    lookup(RESOURCE_RENDER_PROGRAM_STATE);
 }
 
 TraceAnalyzer::~TraceAnalyzer()
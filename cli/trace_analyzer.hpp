@@ -23,7 +23,8 @@
  *
  **************************************************************************/
 
-#include <set>
+#include <map>
+#include <vector>
 
 #include <GL/gl.h>
 #include <GL/glext.h>
@@ -54,8 +55,84 @@ enum {
 
 class TraceAnalyzer {
 private:
-    std::map<std::string, std::set<unsigned> > resources;
-    std::map<std::string, std::set<std::string> > dependencies;
+    /* Resources are interned to compact integer ids.  A resource is
+     * identified by its kind and up to two numbers, (e.g. the texture
+     * name, or the texture unit and target). */
+    typedef unsigned ResourceId;
+
+    enum ResourceKind {
+        RESOURCE_STATE = 0,
+        RESOURCE_FRAMEBUFFER,
+        RESOURCE_RENDER_STATE,
+        RESOURCE_RENDER_PROGRAM_STATE,
+        RESOURCE_TEXTURE,
+        RESOURCE_TEXTURE_UNIT_TARGET,
+        RESOURCE_SHADER,
+        RESOURCE_PROGRAM,
+    };
+
+    struct ResourceKey {
+        ResourceKind kind;
+        long long a;
+        long long b;
+
+        bool operator < (const ResourceKey &other) const {
+            if (kind != other.kind) {
+                return kind < other.kind;
+            }
+            if (a != other.a) {
+                return a < other.a;
+            }
+            return b < other.b;
+        }
+    };
+
+    /* Calls providing a resource, as a vector which is sorted (and
+     * duplicates removed) lazily, as calls are mostly appended in
+     * order. */
+    class CallList {
+    private:
+        std::vector<unsigned> calls;
+        size_t sorted;
+
+    public:
+        CallList() : sorted(0) {}
+
+        void add(unsigned call_no);
+        void add(const std::vector<unsigned> &other);
+        void normalize(void);
+
+        bool empty(void) const {
+            return calls.empty();
+        }
+
+        void clear(void) {
+            calls.clear();
+            sorted = 0;
+        }
+
+        /* Only valid after normalize(). */
+        const std::vector<unsigned> &get(void) const {
+            return calls;
+        }
+    };
+
+    struct Resource {
+        CallList calls;
+
+        /* Sorted ids of the resources this one depends upon. */
+        std::vector<ResourceId> dependencies;
+
+        /* Last resolve() pass which visited this resource. */
+        unsigned visited;
+
+        Resource() : visited(0) {}
+    };
+
+    std::map<ResourceKey, ResourceId> resourceIds;
+    std::vector<Resource> resources;
+    unsigned resolvePass;
+    std::vector<ResourceId> resolveStack;
 
     std::map<GLenum, unsigned> texture_map;
 
@@ -69,15 +146,30 @@ private:
     GLuint activeProgram;
     unsigned int trimFlags;
 
-    void provide(std::string resource, trace::CallNo call_no);
-    void providef(std::string resource, int resource_no, trace::CallNo call_no);
-
-    void link(std::string resource, std::string dependency);
-    void linkf(std::string resource, std::string dependency, int dep_no);
-
-    void unlink(std::string resource, std::string dependency);
-    void unlinkf(std::string resource, std::string dependency, int dep_no);
-    void unlinkAll(std::string resource);
+    ResourceId lookup(ResourceKind kind, long long a = 0, long long b = 0);
+
+    /* The numbers are passed as they were formatted in the original
+     * string resource names, so that both signed and unsigned names
+     * keep mapping to the same resources as before. */
+    ResourceId texture(long long texture) {
+        return lookup(RESOURCE_TEXTURE, texture);
+    }
+    ResourceId textureUnitTarget(long long unit, long long target) {
+        return lookup(RESOURCE_TEXTURE_UNIT_TARGET, unit, target);
+    }
+    ResourceId shader(long long shader) {
+        return lookup(RESOURCE_SHADER, shader);
+    }
+    ResourceId program(long long program) {
+        return lookup(RESOURCE_PROGRAM, program);
+    }
+
+    void provide(ResourceId resource, trace::CallNo call_no);
+    void provide(ResourceId resource, const std::vector<unsigned> &calls);
+
+    void link(ResourceId resource, ResourceId dependency);
+    void unlink(ResourceId resource, ResourceId dependency);
+    void unlinkAll(ResourceId resource);
 
     void stateTrackPreCall(trace::Call *call);
 
@@ -90,9 +182,9 @@ private:
     void stateTrackPostCall(trace::Call *call);
 
     bool renderingHasSideEffect(void);
-    std::set<unsigned> resolve(std::string resource);
+    void resolve(ResourceId resource, std::vector<unsigned> &calls);
 
-    void consume(std::string resource);
+    void consume(ResourceId resource);
     void requireDependencies(trace::Call *call);
 
 public:
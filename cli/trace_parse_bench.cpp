@@ -0,0 +1,110 @@
+/**************************************************************************
+ *
+ * Copyright 2014 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+/*
+ * Parser throughput micro-benchmark.
+ *
+ * Parses a trace from start to end, once fully decoding every call and once
+ * only scanning it, and reports calls/second for each mode.  Set
+ * APITRACE_READ_AHEAD=0 to time decompression and decoding on one thread.
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "os_time.hpp"
+#include "trace_parser.hpp"
+
+
+static bool
+run(const char *filename, bool scan, unsigned &numCalls, double &seconds)
+{
+    trace::Parser p;
+    if (!p.open(filename)) {
+        fprintf(stderr, "error: failed to open %s\n", filename);
+        return false;
+    }
+
+    numCalls = 0;
+    long long startTime = os::getTime();
+
+    trace::Call *call;
+    while ((call = scan ? p.scan_call() : p.parse_call())) {
+        ++numCalls;
+        delete call;
+    }
+
+    long long endTime = os::getTime();
+    seconds = double(endTime - startTime) / os::timeFrequency;
+    return true;
+}
+
+
+int
+main(int argc, char **argv)
+{
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "usage: %s TRACE [REPEAT]\n", argv[0]);
+        return 1;
+    }
+
+    const char *filename = argv[1];
+
+    unsigned repeat = 3;
+    if (argc > 2) {
+        char *endptr;
+        repeat = strtoul(argv[2], &endptr, 0);
+        if (*endptr || !repeat) {
+            fprintf(stderr, "error: invalid repeat count %s\n", argv[2]);
+            return 1;
+        }
+    }
+
+    static const char *modeNames[] = {"FULL", "SCAN"};
+
+    for (unsigned mode = 0; mode < 2; ++mode) {
+        // Report the fastest run, which is the least disturbed by the rest of
+        // the system.
+        unsigned numCalls = 0;
+        double best = 0;
+        for (unsigned i = 0; i < repeat; ++i) {
+            double seconds;
+            if (!run(filename, mode != 0, numCalls, seconds)) {
+                return 1;
+            }
+            if (i == 0 || seconds < best) {
+                best = seconds;
+            }
+        }
+
+        printf("%s: %u calls in %.3f s, %.0f calls/s\n",
+               modeNames[mode], numCalls, best,
+               best > 0 ? numCalls / best : 0.0);
+    }
+
+    return 0;
+}
@@ -0,0 +1,163 @@
+/**************************************************************************
+ *
+ * Copyright 2014 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * Read-only file mapping abstraction.
+ */
+
+#ifndef _OS_MMAP_HPP_
+#define _OS_MMAP_HPP_
+
+
+#include <stddef.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+namespace os {
+
+
+    /**
+     * Maps a whole file into memory for reading.
+     */
+    class MappedFile
+    {
+    public:
+        MappedFile() :
+            m_data(NULL),
+            m_size(0)
+        {
+        }
+
+        ~MappedFile() {
+            close();
+        }
+
+        bool
+        open(const char *filename) {
+            close();
+
+#ifdef _WIN32
+            HANDLE hFile = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+                                       OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+            if (hFile == INVALID_HANDLE_VALUE) {
+                return false;
+            }
+
+            LARGE_INTEGER size;
+            if (!GetFileSizeEx(hFile, &size) ||
+                size.QuadPart == 0 ||
+                (unsigned long long)size.QuadPart != (size_t)size.QuadPart) {
+                CloseHandle(hFile);
+                return false;
+            }
+
+            HANDLE hMapping = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+            CloseHandle(hFile);
+            if (!hMapping) {
+                return false;
+            }
+
+            void *data = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(hMapping);
+            if (!data) {
+                return false;
+            }
+
+            m_data = (const char *)data;
+            m_size = (size_t)size.QuadPart;
+#else
+            int fd = ::open(filename, O_RDONLY);
+            if (fd < 0) {
+                return false;
+            }
+
+            struct stat st;
+            if (fstat(fd, &st) != 0 ||
+                st.st_size == 0 ||
+                (unsigned long long)st.st_size != (size_t)st.st_size) {
+                ::close(fd);
+                return false;
+            }
+
+            void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            ::close(fd);
+            if (data == MAP_FAILED) {
+                return false;
+            }
+
+            m_data = (const char *)data;
+            m_size = (size_t)st.st_size;
+#endif
+            return true;
+        }
+
+        void
+        close(void) {
+            if (m_data) {
+#ifdef _WIN32
+                UnmapViewOfFile(m_data);
+#else
+                munmap((void *)m_data, m_size);
+#endif
+                m_data = NULL;
+                m_size = 0;
+            }
+        }
+
+        bool
+        isOpen(void) const {
+            return m_data != NULL;
+        }
+
+        const char *
+        data(void) const {
+            return m_data;
+        }
+
+        size_t
+        size(void) const {
+            return m_size;
+        }
+
+    private:
+        const char *m_data;
+        size_t m_size;
+
+        MappedFile(const MappedFile &);
+        MappedFile & operator = (const MappedFile &);
+    };
+
+
+} /* namespace os */
+
+#endif /* _OS_MMAP_HPP_ */
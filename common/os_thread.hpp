@@ -37,6 +37,7 @@
 #include <windows.h>
 #else
 #include <pthread.h>
+#include <unistd.h>
 #endif
 
 
@@ -104,6 +105,15 @@ namespace os {
 #endif
         }
 
+        inline bool
+        try_lock(void) {
+#ifdef _WIN32
+            return TryEnterCriticalSection(&_native_handle) != 0;
+#else
+            return pthread_mutex_trylock(&_native_handle) == 0;
+#endif
+        }
+
         inline void
         unlock(void) {
 #ifdef _WIN32
@@ -399,6 +409,11 @@ namespace os {
             return _native_handle != 0;
         }
 
+        inline native_handle_type &
+        native_handle() {
+            return _native_handle;
+        }
+
         inline void
         join() {
 #ifdef _WIN32
@@ -408,6 +423,21 @@ namespace os {
 #endif
         }
 
+        /**
+         * Number of processors available, or 0 if unknown.
+         */
+        static inline unsigned
+        hardware_concurrency(void) {
+#ifdef _WIN32
+            SYSTEM_INFO info;
+            GetSystemInfo(&info);
+            return info.dwNumberOfProcessors;
+#else
+            long count = sysconf(_SC_NPROCESSORS_ONLN);
+            return count > 0 ? count : 0;
+#endif
+        }
+
     private:
         native_handle_type _native_handle;
 
@@ -0,0 +1,109 @@
+/**************************************************************************
+ *
+ * Copyright 2014 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * Bump allocator for parsed trace values.
+ */
+
+#ifndef _TRACE_ARENA_HPP_
+#define _TRACE_ARENA_HPP_
+
+
+#include <stddef.h>
+
+
+namespace trace {
+
+
+/**
+ * Allocates memory by bumping a pointer, and releases it all at once when
+ * cleared or destroyed.  Destructors of the objects placed in it are not
+ * invoked.
+ *
+ * The first allocations are served from storage inside the arena itself, so
+ * that a small call tree needs no heap allocations beyond the one for the
+ * object that embeds the arena.
+ */
+class Arena
+{
+public:
+    enum {
+        ALIGNMENT = 8,
+        INLINE_SIZE = 256,
+        BLOCK_SIZE = 4096
+    };
+
+    Arena() :
+        m_ptr(m_inline.bytes),
+        m_end(m_inline.bytes + INLINE_SIZE),
+        m_blocks(NULL)
+    {
+    }
+
+    ~Arena() {
+        clear();
+    }
+
+    inline void *
+    alloc(size_t size) {
+        size = (size + ALIGNMENT - 1) & ~size_t(ALIGNMENT - 1);
+        if (size > size_t(m_end - m_ptr)) {
+            return allocBlock(size);
+        }
+        void *ptr = m_ptr;
+        m_ptr += size;
+        return ptr;
+    }
+
+    void
+    clear(void);
+
+private:
+    struct Block {
+        Block *next;
+    };
+
+    char *m_ptr;
+    char *m_end;
+    Block *m_blocks;
+
+    union {
+        char bytes[INLINE_SIZE];
+        double d;
+        long long ll;
+        void *p;
+    } m_inline;
+
+    void *
+    allocBlock(size_t size);
+
+    Arena(const Arena &);
+    Arena & operator = (const Arena &);
+};
+
+
+} /* namespace trace */
+
+#endif /* _TRACE_ARENA_HPP_ */
@@ -0,0 +1,103 @@
+/**************************************************************************
+ *
+ * Copyright 2014 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * Reference counted buffers, shared between a trace file and the values
+ * parsed from it.
+ */
+
+#ifndef _TRACE_BUFFER_HPP_
+#define _TRACE_BUFFER_HPP_
+
+
+#include <stddef.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+
+namespace trace {
+
+
+/**
+ * A heap buffer which is freed when the last reference to it is released.
+ *
+ * References may be released from any thread.
+ */
+class SharedBuffer
+{
+public:
+    SharedBuffer(size_t _capacity) :
+        data(new char[_capacity]),
+        capacity(_capacity),
+        m_refCount(1)
+    {}
+
+    void ref(void) {
+#ifdef _WIN32
+        InterlockedIncrement(&m_refCount);
+#else
+        __sync_add_and_fetch(&m_refCount, 1);
+#endif
+    }
+
+    void release(void) {
+#ifdef _WIN32
+        long refCount = InterlockedDecrement(&m_refCount);
+#else
+        long refCount = __sync_sub_and_fetch(&m_refCount, 1);
+#endif
+        if (refCount == 0) {
+            delete this;
+        }
+    }
+
+    /**
+     * Whether anyone besides the caller holds a reference, in which case the
+     * contents must not be overwritten.
+     */
+    bool isShared(void) const {
+        return m_refCount > 1;
+    }
+
+    char * const data;
+    const size_t capacity;
+
+private:
+    volatile long m_refCount;
+
+    ~SharedBuffer() {
+        delete [] data;
+    }
+
+    SharedBuffer(const SharedBuffer &);
+    SharedBuffer &operator=(const SharedBuffer &);
+};
+
+
+} /* namespace trace */
+
+#endif /* _TRACE_BUFFER_HPP_ */
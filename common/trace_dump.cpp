@@ -278,6 +278,9 @@ public:
         
         if (callFlags & CALL_FLAG_INCOMPLETE) {
             os << " // " << red << "incomplete" << normal;
+        } else if ((dumpFlags & DUMP_FLAG_CALL_TIMES) && call->cpuDuration >= 0) {
+            os << " // cpu_start = " << call->cpuStart
+               << ", cpu_dura = " << call->cpuDuration;
         }
         
         os << "\n";
@@ -27,157 +27,529 @@
  *
  *********************************************************************/
 
-#include <stdio.h>
-#include <stdlib.h>
-#include <limits>
+#include <assert.h>
+
+#include <algorithm>
+#include <iterator>
 
-#include "os.hpp"
 #include "trace_fast_callset.hpp"
 
 using namespace trace;
 
-#define MAX_LEVEL 16
+/* An array container is only worthwhile while it is no larger than a
+ * bitmap, i.e., 8KB. */
+#define ARRAY_MAX 4096
+#define BITMAP_WORDS (65536 / 16)
 
-FastCallRange::FastCallRange(CallNo first, CallNo last, int level)
+static inline unsigned
+popcount16(unsigned w)
 {
-    this->first = first;
-    this->last = last;
-    this->level = level;
+    w = w - ((w >> 1) & 0x5555);
+    w = (w & 0x3333) + ((w >> 2) & 0x3333);
+    w = (w + (w >> 4)) & 0x0f0f;
+    return (w + (w >> 8)) & 0x1f;
+}
+
+static void
+set_bits(std::vector<uint16_t> &words, unsigned first, unsigned last)
+{
+    unsigned first_word = first >> 4;
+    unsigned last_word = last >> 4;
+    uint16_t first_mask = 0xffff << (first & 15);
+    uint16_t last_mask = 0xffff >> (15 - (last & 15));
+
+    if (first_word == last_word) {
+        words[first_word] |= first_mask & last_mask;
+        return;
+    }
 
-    next = new FastCallRange*[level];
+    words[first_word] |= first_mask;
+    for (unsigned i = first_word + 1; i < last_word; i++) {
+        words[i] = 0xffff;
+    }
+    words[last_word] |= last_mask;
 }
 
 bool
-FastCallRange::contains(CallNo call_no) const
+FastCallSet::Container::contains(uint16_t value) const
 {
-    return (first <= call_no && last >= call_no);
+    switch (kind) {
+    case CONTAINER_ARRAY:
+        return std::binary_search(data.begin(), data.end(), value);
+    case CONTAINER_BITMAP:
+        return (data[value >> 4] >> (value & 15)) & 1;
+    case CONTAINER_RUNS:
+        {
+            /* Find the last run starting at or before value. */
+            size_t lo = 0, hi = data.size() / 2;
+            while (lo < hi) {
+                size_t mid = (lo + hi) / 2;
+                if (data[2*mid] <= value) {
+                    lo = mid + 1;
+                } else {
+                    hi = mid;
+                }
+            }
+            return lo > 0 && value <= data[2*lo - 1];
+        }
+    case CONTAINER_FULL:
+        return true;
+    }
+    assert(0);
+    return false;
+}
+
+void
+FastCallSet::Container::add(uint16_t first, uint16_t last)
+{
+    if (kind == CONTAINER_FULL) {
+        return;
+    }
+
+    if (first == 0 && last == 0xffff) {
+        std::vector<uint16_t>().swap(data);
+        kind = CONTAINER_FULL;
+        return;
+    }
+
+    switch (kind) {
+    case CONTAINER_ARRAY:
+        if (first == last) {
+            /* Calls are mostly added in order. */
+            if (data.empty() || first > data.back()) {
+                if (data.size() < ARRAY_MAX) {
+                    data.push_back(first);
+                    return;
+                }
+            } else {
+                std::vector<uint16_t>::iterator it =
+                    std::lower_bound(data.begin(), data.end(), first);
+                if (*it == first) {
+                    return;
+                }
+                if (data.size() < ARRAY_MAX) {
+                    data.insert(it, first);
+                    return;
+                }
+            }
+        } else if (data.empty()) {
+            data.push_back(first);
+            data.push_back(last);
+            kind = CONTAINER_RUNS;
+            return;
+        }
+        /* Out of room, so see whether runs or a bitmap suit best. */
+        toBitmap();
+        set_bits(data, first, last);
+        shrink();
+        return;
+
+    case CONTAINER_BITMAP:
+        set_bits(data, first, last);
+        return;
+
+    case CONTAINER_RUNS:
+        {
+            /* Replace all the runs overlapping or adjacent to
+             * [first, last] with a single one. */
+            size_t count = data.size() / 2;
+            size_t i = 0, hi = count;
+            while (i < hi) {
+                size_t mid = (i + hi) / 2;
+                if ((unsigned)data[2*mid + 1] + 1 < first) {
+                    i = mid + 1;
+                } else {
+                    hi = mid;
+                }
+            }
+            size_t j = i;
+            while (j < count && data[2*j] <= (unsigned)last + 1) {
+                j++;
+            }
+
+            if (i == j) {
+                uint16_t run[2] = {first, last};
+                data.insert(data.begin() + 2*i, run, run + 2);
+            } else {
+                data[2*i] = std::min(data[2*i], first);
+                data[2*i + 1] = std::max(data[2*j - 1], last);
+                data.erase(data.begin() + 2*i + 2, data.begin() + 2*j);
+            }
+
+            /* Scattered calls are better off in an array or bitmap. */
+            if (data.size() > ARRAY_MAX ||
+                (data.size() == 2 && data[0] == 0 && data[1] == 0xffff)) {
+                shrink();
+            }
+        }
+        return;
+    }
+}
+
+unsigned long long
+FastCallSet::Container::cardinality(void) const
+{
+    unsigned count = 0;
+
+    switch (kind) {
+    case CONTAINER_ARRAY:
+        return data.size();
+    case CONTAINER_BITMAP:
+        for (unsigned i = 0; i < BITMAP_WORDS; i++) {
+            count += popcount16(data[i]);
+        }
+        return count;
+    case CONTAINER_RUNS:
+        for (size_t i = 0; i < data.size(); i += 2) {
+            count += data[i + 1] - data[i] + 1;
+        }
+        return count;
+    case CONTAINER_FULL:
+        return 65536ULL * (last_key - key + 1);
+    }
+    assert(0);
+    return 0;
 }
 
 bool
-FastCallSet::empty(void) const
+FastCallSet::Container::empty(void) const
 {
-    return max_level == 0;
+    return kind != CONTAINER_FULL && data.empty();
 }
 
-FastCallSet::FastCallSet(): head(0, 0, MAX_LEVEL)
+void
+FastCallSet::Container::toBitmap(void)
 {
-    head.first = std::numeric_limits<CallNo>::max();
-    head.last = std::numeric_limits<CallNo>::min();
+    if (kind == CONTAINER_BITMAP) {
+        return;
+    }
 
-    for (int i = 0; i < MAX_LEVEL; i++)
-        head.next[i] = NULL;
+    std::vector<uint16_t> words(BITMAP_WORDS, 0);
+
+    switch (kind) {
+    case CONTAINER_ARRAY:
+        for (size_t i = 0; i < data.size(); i++) {
+            words[data[i] >> 4] |= 1 << (data[i] & 15);
+        }
+        break;
+    case CONTAINER_RUNS:
+        for (size_t i = 0; i < data.size(); i += 2) {
+            set_bits(words, data[i], data[i + 1]);
+        }
+        break;
+    case CONTAINER_FULL:
+        set_bits(words, 0, 0xffff);
+        break;
+    }
 
-    max_level = 0;
+    data.swap(words);
+    kind = CONTAINER_BITMAP;
 }
 
-/*
- * Generate a random level number, distributed
- * so that each level is 1/4 as likely as the one before
- *
- * Note that level numbers run 1 <= level < MAX_LEVEL
- */
-static int
-random_level (void)
+/* Switch to the most compact representation for the current contents. */
+void
+FastCallSet::Container::shrink(void)
 {
-    /* tricky bit -- each bit is '1' 75% of the time */
-    long int bits = os::random() | os::random();
-    int	level = 1;
+    toBitmap();
+
+    unsigned count = 0;
+    unsigned runs = 0;
+    unsigned carry = 0;
+    for (unsigned i = 0; i < BITMAP_WORDS; i++) {
+        unsigned w = data[i];
+        count += popcount16(w);
+        runs += popcount16(w & ~((w << 1) | carry) & 0xffff);
+        carry = w >> 15;
+    }
 
-    while (level < MAX_LEVEL)
-    {
-	if (bits & 1)
-	    break;
-        level++;
-	bits >>= 1;
+    if (count == 65536) {
+        std::vector<uint16_t>().swap(data);
+        kind = CONTAINER_FULL;
+        return;
     }
 
-    return level;
+    std::vector<uint16_t> values;
+    if (2*runs < BITMAP_WORDS && 2*runs < count) {
+        values.reserve(2*runs);
+        unsigned value = 0;
+        while (value < 65536) {
+            if (!((data[value >> 4] >> (value & 15)) & 1)) {
+                value++;
+                continue;
+            }
+            values.push_back(value);
+            while (value < 65536 && ((data[value >> 4] >> (value & 15)) & 1)) {
+                value++;
+            }
+            values.push_back(value - 1);
+        }
+        kind = CONTAINER_RUNS;
+    } else if (count < BITMAP_WORDS) {
+        values.reserve(count);
+        for (unsigned i = 0; i < BITMAP_WORDS; i++) {
+            for (unsigned w = data[i]; w; w &= w - 1) {
+                unsigned bit = popcount16((w & -w) - 1);
+                values.push_back(i*16 + bit);
+            }
+        }
+        kind = CONTAINER_ARRAY;
+    } else {
+        return;
+    }
+
+    data.swap(values);
 }
 
 void
-FastCallSet::add(CallNo first, CallNo last)
+FastCallSet::Container::unite(const Container &other)
 {
-    FastCallRange **update[MAX_LEVEL];
-    FastCallRange *node, *next;
-    int i, level;
+    if (kind == CONTAINER_FULL || other.empty()) {
+        return;
+    }
 
-    /* Find node immediately before insertion point. */
-    node = &head;
-    for (i = max_level - 1; i >= 0; i--) {
-        while (node->next[i] && first > node->next[i]->last) {
-            node = node->next[i];
+    if (other.kind == CONTAINER_FULL) {
+        std::vector<uint16_t>().swap(data);
+        kind = CONTAINER_FULL;
+        return;
+    }
+
+    if (kind == CONTAINER_ARRAY && other.kind == CONTAINER_ARRAY) {
+        std::vector<uint16_t> values;
+        values.reserve(data.size() + other.data.size());
+        std::set_union(data.begin(), data.end(),
+                       other.data.begin(), other.data.end(),
+                       std::back_inserter(values));
+        data.swap(values);
+        if (data.size() <= ARRAY_MAX) {
+            return;
         }
-        update[i] = &node->next[i];
+        toBitmap();
+        return;
     }
 
-    /* Can we contain first by expanding tail of current range by 1? */
-    if (node != &head && node->last == first - 1) {
+    toBitmap();
 
-        node->last = last;
-        goto MERGE_NODE_WITH_SUBSEQUENT_COVERED_NODES;
+    switch (other.kind) {
+    case CONTAINER_ARRAY:
+        for (size_t i = 0; i < other.data.size(); i++) {
+            data[other.data[i] >> 4] |= 1 << (other.data[i] & 15);
+        }
+        break;
+    case CONTAINER_BITMAP:
+        for (unsigned i = 0; i < BITMAP_WORDS; i++) {
+            data[i] |= other.data[i];
+        }
+        break;
+    case CONTAINER_RUNS:
+        for (size_t i = 0; i < other.data.size(); i += 2) {
+            set_bits(data, other.data[i], other.data[i + 1]);
+        }
+        break;
+    }
 
+    shrink();
+}
+
+void
+FastCallSet::Container::intersect(const Container &other)
+{
+    if (other.kind == CONTAINER_FULL) {
+        return;
     }
 
-    /* Current range could not contain first, look at next. */
-    node = node->next[0];
+    if (kind == CONTAINER_FULL) {
+        data = other.data;
+        kind = other.kind;
+        return;
+    }
 
-    if (node) {
-        /* Do nothing if new range is already entirely contained. */
-        if (node->first <= first && node->last >= last) {
-            return;
+    /* Arrays are small, so just probe the other container. */
+    if (kind == CONTAINER_ARRAY) {
+        std::vector<uint16_t>::iterator out = data.begin();
+        for (std::vector<uint16_t>::const_iterator it = data.begin(); it != data.end(); it++) {
+            if (other.contains(*it)) {
+                *out++ = *it;
+            }
         }
+        data.erase(out, data.end());
+        return;
+    }
 
-        /* If last is already included, we can simply expand
-         * node->first to fully include the range. */
-        if (node->first <= last && node->last >= last) {
-            node->first = first;
-            return;
+    if (other.kind == CONTAINER_ARRAY) {
+        std::vector<uint16_t> values;
+        for (std::vector<uint16_t>::const_iterator it = other.data.begin(); it != other.data.end(); it++) {
+            if (contains(*it)) {
+                values.push_back(*it);
+            }
+        }
+        data.swap(values);
+        kind = CONTAINER_ARRAY;
+        return;
+    }
+
+    toBitmap();
+
+    if (other.kind == CONTAINER_BITMAP) {
+        for (unsigned i = 0; i < BITMAP_WORDS; i++) {
+            data[i] &= other.data[i];
+        }
+    } else {
+        Container mask(other);
+        mask.toBitmap();
+        for (unsigned i = 0; i < BITMAP_WORDS; i++) {
+            data[i] &= mask.data[i];
+        }
+    }
+
+    shrink();
+}
+
+FastCallSet::FastCallSet()
+{
+}
+
+bool
+FastCallSet::empty(void) const
+{
+    return containers.empty();
+}
+
+/* Index of the first container whose last key is not less than 'key'. */
+size_t
+FastCallSet::find(unsigned key) const
+{
+    /* Call numbers are usually spread over consecutive chunks, in
+     * which case the position can be computed directly. */
+    if (!containers.empty() && key >= containers[0].key) {
+        size_t guess = key - containers[0].key;
+        if (guess < containers.size() && containers[guess].key == key) {
+            return guess;
         }
+    }
 
-        /* This is our candidate node if first is contained */
-        if (node->first <= first && node->last >= first) {
-            node->last = last;
-            goto MERGE_NODE_WITH_SUBSEQUENT_COVERED_NODES;
+    size_t lo = 0, hi = containers.size();
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (containers[mid].last_key < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
         }
     }
+    return lo;
+}
 
-    /* Not possible to expand any existing node, so create a new one. */
+/* Add [first, last] within a single chunk. */
+void
+FastCallSet::addChunk(unsigned key, uint16_t first, uint16_t last)
+{
+    if (first == 0 && last == 0xffff) {
+        addFull(key, key);
+        return;
+    }
 
-    level = random_level();
+    size_t i = find(key);
+    if (i == containers.size() || containers[i].key > key) {
+        containers.insert(containers.begin() + i, Container(key, CONTAINER_ARRAY));
+    }
 
-    /* Handle first node of this level. */
-    if (level > max_level) {
-        level = max_level + 1;
-        update[max_level] = &head.next[max_level];
-        max_level = level;
+    Container &container = containers[i];
+    if (container.kind == CONTAINER_FULL) {
+        return;
     }
 
-    node = new FastCallRange(first, last, level);
+    container.add(first, last);
+    if (container.kind == CONTAINER_FULL) {
+        /* Merge with any full neighbours. */
+        addFull(key, key);
+    }
+}
+
+/* Add every chunk from first_key to last_key, replacing the containers
+ * within and merging with the full ones next to them. */
+void
+FastCallSet::addFull(unsigned first_key, unsigned last_key)
+{
+    size_t i = find(first_key);
+    if (i > 0 &&
+        containers[i - 1].kind == CONTAINER_FULL &&
+        containers[i - 1].last_key + 1U == first_key) {
+        --i;
+    }
 
-    /* Perform insertion into all lists. */
-    for (i = 0; i < level; i++) {
-        node->next[i] = *update[i];
-        *update[i] = node;
+    size_t j = i;
+    while (j < containers.size() &&
+           (containers[j].key <= last_key ||
+            (containers[j].kind == CONTAINER_FULL && containers[j].key == last_key + 1))) {
+        ++j;
     }
 
-MERGE_NODE_WITH_SUBSEQUENT_COVERED_NODES:
-    next = node->next[0];
-    while (next && next->first <= node->last + 1) {
-        if (next->last > node->last)
-            node->last = next->last;
+    if (i == j) {
+        containers.insert(containers.begin() + i, Container(first_key, CONTAINER_FULL));
+        containers[i].last_key = last_key;
+        return;
+    }
 
-        /* Delete node 'next' */
-        for (i = 0; i < node->level && i < next->level; i++) {
-            node->next[i] = next->next[i];
-        }
+    Container &container = containers[i];
+    container.key = std::min<unsigned>(container.key, first_key);
+    container.last_key = std::max<unsigned>(containers[j - 1].last_key, last_key);
+    container.kind = CONTAINER_FULL;
+    std::vector<uint16_t>().swap(container.data);
+    containers.erase(containers.begin() + i + 1, containers.begin() + j);
+}
 
-        for (; i < next->level; i++) {
-            *update[i] = next->next[i];
+/* Append 'container' to 'result', which must not hold any container
+ * starting after it, taking its data. */
+void
+FastCallSet::append(std::vector<Container> &result, Container &container)
+{
+    if (!result.empty() && result.back().kind == CONTAINER_FULL) {
+        Container &back = result.back();
+        if (container.key <= back.last_key) {
+            if (container.kind == CONTAINER_FULL && container.last_key > back.last_key) {
+                back.last_key = container.last_key;
+            }
+            return;
+        }
+        if (container.kind == CONTAINER_FULL && container.key == back.last_key + 1U) {
+            back.last_key = container.last_key;
+            return;
         }
+    }
+
+    result.push_back(Container(container.key, container.kind));
+    result.back().last_key = container.last_key;
+    result.back().data.swap(container.data);
+}
 
-        delete next;
+void
+FastCallSet::add(CallNo first, CallNo last)
+{
+    if (first > last) {
+        return;
+    }
+
+    unsigned first_key = first >> 16;
+    unsigned last_key = last >> 16;
 
-        next = node->next[0];
+    if (first_key == last_key) {
+        addChunk(first_key, first & 0xffff, last & 0xffff);
+        return;
+    }
+
+    /* Partial chunks at either end, and the whole ones in between. */
+    unsigned full_first_key = first_key;
+    unsigned full_last_key = last_key;
+    if (first & 0xffff) {
+        addChunk(first_key, first & 0xffff, 0xffff);
+        ++full_first_key;
+    }
+    if ((last & 0xffff) != 0xffff) {
+        addChunk(last_key, 0, last & 0xffff);
+        --full_last_key;
+    }
+    if (full_first_key <= full_last_key) {
+        addFull(full_first_key, full_last_key);
     }
 }
 
@@ -190,20 +562,110 @@ FastCallSet::add(CallNo call_no)
 bool
 FastCallSet::contains(CallNo call_no) const
 {
-    const FastCallRange *node;
-    int i;
+    unsigned key = call_no >> 16;
 
-    node = &head;
-    for (i = max_level - 1; i >= 0; i--) {
-        while (node->next[i] && call_no > node->next[i]->last) {
-            node = node->next[i];
+    size_t i = find(key);
+    if (i == containers.size() || containers[i].key > key) {
+        return false;
+    }
+
+    return containers[i].contains(call_no & 0xffff);
+}
+
+void
+FastCallSet::unite(const FastCallSet &other)
+{
+    std::vector<Container> result;
+    result.reserve(containers.size() + other.containers.size());
+
+    std::vector<Container>::iterator it = containers.begin();
+    std::vector<Container>::const_iterator other_it = other.containers.begin();
+    while (it != containers.end() || other_it != other.containers.end()) {
+        if (other_it == other.containers.end() ||
+            (it != containers.end() && it->key < other_it->key)) {
+            append(result, *it);
+            ++it;
+        } else if (it == containers.end() || other_it->key < it->key) {
+            Container copy(*other_it);
+            append(result, copy);
+            ++other_it;
+        } else if (it->kind == CONTAINER_FULL || other_it->kind == CONTAINER_FULL) {
+            /* Whichever spans further covers the other. */
+            if (it->kind == CONTAINER_FULL && it->last_key >= other_it->last_key) {
+                append(result, *it);
+            } else {
+                Container copy(*other_it);
+                append(result, copy);
+            }
+            ++it;
+            ++other_it;
+        } else {
+            it->unite(*other_it);
+            append(result, *it);
+            ++it;
+            ++other_it;
         }
     }
 
-    node = node->next[0];
+    containers.swap(result);
+}
 
-    if (node == NULL)
-        return false;
+void
+FastCallSet::intersect(const FastCallSet &other)
+{
+    std::vector<Container> result;
+
+    std::vector<Container>::iterator it = containers.begin();
+    std::vector<Container>::const_iterator other_it = other.containers.begin();
+    while (it != containers.end() && other_it != other.containers.end()) {
+        if (it->last_key < other_it->key) {
+            ++it;
+            continue;
+        }
+        if (other_it->last_key < it->key) {
+            ++other_it;
+            continue;
+        }
+
+        if (it->kind == CONTAINER_FULL && other_it->kind == CONTAINER_FULL) {
+            Container overlap(std::max(it->key, other_it->key), CONTAINER_FULL);
+            overlap.last_key = std::min(it->last_key, other_it->last_key);
+            append(result, overlap);
+        } else if (it->kind == CONTAINER_FULL) {
+            Container copy(*other_it);
+            append(result, copy);
+        } else {
+            /* A full container on the other side keeps this one whole. */
+            if (other_it->kind != CONTAINER_FULL) {
+                it->intersect(*other_it);
+            }
+            if (!it->empty()) {
+                append(result, *it);
+            }
+        }
+
+        /* Move past whichever ends first. */
+        if (it->last_key < other_it->last_key) {
+            ++it;
+        } else if (other_it->last_key < it->last_key) {
+            ++other_it;
+        } else {
+            ++it;
+            ++other_it;
+        }
+    }
+
+    containers.swap(result);
+}
+
+unsigned long long
+FastCallSet::size(void) const
+{
+    unsigned long long count = 0;
+
+    for (std::vector<Container>::const_iterator it = containers.begin(); it != containers.end(); ++it) {
+        count += it->cardinality();
+    }
 
-    return node->contains(call_no);
+    return count;
 }
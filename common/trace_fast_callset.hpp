@@ -29,6 +29,10 @@
 #ifndef _TRACE_FAST_CALLSET_HPP_
 #define _TRACE_FAST_CALLSET_HPP_
 
+#include <stdint.h>
+
+#include <vector>
+
 #include "trace_model.hpp"
 
 namespace trace {
@@ -47,38 +51,23 @@ namespace trace {
  *
  *   Sophistications:
  *
- *	* This callset is implemented with a skip list for
- *	  (probabilistically) logarithmic lookup times for
- *	  out-of-order lookups.
+ *	* This callset is implemented as a compressed bitmap, in the
+ *	  manner of "Roaring" bitmaps: call numbers are split in chunks
+ *	  of 65536 by their upper 16 bits, and each chunk is stored in
+ *	  whichever of a sorted array, a plain bitmap, or a list of runs
+ *	  is smallest for its contents.  Consecutive full chunks share a
+ *	  single entry.  Lookups are a binary search over the chunks
+ *	  followed by a (mostly constant time) probe within it.
  *
- *	* This callset optimizes the addition of new calls which are
- *        within or adjacent to existing ranges, (by either doing
- *        nothing, expanding the limits of an existing range, or also
- *        merging two or more ranges).
+ *	* Memory use stays bounded at 8KB per chunk however scattered the
+ *	  calls are, while dense ranges (including open-ended ones such
+ *	  as "100-") cost next to nothing.
  *
- * It would not be impossible to extend this code to support the
- * missing features of trace::CallSet, (though the 'step' and 'freq'
- * features would prevent some range-extending and merging
- * optimizations in some cases).
+ *	* Whole sets can be combined with unite() and intersect().
  */
 
-class FastCallRange {
-public:
-    CallNo first;
-    CallNo last;
-    int level;
-    FastCallRange **next;
-
-    FastCallRange(CallNo first, CallNo last, int level);
-
-    bool contains(CallNo call_no) const;
-};
-
 class FastCallSet {
 public:
-    FastCallRange head;
-    int max_level;
-
     FastCallSet();
 
     bool empty(void) const;
@@ -88,6 +77,56 @@ public:
     void add(CallNo call_no);
 
     bool contains(CallNo call_no) const;
+
+    /* Add all calls in 'other' to this set. */
+    void unite(const FastCallSet &other);
+
+    /* Remove all calls not in 'other' from this set. */
+    void intersect(const FastCallSet &other);
+
+    /* Number of calls in the set. */
+    unsigned long long size(void) const;
+
+private:
+    enum ContainerKind {
+        CONTAINER_ARRAY,
+        CONTAINER_BITMAP,
+        CONTAINER_RUNS,
+        CONTAINER_FULL
+    };
+
+    /* The calls whose upper 16 bits are 'key'.  'data' holds, depending
+     * on 'kind', the sorted lower 16 bits of each call, a bitmap of
+     * 65536 bits, (first, last) pairs of lower 16 bits, or nothing at
+     * all when every call in the chunk is present.  Full containers
+     * stand for all the chunks from 'key' to 'last_key'; for the other
+     * kinds the two are equal. */
+    struct Container {
+        uint16_t key;
+        uint16_t last_key;
+        uint8_t kind;
+        std::vector<uint16_t> data;
+
+        Container(uint16_t _key, uint8_t _kind) : key(_key), last_key(_key), kind(_kind) {}
+
+        bool contains(uint16_t value) const;
+        void add(uint16_t first, uint16_t last);
+        unsigned long long cardinality(void) const;
+        bool empty(void) const;
+
+        void toBitmap(void);
+        void shrink(void);
+        void unite(const Container &other);
+        void intersect(const Container &other);
+    };
+
+    /* Sorted by key, and never overlapping. */
+    std::vector<Container> containers;
+
+    size_t find(unsigned key) const;
+    void addChunk(unsigned key, uint16_t first, uint16_t last);
+    void addFull(unsigned first_key, unsigned last_key);
+    static void append(std::vector<Container> &result, Container &container);
 };
 
 } /* namespace trace */
@@ -35,7 +35,10 @@ using namespace trace;
 File::File(const std::string &filename,
            File::Mode mode)
     : m_mode(mode),
-      m_isOpened(false)
+      m_isOpened(false),
+      m_readPtr(NULL),
+      m_readEnd(NULL),
+      m_readBuffer(NULL)
 {
     if (!filename.empty()) {
         open(filename, m_mode);
@@ -54,3 +57,15 @@ void File::setCurrentOffset(const File::Offset &offset)
     assert(0);
 }
 
+
+bool File::readIndex(Index &index)
+{
+    return false;
+}
+
+
+bool File::writeIndex(const Index &index)
+{
+    return false;
+}
+
@@ -27,9 +27,12 @@
 #ifndef TRACE_FILE_HPP
 #define TRACE_FILE_HPP
 
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
 #include <string>
 #include <fstream>
-#include <stdint.h>
 
 
 #define SNAPPY_BYTE1 'a'
@@ -38,6 +41,9 @@
 
 namespace trace {
 
+struct Index;
+class SharedBuffer;
+
 class File {
 public:
     enum Mode {
@@ -58,6 +64,11 @@ public:
     static File *createSnappy(void);
     static File *createForRead(const char *filename);
     static File *createForWrite(const char *filename);
+
+    /**
+     * Append an index footer to an existing trace file which lacks one.
+     */
+    static bool appendIndex(const char *filename, const Index &index);
 public:
     File(const std::string &filename = std::string(),
          File::Mode mode = File::Read);
@@ -75,9 +86,33 @@ public:
     bool skip(size_t length);
     int percentRead();
 
+    /**
+     * Number of bytes that can be read right away from readPointer(), without
+     * going through the virtual interface.  May be zero even when there is
+     * more data to read.
+     */
+    size_t available() const;
+    const char *readPointer() const;
+    void advance(size_t length);
+
+    /**
+     * Buffer holding the bytes at readPointer(), if the implementation lets
+     * them be referenced in place, or NULL.  Callers must take their own
+     * reference to keep it.
+     */
+    SharedBuffer *readBuffer() const;
+
+    /*
+     * When writing, the offsets returned by currentOffset() are only
+     * meaningful to writeIndex(), which translates them into offsets that can
+     * be used when reading the file back.
+     */
     virtual bool supportsOffsets() const = 0;
     virtual File::Offset currentOffset() = 0;
     virtual void setCurrentOffset(const File::Offset &offset);
+
+    virtual bool readIndex(Index &index);
+    virtual bool writeIndex(const Index &index);
 protected:
     virtual bool rawOpen(const std::string &filename, File::Mode mode) = 0;
     virtual bool rawWrite(const void *buffer, size_t length) = 0;
@@ -91,6 +126,15 @@ protected:
 protected:
     File::Mode m_mode;
     bool m_isOpened;
+
+    /*
+     * Span of decompressed data which getc(), read() and skip() consume
+     * inline.  Implementations that support it must take the read position
+     * from m_readPtr, and update both pointers, in every raw read method.
+     */
+    const char *m_readPtr;
+    const char *m_readEnd;
+    SharedBuffer *m_readBuffer;
 };
 
 inline bool File::isOpened() const
@@ -114,6 +158,27 @@ inline bool File::open(const std::string &filename, File::Mode mode)
     return m_isOpened;
 }
 
+inline size_t File::available() const
+{
+    return m_readEnd - m_readPtr;
+}
+
+inline const char *File::readPointer() const
+{
+    return m_readPtr;
+}
+
+inline SharedBuffer *File::readBuffer() const
+{
+    return m_readBuffer;
+}
+
+inline void File::advance(size_t length)
+{
+    assert(length <= available());
+    m_readPtr += length;
+}
+
 inline bool File::write(const void *buffer, size_t length)
 {
     if (!m_isOpened || m_mode != File::Write) {
@@ -124,6 +189,11 @@ inline bool File::write(const void *buffer, size_t length)
 
 inline size_t File::read(void *buffer, size_t length)
 {
+    if (length <= available()) {
+        memcpy(buffer, m_readPtr, length);
+        m_readPtr += length;
+        return length;
+    }
     if (!m_isOpened || m_mode != File::Read) {
         return 0;
     }
@@ -144,6 +214,9 @@ inline void File::close()
         rawClose();
         m_isOpened = false;
     }
+    m_readPtr = NULL;
+    m_readEnd = NULL;
+    m_readBuffer = NULL;
 }
 
 inline void File::flush(void)
@@ -155,6 +228,9 @@ inline void File::flush(void)
 
 inline int File::getc()
 {
+    if (m_readPtr < m_readEnd) {
+        return (unsigned char)*m_readPtr++;
+    }
     if (!m_isOpened || m_mode != File::Read) {
         return -1;
     }
@@ -163,6 +239,10 @@ inline int File::getc()
 
 inline bool File::skip(size_t length)
 {
+    if (length <= available()) {
+        m_readPtr += length;
+        return true;
+    }
     if (!m_isOpened || m_mode != File::Read) {
         return false;
     }
@@ -41,6 +41,14 @@
  * The default size of an uncompressed chunk is specified in
  * SNAPPY_CHUNK_SIZE.
  *
+ * The chunks may be followed by an index footer (see trace_index.hpp):
+ * footer {
+ *     uint32 - zero, which marks the end of the chunks
+ *     serialized index
+ *     uint32 - specifying the length of the serialized index
+ *     SNAPPY_INDEX_MAGIC
+ * }
+ *
  * Note:
  * Currently the default size for a a to-be-compressed data is
  * 1mb, meaning that the compressed data will be <= 1mb.
@@ -48,6 +56,25 @@
  * to offer a pretty good compression/disk io speed ratio
  * but that might change.
  *
+ * When writing, full chunks are by default handed over to a background
+ * thread which compresses and writes them, so that the thread which filled
+ * the cache only pays for a memcpy.  The number of chunks that may be queued
+ * is controlled by the APITRACE_COMPRESS_QUEUE environment variable; setting
+ * it to zero compresses the chunks synchronously instead.
+ *
+ * Likewise, when reading, a background thread reads and decompresses the
+ * chunks ahead of the one being consumed, so that decompression overlaps
+ * with parsing.  The number of chunks it may get ahead is controlled by the
+ * APITRACE_READ_AHEAD environment variable; zero disables it.
+ *
+ * Files are memory mapped for reading whenever possible, so that chunks are
+ * decompressed straight from the mapping instead of being copied through
+ * the stream first.
+ *
+ * Decompressed chunks are kept in reference counted buffers, so that large
+ * blobs parsed from them can point straight into the chunk instead of being
+ * copied out of it.
+ *
  */
 
 
@@ -55,15 +82,39 @@
 
 #include <iostream>
 #include <algorithm>
+#include <deque>
+#include <vector>
 
 #include <assert.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "os_mmap.hpp"
+#include "os_process.hpp"
+#include "os_thread.hpp"
+#include "trace_buffer.hpp"
 #include "trace_file.hpp"
+#include "trace_index.hpp"
 
 
 #define SNAPPY_CHUNK_SIZE (1 * 1024 * 1024)
 
+/*
+ * Default number of full chunks that can be waiting for the compressor
+ * thread.  Writers block once this many chunks are pending.
+ */
+#define SNAPPY_WRITE_QUEUE_DEPTH 2
+
+/*
+ * Default number of chunks that the decompressor thread may read ahead of
+ * the one being consumed.
+ */
+#define SNAPPY_READ_AHEAD_DEPTH 2
+
+#define SNAPPY_INDEX_MAGIC "atindex1"
+#define SNAPPY_INDEX_MAGIC_SIZE 8
+#define SNAPPY_FOOTER_TRAILER_SIZE (4 + SNAPPY_INDEX_MAGIC_SIZE)
+
 
 
 using namespace trace;
@@ -78,6 +129,9 @@ public:
     virtual bool supportsOffsets() const;
     virtual File::Offset currentOffset();
     virtual void setCurrentOffset(const File::Offset &offset);
+
+    virtual bool readIndex(Index &index);
+    virtual bool writeIndex(const Index &index);
 protected:
     virtual bool rawOpen(const std::string &filename, File::Mode mode);
     virtual bool rawWrite(const void *buffer, size_t length);
@@ -105,13 +159,55 @@ private:
     }
     inline bool endOfData() const
     {
-        return m_stream.eof() && freeCacheSize() == 0;
+        return m_endOfChunks && freeCacheSize() == 0;
+    }
+
+    /*
+     * When reading, the File base class consumes the cache inline through
+     * m_readPtr, so take the position from it on entry to every read method,
+     * and hand it back on exit.
+     */
+    inline void fetchReadPtr()
+    {
+        if (m_readPtr) {
+            m_cachePtr = m_cache + (m_readPtr - m_cache);
+        }
+    }
+    inline void publishReadPtr()
+    {
+        m_readPtr = m_cachePtr;
+        m_readEnd = m_cache + m_cacheSize;
+        m_readBuffer = m_cacheBuffer;
     }
+    void readFooter();
+    bool readAt(uint64_t position, void *buffer, size_t length);
+    uint64_t readPosition();
+    void seekRead(uint64_t position);
+    size_t readChunk(const char **compressedData);
     void flushWriteCache();
     void flushReadCache(size_t skipLength = 0);
     void createCache(size_t size);
     void writeCompressedLength(size_t length);
     size_t readCompressedLength();
+
+    void compressChunk(const char *data, size_t length);
+
+    void startWriterThread(unsigned queueDepth);
+    void stopWriterThread();
+    void queueWriteCache();
+    void drainWriteQueue();
+    bool writerAlive();
+    void abandonWriterThread();
+
+    static void *writerThread(SnappyFile *_this);
+    void runWriter();
+
+    void startReaderThread(unsigned depth);
+    void stopReaderThread();
+    void seekReadAhead(uint64_t position);
+
+    static void *readerThread(SnappyFile *_this);
+    void runReader();
 private:
     std::fstream m_stream;
     size_t m_cacheMaxSize;
@@ -119,19 +215,146 @@ private:
     char *m_cache;
     char *m_cachePtr;
 
+    /*
+     * When reading, m_cache is the data of this buffer, so that parsed values
+     * can refer to the decompressed bytes instead of copying them.  A buffer
+     * that is still referenced is never reused.
+     */
+    SharedBuffer *m_cacheBuffer;
+
     char *m_compressedCache;
 
     File::Offset m_currentOffset;
     std::streampos m_endPos;
+
+    /*
+     * When reading from a memory mapped file, m_stream is not used, and
+     * m_mappingPos is the read position.
+     */
+    os::MappedFile m_mapping;
+    uint64_t m_mappingPos;
+
+    /*
+     * Whether the cache holds the decompressed contents of the chunk at
+     * m_currentOffset.chunk.
+     */
+    bool m_cacheValid;
+
+    /*
+     * Whether the last chunk has been consumed.
+     */
+    bool m_endOfChunks;
+
+    std::string m_indexData;
+
+    /*
+     * When writing, number of chunks flushed so far, and the position in the
+     * stream where each one was written.
+     */
+    uint64_t m_numChunks;
+    std::vector<uint64_t> m_chunkPositions;
+
+    struct PendingChunk {
+        char *data;
+        size_t length;
+    };
+
+    /*
+     * Asynchronous write state.  The chunk buffers are owned by
+     * m_writeBuffers; m_cache is always one of them while the writer thread
+     * is running.  The queues are protected by m_writeMutex.
+     */
+    bool m_asyncWrite;
+    std::vector<char *> m_writeBuffers;
+    std::vector<char *> m_freeBuffers;
+    std::deque<PendingChunk> m_pendingChunks;
+    bool m_writerStop;
+    bool m_writerBusy;
+    uint64_t m_writerOffset;
+    os::ProcessId m_writerProcess;
+    os::mutex m_writeMutex;
+    os::condition_variable m_pendingCond;
+    os::condition_variable m_doneCond;
+    os::thread m_writerThread;
+
+    struct ReadChunk {
+        SharedBuffer *buffer;
+        size_t size;
+        uint64_t position;
+        bool end;
+    };
+
+    /*
+     * Asynchronous read state.  The decompressor thread owns the read position and
+     * m_compressedCache, taking buffers from m_emptyChunks and handing them
+     * back decompressed in m_readyChunks.  Seeks bump m_readGeneration, so
+     * that chunks read from the old position are discarded.  All protected
+     * by m_readMutex.
+     */
+    bool m_asyncRead;
+    std::vector<ReadChunk> m_emptyChunks;
+    std::deque<ReadChunk> m_readyChunks;
+    unsigned m_readGeneration;
+    bool m_readSeek;
+    uint64_t m_readSeekPosition;
+    bool m_readerStop;
+    os::mutex m_readMutex;
+    os::condition_variable m_readerCond;
+    os::condition_variable m_readyCond;
+    os::thread m_readerThread;
 };
 
+
+/*
+ * Set on the compressor thread, so that we don't wait on ourselves should
+ * an exception handler try to flush or close the file from within it.
+ */
+static OS_THREAD_SPECIFIC_PTR(void)
+isWriterThread;
+
+
+static unsigned
+getWriteQueueDepth(void)
+{
+    const char *value = getenv("APITRACE_COMPRESS_QUEUE");
+    if (!value) {
+        return SNAPPY_WRITE_QUEUE_DEPTH;
+    }
+    return atoi(value) > 0 ? atoi(value) : 0;
+}
+
+static unsigned
+getReadAheadDepth(void)
+{
+    const char *value = getenv("APITRACE_READ_AHEAD");
+    if (!value) {
+        return SNAPPY_READ_AHEAD_DEPTH;
+    }
+    return atoi(value) > 0 ? atoi(value) : 0;
+}
+
 SnappyFile::SnappyFile(const std::string &filename,
                               File::Mode mode)
     : File(),
       m_cacheMaxSize(SNAPPY_CHUNK_SIZE),
       m_cacheSize(m_cacheMaxSize),
       m_cache(new char [m_cacheMaxSize]),
-      m_cachePtr(m_cache)
+      m_cachePtr(m_cache),
+      m_cacheBuffer(NULL),
+      m_mappingPos(0),
+      m_cacheValid(false),
+      m_endOfChunks(false),
+      m_numChunks(0),
+      m_asyncWrite(false),
+      m_writerStop(false),
+      m_writerBusy(false),
+      m_writerOffset(0),
+      m_writerProcess(0),
+      m_asyncRead(false),
+      m_readGeneration(0),
+      m_readSeek(false),
+      m_readSeekPosition(0),
+      m_readerStop(false)
 {
     size_t maxCompressedLength =
         snappy::MaxCompressedLength(SNAPPY_CHUNK_SIZE);
@@ -155,12 +378,34 @@ bool SnappyFile::rawOpen(const std::string &filename, File::Mode mode)
         fmode |= std::fstream::in;
     }
 
-    m_stream.open(filename.c_str(), fmode);
+    if (mode == File::Read &&
+        m_mapping.open(filename.c_str())) {
+        m_mappingPos = 0;
+    } else {
+        m_stream.open(filename.c_str(), fmode);
+    }
+
+    if (m_stream.is_open() && mode == File::Write) {
+        unsigned queueDepth = getWriteQueueDepth();
+        if (queueDepth) {
+            startWriterThread(queueDepth);
+        }
+    }
 
     //read in the initial buffer if we're reading
-    if (m_stream.is_open() && mode == File::Read) {
+    if (m_mapping.isOpen()) {
+        m_endPos = m_mapping.size();
+        readFooter();
+
+        // read the snappy file identifier
+        unsigned char bytes[2] = {0, 0};
+        readAt(0, bytes, sizeof bytes);
+        assert(bytes[0] == SNAPPY_BYTE1 && bytes[1] == SNAPPY_BYTE2);
+        seekRead(sizeof bytes);
+    } else if (m_stream.is_open() && mode == File::Read) {
         m_stream.seekg(0, std::ios::end);
         m_endPos = m_stream.tellg();
+        readFooter();
         m_stream.seekg(0, std::ios::beg);
 
         // read the snappy file identifier
@@ -168,14 +413,149 @@ bool SnappyFile::rawOpen(const std::string &filename, File::Mode mode)
         m_stream >> byte1;
         m_stream >> byte2;
         assert(byte1 == SNAPPY_BYTE1 && byte2 == SNAPPY_BYTE2);
+    }
+
+    if (mode == File::Read &&
+        (m_mapping.isOpen() || m_stream.is_open())) {
+        delete [] m_cache;
+        m_cacheBuffer = new SharedBuffer(SNAPPY_CHUNK_SIZE);
+        m_cache = m_cacheBuffer->data;
+        m_cacheMaxSize = m_cacheBuffer->capacity;
+        m_cachePtr = m_cache;
+
+        m_endOfChunks = false;
+        unsigned readAheadDepth = getReadAheadDepth();
+        if (readAheadDepth) {
+            startReaderThread(readAheadDepth);
+        }
 
         flushReadCache();
+        publishReadPtr();
     } else if (m_stream.is_open() && mode == File::Write) {
         // write the snappy file identifier
         m_stream << SNAPPY_BYTE1;
         m_stream << SNAPPY_BYTE2;
+        m_numChunks = 0;
+        m_chunkPositions.clear();
+    }
+    return m_mapping.isOpen() || m_stream.is_open();
+}
+
+/*
+ * Look for an index footer at the end of the stream, and if found, exclude it
+ * from the data.
+ */
+void SnappyFile::readFooter()
+{
+    m_indexData.clear();
+
+    uint64_t endPos = m_endPos;
+    if (endPos < 2 + 4 + SNAPPY_FOOTER_TRAILER_SIZE) {
+        return;
+    }
+
+    unsigned char trailer[SNAPPY_FOOTER_TRAILER_SIZE];
+    if (!readAt(endPos - SNAPPY_FOOTER_TRAILER_SIZE, trailer, sizeof trailer) ||
+        memcmp(trailer + 4, SNAPPY_INDEX_MAGIC, SNAPPY_INDEX_MAGIC_SIZE) != 0) {
+        return;
+    }
+
+    size_t length;
+    length  =  (size_t)trailer[0];
+    length |= ((size_t)trailer[1] <<  8);
+    length |= ((size_t)trailer[2] << 16);
+    length |= ((size_t)trailer[3] << 24);
+
+    uint64_t footerSize = 4 + length + SNAPPY_FOOTER_TRAILER_SIZE;
+    if (endPos < 2 + footerSize) {
+        return;
+    }
+
+    m_indexData.resize(length);
+    if (length &&
+        !readAt(endPos - footerSize + 4, &m_indexData[0], length)) {
+        m_indexData.clear();
+        return;
+    }
+
+    m_endPos = endPos - footerSize;
+}
+
+/*
+ * Read from an absolute position, regardless of the current one.
+ */
+bool SnappyFile::readAt(uint64_t position, void *buffer, size_t length)
+{
+    if (m_mapping.isOpen()) {
+        if (position + length > m_mapping.size()) {
+            return false;
+        }
+        memcpy(buffer, m_mapping.data() + position, length);
+        return true;
+    }
+
+    m_stream.seekg(position, std::ios::beg);
+    m_stream.read((char *)buffer, length);
+    if (m_stream.fail()) {
+        m_stream.clear();
+        return false;
+    }
+    return true;
+}
+
+uint64_t SnappyFile::readPosition()
+{
+    if (m_mapping.isOpen()) {
+        return m_mappingPos;
+    }
+    return m_stream.tellg();
+}
+
+void SnappyFile::seekRead(uint64_t position)
+{
+    if (m_mapping.isOpen()) {
+        m_mappingPos = position;
+    } else {
+        // to remove eof bit
+        m_stream.clear();
+        m_stream.seekg(position, std::ios::beg);
     }
-    return m_stream.is_open();
+}
+
+/*
+ * Read the next chunk's compressed data, returning its length, or zero at
+ * the end of the chunks.  When mapped, the data is not copied.
+ */
+size_t SnappyFile::readChunk(const char **compressedData)
+{
+    if (m_mapping.isOpen()) {
+        uint64_t endPos = m_endPos;
+        if (m_mappingPos + 4 > endPos) {
+            return 0;
+        }
+        const unsigned char *buf =
+            (const unsigned char *)m_mapping.data() + m_mappingPos;
+        size_t length;
+        length  =  (size_t)buf[0];
+        length |= ((size_t)buf[1] <<  8);
+        length |= ((size_t)buf[2] << 16);
+        length |= ((size_t)buf[3] << 24);
+        if (m_mappingPos + 4 + length > endPos) {
+            // truncated
+            m_mappingPos = endPos;
+            return 0;
+        }
+        *compressedData = (const char *)buf + 4;
+        m_mappingPos += 4 + length;
+        return length;
+    }
+
+    size_t compressedLength = readCompressedLength();
+    if (compressedLength) {
+        m_stream.read((char*)m_compressedCache, compressedLength);
+    }
+    *compressedData = m_compressedCache;
+    return compressedLength;
 }
 
 bool SnappyFile::rawWrite(const void *buffer, size_t length)
@@ -210,6 +590,8 @@ bool SnappyFile::rawWrite(const void *buffer, size_t length)
 
 size_t SnappyFile::rawRead(void *buffer, size_t length)
 {
+    fetchReadPtr();
+
     if (endOfData()) {
         return 0;
     }
@@ -230,11 +612,13 @@ size_t SnappyFile::rawRead(void *buffer, size_t length)
                 flushReadCache();
             }
             if (!m_cacheSize) {
+                publishReadPtr();
                 return length - sizeToRead;
             }
         }
     }
 
+    publishReadPtr();
     return length;
 }
 
@@ -250,9 +634,21 @@ void SnappyFile::rawClose()
 {
     if (m_mode == File::Write) {
         flushWriteCache();
+        if (m_asyncWrite) {
+            stopWriterThread();
+        }
+    }
+    if (m_asyncRead) {
+        stopReaderThread();
     }
+    m_mapping.close();
     m_stream.close();
-    delete [] m_cache;
+    if (m_cacheBuffer) {
+        m_cacheBuffer->release();
+        m_cacheBuffer = NULL;
+    } else {
+        delete [] m_cache;
+    }
     m_cache = NULL;
     m_cachePtr = NULL;
 }
@@ -261,50 +657,426 @@ void SnappyFile::rawFlush()
 {
     assert(m_mode == File::Write);
     flushWriteCache();
+    if (m_asyncWrite) {
+        drainWriteQueue();
+    }
     m_stream.flush();
 }
 
 void SnappyFile::flushWriteCache()
 {
+    // Should the writer thread itself get here, from an exception handler,
+    // it will never return to its queue.
+    if (m_asyncWrite && (isWriterThread || !writerAlive())) {
+        abandonWriterThread();
+    }
+
     size_t inputLength = usedCacheSize();
 
     if (inputLength) {
-        size_t compressedLength;
-
-        ::snappy::RawCompress(m_cache, inputLength,
-                              m_compressedCache, &compressedLength);
-
-        writeCompressedLength(compressedLength);
-        m_stream.write(m_compressedCache, compressedLength);
+        ++m_numChunks;
+        if (m_asyncWrite) {
+            queueWriteCache();
+        } else {
+            compressChunk(m_cache, inputLength);
+        }
         m_cachePtr = m_cache;
     }
     assert(m_cachePtr == m_cache);
 }
 
+void SnappyFile::compressChunk(const char *data, size_t length)
+{
+    size_t compressedLength;
+
+    m_chunkPositions.push_back(m_stream.tellp());
+
+    ::snappy::RawCompress(data, length,
+                          m_compressedCache, &compressedLength);
+
+    writeCompressedLength(compressedLength);
+    m_stream.write(m_compressedCache, compressedLength);
+}
+
+void SnappyFile::startWriterThread(unsigned queueDepth)
+{
+    assert(!m_asyncWrite);
+
+    // One buffer is always being filled (m_cache), while up to queueDepth
+    // full ones are waiting to be compressed.
+    m_writeBuffers.push_back(m_cache);
+    for (unsigned i = 0; i < queueDepth; ++i) {
+        char *buffer = new char[m_cacheMaxSize];
+        m_writeBuffers.push_back(buffer);
+        m_freeBuffers.push_back(buffer);
+    }
+
+    m_writerStop = false;
+    m_writerBusy = false;
+    m_writerProcess = os::getCurrentProcessId();
+    m_asyncWrite = true;
+    m_writerThread = os::thread(writerThread, this);
+}
+
+void SnappyFile::stopWriterThread()
+{
+    assert(m_asyncWrite);
+
+    m_writeMutex.lock();
+    m_writerStop = true;
+    m_writeMutex.unlock();
+    m_pendingCond.signal();
+
+    m_writerThread.join();
+    m_writerThread = os::thread();
+    m_asyncWrite = false;
+
+    assert(m_pendingChunks.empty());
+
+    // m_cache is deleted by the caller
+    for (unsigned i = 0; i < m_writeBuffers.size(); ++i) {
+        if (m_writeBuffers[i] != m_cache) {
+            delete [] m_writeBuffers[i];
+        }
+    }
+    m_writeBuffers.clear();
+    m_freeBuffers.clear();
+}
+
+/*
+ * Hand the current cache over to the writer thread, and grab an empty one,
+ * waiting for one to become available if the queue is full.
+ */
+void SnappyFile::queueWriteCache()
+{
+    PendingChunk chunk;
+    chunk.data = m_cache;
+    chunk.length = usedCacheSize();
+
+    os::unique_lock<os::mutex> lock(m_writeMutex);
+
+    m_pendingChunks.push_back(chunk);
+    m_pendingCond.signal();
+
+    while (m_freeBuffers.empty()) {
+        m_doneCond.wait(lock);
+    }
+    m_cache = m_freeBuffers.back();
+    m_freeBuffers.pop_back();
+}
+
+/*
+ * Whether the writer thread can still be relied upon.  On Windows,
+ * ExitProcess terminates all other threads before DLLs are detached and the
+ * trace closed, and a forked child never has the parent's threads.
+ */
+bool SnappyFile::writerAlive()
+{
+    if (m_writerProcess != os::getCurrentProcessId()) {
+        return false;
+    }
+#ifdef _WIN32
+    if (WaitForSingleObject(m_writerThread.native_handle(), 0) != WAIT_TIMEOUT) {
+        return false;
+    }
+#endif
+    return true;
+}
+
+/*
+ * Write out the chunks a dead writer thread left behind, and carry on
+ * synchronously.  The lock isn't taken, as the writer may have died holding
+ * it.
+ */
+void SnappyFile::abandonWriterThread()
+{
+    assert(m_asyncWrite);
+
+    // Rewrite any chunk the writer was killed in the middle of.
+    if (m_writerBusy) {
+        m_stream.clear();
+        m_stream.seekp(m_writerOffset);
+        while (!m_chunkPositions.empty() &&
+               m_chunkPositions.back() >= m_writerOffset) {
+            m_chunkPositions.pop_back();
+        }
+        m_writerBusy = false;
+    }
+
+    while (!m_pendingChunks.empty()) {
+        PendingChunk chunk = m_pendingChunks.front();
+        compressChunk(chunk.data, chunk.length);
+        m_pendingChunks.pop_front();
+    }
+
+    m_writerThread = os::thread();
+    m_asyncWrite = false;
+
+    for (unsigned i = 0; i < m_writeBuffers.size(); ++i) {
+        if (m_writeBuffers[i] != m_cache) {
+            delete [] m_writeBuffers[i];
+        }
+    }
+    m_writeBuffers.clear();
+    m_freeBuffers.clear();
+}
+
+/*
+ * Wait until all queued chunks have been written to the stream.
+ */
+void SnappyFile::drainWriteQueue()
+{
+    if (isWriterThread) {
+        return;
+    }
+
+    os::unique_lock<os::mutex> lock(m_writeMutex);
+    while (!m_pendingChunks.empty()) {
+        m_doneCond.wait(lock);
+    }
+}
+
+void *SnappyFile::writerThread(SnappyFile *_this)
+{
+    isWriterThread = _this;
+    _this->runWriter();
+    return 0;
+}
+
+void SnappyFile::runWriter()
+{
+    os::unique_lock<os::mutex> lock(m_writeMutex);
+
+    while (true) {
+        while (m_pendingChunks.empty() && !m_writerStop) {
+            m_pendingCond.wait(lock);
+        }
+        if (m_pendingChunks.empty()) {
+            break;
+        }
+
+        // Leave the chunk in the queue while it's being written, so that
+        // drainWriteQueue() waits for it too.
+        PendingChunk chunk = m_pendingChunks.front();
+        m_writerBusy = true;
+        m_writerOffset = m_stream.tellp();
+
+        lock.unlock();
+        compressChunk(chunk.data, chunk.length);
+        lock.lock();
+
+        m_writerBusy = false;
+        m_pendingChunks.pop_front();
+        m_freeBuffers.push_back(chunk.data);
+        m_doneCond.signal();
+    }
+}
+
+void SnappyFile::startReaderThread(unsigned depth)
+{
+    assert(!m_asyncRead);
+
+    for (unsigned i = 0; i < depth; ++i) {
+        ReadChunk chunk;
+        chunk.buffer = new SharedBuffer(SNAPPY_CHUNK_SIZE);
+        chunk.size = 0;
+        chunk.position = 0;
+        chunk.end = false;
+        m_emptyChunks.push_back(chunk);
+    }
+
+    m_readGeneration = 0;
+    m_readSeek = true;
+    m_readSeekPosition = readPosition();
+    m_readerStop = false;
+    m_asyncRead = true;
+    m_readerThread = os::thread(readerThread, this);
+}
+
+void SnappyFile::stopReaderThread()
+{
+    assert(m_asyncRead);
+
+    m_readMutex.lock();
+    m_readerStop = true;
+    m_readMutex.unlock();
+    m_readerCond.signal();
+
+    m_readerThread.join();
+    m_readerThread = os::thread();
+    m_asyncRead = false;
+
+    // m_cacheBuffer is released by the caller
+    for (unsigned i = 0; i < m_emptyChunks.size(); ++i) {
+        m_emptyChunks[i].buffer->release();
+    }
+    m_emptyChunks.clear();
+    for (unsigned i = 0; i < m_readyChunks.size(); ++i) {
+        m_readyChunks[i].buffer->release();
+    }
+    m_readyChunks.clear();
+}
+
+/*
+ * Discard whatever was read ahead, and have the decompressor thread carry on
+ * from the given position.
+ */
+void SnappyFile::seekReadAhead(uint64_t position)
+{
+    os::unique_lock<os::mutex> lock(m_readMutex);
+
+    while (!m_readyChunks.empty()) {
+        m_emptyChunks.push_back(m_readyChunks.front());
+        m_readyChunks.pop_front();
+    }
+
+    ++m_readGeneration;
+    m_readSeek = true;
+    m_readSeekPosition = position;
+    m_readerCond.signal();
+}
+
+void *SnappyFile::readerThread(SnappyFile *_this)
+{
+    _this->runReader();
+    return 0;
+}
+
+void SnappyFile::runReader()
+{
+    os::unique_lock<os::mutex> lock(m_readMutex);
+
+    bool end = false;
+    while (true) {
+        while (!m_readerStop &&
+               !m_readSeek &&
+               (end || m_emptyChunks.empty())) {
+            m_readerCond.wait(lock);
+        }
+        if (m_readerStop) {
+            break;
+        }
+
+        if (m_readSeek) {
+            seekRead(m_readSeekPosition);
+            m_readSeek = false;
+            end = false;
+            continue;
+        }
+
+        unsigned generation = m_readGeneration;
+        ReadChunk chunk = m_emptyChunks.back();
+        m_emptyChunks.pop_back();
+
+        lock.unlock();
+
+        chunk.position = readPosition();
+        const char *compressedData = NULL;
+        size_t compressedLength = readChunk(&compressedData);
+        if (compressedLength) {
+            ::snappy::GetUncompressedLength(compressedData, compressedLength,
+                                            &chunk.size);
+            if (chunk.buffer->isShared() ||
+                chunk.size > chunk.buffer->capacity) {
+                // Parsed values still refer to the old buffer, or it is too
+                // small
+                size_t capacity = std::max(chunk.size,
+                                           (size_t)SNAPPY_CHUNK_SIZE);
+                chunk.buffer->release();
+                chunk.buffer = new SharedBuffer(capacity);
+            }
+            ::snappy::RawUncompress(compressedData, compressedLength,
+                                    chunk.buffer->data);
+            chunk.end = false;
+        } else {
+            // A zero length marks either the end of the file or the start of
+            // the footer
+            chunk.size = 0;
+            chunk.end = true;
+        }
+
+        lock.lock();
+
+        if (generation == m_readGeneration) {
+            m_readyChunks.push_back(chunk);
+            m_readyCond.signal();
+            end = chunk.end;
+        } else {
+            m_emptyChunks.push_back(chunk);
+        }
+    }
+}
+
 void SnappyFile::flushReadCache(size_t skipLength)
 {
+    if (m_asyncRead) {
+        os::unique_lock<os::mutex> lock(m_readMutex);
+        while (m_readyChunks.empty()) {
+            m_readyCond.wait(lock);
+        }
+
+        // Give the current buffer back in exchange for the next chunk
+        ReadChunk chunk = m_readyChunks.front();
+        m_readyChunks.pop_front();
+
+        ReadChunk empty;
+        empty.buffer = m_cacheBuffer;
+        empty.size = 0;
+        empty.position = 0;
+        empty.end = false;
+        m_emptyChunks.push_back(empty);
+        m_readerCond.signal();
+
+        m_cacheBuffer = chunk.buffer;
+        m_cache = m_cacheBuffer->data;
+        m_cacheMaxSize = m_cacheBuffer->capacity;
+        m_cachePtr = m_cache;
+        m_cacheSize = chunk.size;
+        m_currentOffset.chunk = chunk.position;
+        m_cacheValid = !chunk.end;
+        m_endOfChunks = chunk.end;
+        return;
+    }
+
     //assert(m_cachePtr == m_cache + m_cacheSize);
-    m_currentOffset.chunk = m_stream.tellg();
-    size_t compressedLength;
-    compressedLength = readCompressedLength();
+    m_currentOffset.chunk = readPosition();
+    const char *compressedData = NULL;
+    size_t compressedLength = readChunk(&compressedData);
 
     if (compressedLength) {
-        m_stream.read((char*)m_compressedCache, compressedLength);
-        ::snappy::GetUncompressedLength(m_compressedCache, compressedLength,
+        ::snappy::GetUncompressedLength(compressedData, compressedLength,
                                         &m_cacheSize);
         createCache(m_cacheSize);
         if (skipLength < m_cacheSize) {
-            ::snappy::RawUncompress(m_compressedCache, compressedLength,
+            ::snappy::RawUncompress(compressedData, compressedLength,
                                     m_cache);
+            m_cacheValid = true;
+        } else {
+            m_cacheValid = false;
         }
+        m_endOfChunks = false;
     } else {
+        // A zero length marks either the end of the file or the start of the
+        // footer
         createCache(0);
+        m_cacheValid = false;
+        m_endOfChunks = true;
     }
 }
 
 void SnappyFile::createCache(size_t size)
 {
-    if (size > m_cacheMaxSize) {
+    if (m_cacheBuffer) {
+        if (m_cacheBuffer->isShared() ||
+            size > m_cacheBuffer->capacity) {
+            // Parsed values still refer to the old buffer, or it is too small
+            size_t capacity = std::max(size, (size_t)SNAPPY_CHUNK_SIZE);
+            m_cacheBuffer->release();
+            m_cacheBuffer = new SharedBuffer(capacity);
+            m_cache = m_cacheBuffer->data;
+            m_cacheMaxSize = m_cacheBuffer->capacity;
+        }
+    } else if (size > m_cacheMaxSize) {
         do {
             m_cacheMaxSize <<= 1;
         } while (size > m_cacheMaxSize);
@@ -352,26 +1124,104 @@ bool SnappyFile::supportsOffsets() const
 
 File::Offset SnappyFile::currentOffset()
 {
+    if (m_mode == File::Write) {
+        return File::Offset(m_numChunks, usedCacheSize());
+    }
+    fetchReadPtr();
     m_currentOffset.offsetInChunk = m_cachePtr - m_cache;
     return m_currentOffset;
 }
 
 void SnappyFile::setCurrentOffset(const File::Offset &offset)
 {
-    // to remove eof bit
-    m_stream.clear();
-    // seek to the start of a chunk
-    m_stream.seekg(offset.chunk, std::ios::beg);
-    // load the chunk
-    flushReadCache();
+    fetchReadPtr();
+
+    // avoid decompressing the same chunk again
+    if (!m_cacheValid ||
+        offset.chunk != m_currentOffset.chunk) {
+        if (m_asyncRead) {
+            seekReadAhead(offset.chunk);
+        } else {
+            // seek to the start of a chunk
+            seekRead(offset.chunk);
+        }
+        // load the chunk
+        flushReadCache();
+    }
     assert(m_cacheSize >= offset.offsetInChunk);
     // seek within our cache to the correct location within the chunk
     m_cachePtr = m_cache + offset.offsetInChunk;
+    publishReadPtr();
 
 }
 
+bool SnappyFile::readIndex(Index &index)
+{
+    if (m_indexData.empty()) {
+        return false;
+    }
+    return index.parse(m_indexData);
+}
+
+static void
+writeFooter(std::ostream &stream, const Index &index)
+{
+    std::string data;
+    index.serialize(data);
+
+    size_t length = data.size();
+    unsigned char buf[4];
+
+    memset(buf, 0, sizeof buf);
+    stream.write((const char *)buf, sizeof buf);
+
+    stream.write(data.data(), length);
+
+    buf[0] = length & 0xff; length >>= 8;
+    buf[1] = length & 0xff; length >>= 8;
+    buf[2] = length & 0xff; length >>= 8;
+    buf[3] = length & 0xff; length >>= 8;
+    assert(length == 0);
+    stream.write((const char *)buf, sizeof buf);
+
+    stream.write(SNAPPY_INDEX_MAGIC, SNAPPY_INDEX_MAGIC_SIZE);
+}
+
+bool SnappyFile::writeIndex(const Index &index)
+{
+    assert(m_mode == File::Write);
+
+    flushWriteCache();
+    if (m_asyncWrite) {
+        drainWriteQueue();
+    }
+
+    // Translate chunk numbers into stream positions.  Offsets past the last
+    // chunk refer to the end of the data.
+    Index translated(index);
+    uint64_t endPos = m_stream.tellp();
+    for (unsigned i = 0; i < translated.frames.size(); ++i) {
+        File::Offset &offset = translated.frames[i].offset;
+        offset.chunk = offset.chunk < m_chunkPositions.size() ?
+                       m_chunkPositions[offset.chunk] : endPos;
+    }
+    for (unsigned kind = 0; kind < SIG_KIND_COUNT; ++kind) {
+        Index::SigOffsets &sigs = translated.sigs[kind];
+        for (Index::SigOffsets::iterator it = sigs.begin(); it != sigs.end(); ++it) {
+            File::Offset &offset = it->second;
+            offset.chunk = offset.chunk < m_chunkPositions.size() ?
+                           m_chunkPositions[offset.chunk] : endPos;
+        }
+    }
+
+    writeFooter(m_stream, translated);
+    return !m_stream.fail();
+}
+
 bool SnappyFile::rawSkip(size_t length)
 {
+    fetchReadPtr();
+
     if (endOfData()) {
         return false;
     }
@@ -393,15 +1243,42 @@ bool SnappyFile::rawSkip(size_t length)
         }
     }
 
+    publishReadPtr();
     return true;
 }
 
 int SnappyFile::rawPercentRead()
 {
-    return int(100 * (double(m_stream.tellg()) / double(m_endPos)));
+    if (m_asyncRead) {
+        // the stream position belongs to the decompressor thread
+        return int(100 * (double(m_currentOffset.chunk) / double(m_endPos)));
+    }
+    return int(100 * (double(readPosition()) / double(m_endPos)));
 }
 
 
 File* File::createSnappy(void) {
     return new SnappyFile;
 }
+
+bool File::appendIndex(const char *filename, const Index &index)
+{
+    SnappyFile file;
+    if (!file.open(filename, File::Read)) {
+        return false;
+    }
+    Index existing;
+    bool indexed = file.readIndex(existing);
+    file.close();
+    if (indexed) {
+        return false;
+    }
+
+    std::ofstream stream(filename, std::ofstream::binary | std::ofstream::app);
+    if (!stream.is_open()) {
+        return false;
+    }
+    writeFooter(stream, index);
+    stream.close();
+    return !stream.fail();
+}
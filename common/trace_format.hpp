@@ -72,8 +72,18 @@ namespace trace {
  *
  * - version 5:
  *   - new call detail flag CALL_BACKTRACE
+ *
+ * - version 6:
+ *   - new call detail flag CALL_TIME
+ *
+ * Only traces which may contain CALL_TIME details are marked as version 6,
+ * so that traces recorded without call times remain readable by older
+ * tools.  TRACE_VERSION is the version written otherwise, and
+ * TRACE_VERSION_MAX the newest one the parser understands.
  */
 #define TRACE_VERSION 5
+#define TRACE_VERSION_CALL_TIME 6
+#define TRACE_VERSION_MAX TRACE_VERSION_CALL_TIME
 
 
 /*
@@ -90,6 +100,7 @@ namespace trace {
  *               | RET value
  *               | THREAD int
  *               | BACKTRACE int frame*
+ *               | TIME uint uint
  *               | END
  *
  *   value = NULL
@@ -143,6 +154,7 @@ enum CallDetail {
     CALL_RET,
     CALL_THREAD,
     CALL_BACKTRACE,
+    CALL_TIME,
 };
 
 enum Type {
@@ -0,0 +1,196 @@
+/**************************************************************************
+ *
+ * Copyright 2014 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+#include <assert.h>
+
+#include "trace_index.hpp"
+
+
+/*
+ * Serialized index, all integers being variable length unsigned integers
+ * as in the trace format:
+ *
+ *   index = version num_calls num_frames frame* num_sigs sig*
+ *
+ *   frame = call_no chunk offset_in_chunk
+ *
+ *   sig = kind id chunk offset_in_chunk
+ */
+#define INDEX_VERSION 1
+
+
+namespace trace {
+
+
+void
+Index::clear(void) {
+    frames.clear();
+    numCalls = 0;
+    for (unsigned kind = 0; kind < SIG_KIND_COUNT; ++kind) {
+        sigs[kind].clear();
+    }
+}
+
+
+void
+Index::addFrame(unsigned callNo, const File::Offset &offset) {
+    FrameEntry entry;
+    entry.callNo = callNo;
+    entry.offset = offset;
+    frames.push_back(entry);
+}
+
+
+void
+Index::addSig(SigKind kind, unsigned id, const File::Offset &offset) {
+    assert(kind < SIG_KIND_COUNT);
+    sigs[kind][id] = offset;
+}
+
+
+bool
+Index::findSig(SigKind kind, unsigned id, File::Offset &offset) const {
+    assert(kind < SIG_KIND_COUNT);
+    SigOffsets::const_iterator it = sigs[kind].find(id);
+    if (it == sigs[kind].end()) {
+        return false;
+    }
+    offset = it->second;
+    return true;
+}
+
+
+static void
+writeUInt(std::string &data, unsigned long long value) {
+    do {
+        unsigned char c = value & 0x7f;
+        value >>= 7;
+        if (value) {
+            c |= 0x80;
+        }
+        data.push_back(c);
+    } while (value);
+}
+
+
+static bool
+readUInt(const std::string &data, size_t &pos, unsigned long long &value) {
+    unsigned shift = 0;
+    value = 0;
+    while (pos < data.size() && shift < 64) {
+        unsigned char c = data[pos++];
+        value |= (unsigned long long)(c & 0x7f) << shift;
+        shift += 7;
+        if (!(c & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+void
+Index::serialize(std::string &data) const {
+    data.clear();
+
+    writeUInt(data, INDEX_VERSION);
+    writeUInt(data, numCalls);
+
+    writeUInt(data, frames.size());
+    for (std::vector<FrameEntry>::const_iterator it = frames.begin(); it != frames.end(); ++it) {
+        writeUInt(data, it->callNo);
+        writeUInt(data, it->offset.chunk);
+        writeUInt(data, it->offset.offsetInChunk);
+    }
+
+    size_t numSigs = 0;
+    for (unsigned kind = 0; kind < SIG_KIND_COUNT; ++kind) {
+        numSigs += sigs[kind].size();
+    }
+    writeUInt(data, numSigs);
+    for (unsigned kind = 0; kind < SIG_KIND_COUNT; ++kind) {
+        for (SigOffsets::const_iterator it = sigs[kind].begin(); it != sigs[kind].end(); ++it) {
+            writeUInt(data, kind);
+            writeUInt(data, it->first);
+            writeUInt(data, it->second.chunk);
+            writeUInt(data, it->second.offsetInChunk);
+        }
+    }
+}
+
+
+bool
+Index::parse(const std::string &data) {
+    clear();
+
+    size_t pos = 0;
+    unsigned long long version;
+    unsigned long long value;
+    if (!readUInt(data, pos, version) ||
+        version > INDEX_VERSION ||
+        !readUInt(data, pos, value)) {
+        return false;
+    }
+    numCalls = value;
+
+    unsigned long long numFrames;
+    if (!readUInt(data, pos, numFrames)) {
+        return false;
+    }
+    for (unsigned long long i = 0; i < numFrames; ++i) {
+        unsigned long long callNo, chunk, offsetInChunk;
+        if (!readUInt(data, pos, callNo) ||
+            !readUInt(data, pos, chunk) ||
+            !readUInt(data, pos, offsetInChunk)) {
+            clear();
+            return false;
+        }
+        addFrame(callNo, File::Offset(chunk, offsetInChunk));
+    }
+
+    unsigned long long numSigs;
+    if (!readUInt(data, pos, numSigs)) {
+        clear();
+        return false;
+    }
+    for (unsigned long long i = 0; i < numSigs; ++i) {
+        unsigned long long kind, id, chunk, offsetInChunk;
+        if (!readUInt(data, pos, kind) ||
+            !readUInt(data, pos, id) ||
+            !readUInt(data, pos, chunk) ||
+            !readUInt(data, pos, offsetInChunk) ||
+            kind >= SIG_KIND_COUNT) {
+            clear();
+            return false;
+        }
+        addSig(SigKind(kind), id, File::Offset(chunk, offsetInChunk));
+    }
+
+    return true;
+}
+
+
+} /* namespace trace */
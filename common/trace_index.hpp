@@ -0,0 +1,110 @@
+/**************************************************************************
+ *
+ * Copyright 2014 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * Trace seek index.
+ *
+ * An index maps frames to the place in the trace file where they start, and
+ * signatures to the place where they are defined, so that readers can jump
+ * straight into the middle of a trace without scanning everything before.
+ *
+ * The index is stored as a footer after the compressed data (see
+ * trace_file_snappy.cpp).  It is written by trace::Writer when closing the
+ * file, and can be added to existing traces with `apitrace index`.
+ */
+
+#ifndef _TRACE_INDEX_HPP_
+#define _TRACE_INDEX_HPP_
+
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "trace_file.hpp"
+
+
+namespace trace {
+
+
+enum SigKind {
+    SIG_FUNCTION = 0,
+    SIG_STRUCT,
+    SIG_ENUM,
+    SIG_BITMASK,
+    SIG_FRAME,
+    SIG_KIND_COUNT
+};
+
+
+struct Index
+{
+    /**
+     * Where a frame starts, i.e., the state of the parser right after the
+     * previous frame's last call was parsed.
+     */
+    struct FrameEntry {
+        unsigned callNo;
+        File::Offset offset;
+    };
+
+    /**
+     * Start of every frame, including a last one for the (possibly empty)
+     * calls after the last frame marker.
+     */
+    std::vector<FrameEntry> frames;
+
+    /**
+     * Total number of calls in the trace.
+     */
+    unsigned numCalls;
+
+    /**
+     * Offset of each signature definition, right after its ID.
+     */
+    typedef std::map<unsigned, File::Offset> SigOffsets;
+    SigOffsets sigs[SIG_KIND_COUNT];
+
+    Index() :
+        numCalls(0)
+    {}
+
+    void clear(void);
+
+    void addFrame(unsigned callNo, const File::Offset &offset);
+
+    void addSig(SigKind kind, unsigned id, const File::Offset &offset);
+
+    bool findSig(SigKind kind, unsigned id, File::Offset &offset) const;
+
+    void serialize(std::string &data) const;
+
+    bool parse(const std::string &data);
+};
+
+
+} /* namespace trace */
+
+#endif /* _TRACE_INDEX_HPP_ */
@@ -50,6 +50,20 @@ bool Loader::open(const char *filename)
         return false;
     }
 
+    const Index *index = m_parser.getIndex();
+    if (index && m_frameMarker == FrameMarker_SwapBuffers) {
+        // The index already tells where each frame starts
+        for (unsigned i = 0; i + 1 < index->frames.size(); ++i) {
+            FrameBookmark frameBookmark;
+            frameBookmark.start.offset = index->frames[i].offset;
+            frameBookmark.start.next_call_no = index->frames[i].callNo;
+            frameBookmark.numberOfCalls =
+                index->frames[i + 1].callNo - index->frames[i].callNo;
+            m_frameBookmarks[i] = frameBookmark;
+        }
+        return true;
+    }
+
     trace::Call *call;
     ParseBookmark startBookmark;
     unsigned numOfFrames = 0;
@@ -115,22 +129,20 @@ std::vector<trace::Call *> Loader::frame(unsigned idx)
     unsigned numOfCalls = numberOfCallsInFrame(idx);
     if (numOfCalls) {
         const FrameBookmark &frameBookmark = m_frameBookmarks[idx];
-        std::vector<trace::Call*> calls(numOfCalls);
+        std::vector<trace::Call*> calls;
+        calls.reserve(numOfCalls);
         m_parser.setBookmark(frameBookmark.start);
 
         trace::Call *call;
-        unsigned parsedCalls = 0;
         while ((call = m_parser.parse_call())) {
 
-            calls[parsedCalls] = call;
-            ++parsedCalls;
+            calls.push_back(call);
 
             if (isCallAFrameMarker(call)) {
                 break;
             }
 
         }
-        assert(parsedCalls == numOfCalls);
         return calls;
     }
     return std::vector<trace::Call*>();
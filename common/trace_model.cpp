@@ -24,12 +24,88 @@
  **************************************************************************/
 
 
+#include <new>
+#include <stdint.h>
+#include <string.h>
+
 #include "trace_model.hpp"
 
 
 namespace trace {
 
 
+void Arena::clear(void) {
+    while (m_blocks) {
+        Block *next = m_blocks->next;
+        delete [] reinterpret_cast<char *>(m_blocks);
+        m_blocks = next;
+    }
+    m_ptr = m_inline.bytes;
+    m_end = m_inline.bytes + INLINE_SIZE;
+}
+
+
+void *Arena::allocBlock(size_t size) {
+    const size_t headerSize = (sizeof(Block) + ALIGNMENT - 1) & ~size_t(ALIGNMENT - 1);
+
+    if (size > BLOCK_SIZE / 2) {
+        // Give large allocations a block of their own, so that the space left
+        // in the current block is not wasted.
+        Block *block = reinterpret_cast<Block *>(new char[headerSize + size]);
+        block->next = m_blocks;
+        m_blocks = block;
+        return reinterpret_cast<char *>(block) + headerSize;
+    }
+
+    Block *block = reinterpret_cast<Block *>(new char[headerSize + BLOCK_SIZE]);
+    block->next = m_blocks;
+    m_blocks = block;
+    m_ptr = reinterpret_cast<char *>(block) + headerSize;
+    m_end = m_ptr + BLOCK_SIZE;
+
+    void *ptr = m_ptr;
+    m_ptr += size;
+    return ptr;
+}
+
+
+/*
+ * Every value is preceded by a word which tells whether it lives in an arena,
+ * so that deleting values works the same regardless of where they came from.
+ */
+enum {
+    VALUE_HEAP = 0,
+    VALUE_ARENA = 1
+};
+
+static const size_t valueHeaderSize = Arena::ALIGNMENT;
+
+void *Value::operator new(size_t size) {
+    char *ptr = static_cast<char *>(::operator new(valueHeaderSize + size));
+    *reinterpret_cast<unsigned *>(ptr) = VALUE_HEAP;
+    return ptr + valueHeaderSize;
+}
+
+void *Value::operator new(size_t size, Arena &arena) {
+    char *ptr = static_cast<char *>(arena.alloc(valueHeaderSize + size));
+    *reinterpret_cast<unsigned *>(ptr) = VALUE_ARENA;
+    return ptr + valueHeaderSize;
+}
+
+void Value::operator delete(void *ptr) {
+    if (ptr) {
+        char *header = static_cast<char *>(ptr) - valueHeaderSize;
+        if (*reinterpret_cast<unsigned *>(header) == VALUE_HEAP) {
+            ::operator delete(header);
+        }
+    }
+}
+
+void Value::operator delete(void *ptr, Arena &arena) {
+    // only invoked if a constructor throws; the arena owns the memory
+}
+
+
 Call::~Call() {
     for (unsigned i = 0; i < args.size(); ++i) {
         delete args[i].value;
@@ -42,7 +118,9 @@ Call::~Call() {
 
 
 String::~String() {
-    delete [] value;
+    if (owned) {
+        delete [] value;
+    }
 }
 
 
@@ -67,11 +145,22 @@ Blob::~Blob() {
     // effectively means we have to leak them.  A better solution would be to
     // keep a list of bound pointers, and defer the destruction to when the
     // trace in question has been fully processed.
-    if (!bound) {
+    if (shared) {
+        shared->release();
+    } else if (!bound) {
         delete [] buf;
     }
 }
 
+// Replace the reference to the shared buffer with an owned copy
+void Blob::unshare(void) const {
+    char *copy = new char[size];
+    memcpy(copy, buf, size);
+    shared->release();
+    shared = NULL;
+    buf = copy;
+}
+
 StackFrame::~StackFrame() {
     if (module != NULL) {
         delete [] module;
@@ -147,13 +236,30 @@ double Repr   ::toDouble(void) const { return machineValue->toDouble(); }
 // pointer cast
 void * Value  ::toPointer(void) const { assert(0); return NULL; }
 void * Null   ::toPointer(void) const { return NULL; }
-void * Blob   ::toPointer(void) const { return buf; }
+void * Blob   ::toPointer(void) const {
+    // The caller may cast the data to pointers to structs or arrays
+    if (shared && ((uintptr_t)buf & (alignment - 1)) != 0) {
+        unshare();
+    }
+    return buf;
+}
 void * Pointer::toPointer(void) const { return (void *)value; }
 void * Repr   ::toPointer(void) const { return machineValue->toPointer(); }
 
 void * Value  ::toPointer(bool bind) { assert(0); return NULL; }
 void * Null   ::toPointer(bool bind) { return NULL; }
-void * Blob   ::toPointer(bool bind) { if (bind) bound = true; return buf; }
+void * Blob   ::toPointer(bool bind) {
+    if (bind) {
+        // Bound blobs outlive the call, so take a copy rather than keep the
+        // whole shared buffer alive
+        if (shared) {
+            unshare();
+        }
+        bound = true;
+        return buf;
+    }
+    return toPointer();
+}
 void * Pointer::toPointer(bool bind) { return (void *)value; }
 void * Repr   ::toPointer(bool bind) { return machineValue->toPointer(bind); }
 
@@ -38,6 +38,9 @@
 #include <vector>
 #include <ostream>
 
+#include "trace_arena.hpp"
+#include "trace_buffer.hpp"
+
 
 namespace trace {
 
@@ -95,12 +98,24 @@ class Visitor;
 class Null;
 class Struct;
 class Array;
+class Blob;
 
 
 class Value
 {
 public:
     virtual ~Value() {}
+
+    /*
+     * Values may be allocated either on the heap, or in an arena with
+     * `new (arena) T(...)`.  Deleting a value allocated in an arena runs its
+     * destructor but leaves the memory to be released with the arena.
+     */
+    static void *operator new(size_t size);
+    static void *operator new(size_t size, Arena &arena);
+    static void operator delete(void *ptr);
+    static void operator delete(void *ptr, Arena &arena);
+
     virtual void visit(Visitor &visitor) = 0;
 
     virtual bool toBool(void) const = 0;
@@ -123,6 +138,9 @@ public:
     virtual const Struct *toStruct(void) const { return NULL; }
     virtual Struct *toStruct(void) { return NULL; }
 
+    virtual const Blob *toBlob(void) const { return NULL; }
+    virtual Blob *toBlob(void) { return NULL; }
+
     const Value & operator[](size_t index) const;
 };
 
@@ -229,7 +247,10 @@ public:
 class String : public Value
 {
 public:
-    String(const char * _value) : value(_value) {}
+    String(const char * _value, bool _owned = true) :
+        value(_value),
+        owned(_owned)
+    {}
     ~String();
 
     bool toBool(void) const;
@@ -237,6 +258,9 @@ public:
     void visit(Visitor &visitor);
 
     const char * value;
+
+    /** Whether value was allocated with new [] and must be deleted */
+    bool owned;
 };
 
 
@@ -318,18 +342,55 @@ public:
         size = _size;
         buf = new char[_size];
         bound = false;
+        shared = NULL;
+    }
+
+    /**
+     * Refer to the data at the given offset of a shared buffer, instead of
+     * owning a copy.
+     */
+    Blob(size_t _size, SharedBuffer *_shared, size_t offset) {
+        assert(offset + _size <= _shared->capacity);
+        size = _size;
+        buf = _shared->data + offset;
+        bound = false;
+        shared = _shared;
+        shared->ref();
     }
 
     ~Blob();
 
+    /**
+     * Alignment that blob data which is cast to pointers to structs or
+     * arrays must have.  Shared blobs start wherever the payload happens to
+     * be in the chunk, so they may be less aligned than this.
+     */
+    static const size_t alignment = 16;
+
     bool toBool(void) const;
+
+    /**
+     * Data suitably aligned for any type, copying it out of the shared
+     * buffer if necessary.  Consumers that only read the data byte-wise
+     * (such as memcpy) can use buf directly instead.
+     */
     void *toPointer(void) const;
     void *toPointer(bool bind);
+
+    const Blob *toBlob(void) const { return this; }
+    Blob *toBlob(void) { return this; }
+
     void visit(Visitor &visitor);
 
     size_t size;
-    char *buf;
+    mutable char *buf;
     bool bound;
+
+    /* Buffer which buf points into, if not owned */
+    mutable SharedBuffer *shared;
+
+private:
+    void unshare(void) const;
 };
 
 
@@ -543,13 +604,25 @@ public:
     CallFlags flags;
     Backtrace* backtrace;
 
+    /**
+     * When and for how long the real function ran while tracing, in
+     * nanoseconds since the trace was opened, or -1 if not recorded.
+     */
+    long long cpuStart;
+    long long cpuDuration;
+
+    /** Storage for the values of this call */
+    Arena arena;
+
     Call(const FunctionSig *_sig, const CallFlags &_flags, unsigned _thread_id) :
         thread_id(_thread_id), 
         sig(_sig), 
         args(_sig->num_args), 
         ret(0),
         flags(_flags),
-        backtrace(0) {
+        backtrace(0),
+        cpuStart(-1),
+        cpuDuration(-1) {
     }
 
     ~Call();
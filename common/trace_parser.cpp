@@ -29,14 +29,23 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <algorithm>
+
 #include "trace_file.hpp"
 #include "trace_dump.hpp"
 #include "trace_parser.hpp"
+#include "trace_index.hpp"
 
 
 #define TRACE_VERBOSE 0
 
 
+/*
+ * Maximum number of bytes in the encoding of a 64bit unsigned integer.
+ */
+static const size_t MAX_UINT_LENGTH = (64 + 6) / 7;
+
+
 namespace trace {
 
 
@@ -45,6 +54,8 @@ Parser::Parser() {
     next_call_no = 0;
     version = 0;
     api = API_UNKNOWN;
+    hasIndex = false;
+    arena = NULL;
 
     glGetErrorSig = NULL;
 }
@@ -63,7 +74,7 @@ bool Parser::open(const char *filename) {
     }
 
     version = read_uint();
-    if (version > TRACE_VERSION) {
+    if (version > TRACE_VERSION_MAX) {
         std::cerr << "error: unsupported trace format version " << version << "\n";
         delete file;
         file = NULL;
@@ -71,6 +82,8 @@ bool Parser::open(const char *filename) {
     }
     api = API_UNKNOWN;
 
+    hasIndex = file->readIndex(index);
+
     return true;
 }
 
@@ -154,10 +167,63 @@ void Parser::close(void) {
     }
     bitmasks.clear();
 
+    index.clear();
+    hasIndex = false;
+
     next_call_no = 0;
 }
 
 
+/**
+ * When a signature is seen for the first time after seeking straight into
+ * the middle of the trace, its definition lies somewhere behind the current
+ * position.  Use the index to go back and parse it there.
+ *
+ * Returns whether the caller must go back to resumeOffset after parsing the
+ * definition.
+ */
+bool Parser::seek_sig_definition(SigKind kind, size_t id, File::Offset &resumeOffset) {
+    if (!hasIndex) {
+        return false;
+    }
+
+    File::Offset definitionOffset;
+    if (!index.findSig(kind, id, definitionOffset)) {
+        return false;
+    }
+
+    resumeOffset = file->currentOffset();
+    if (!(definitionOffset < resumeOffset)) {
+        // the definition is right here
+        return false;
+    }
+
+    file->setCurrentOffset(definitionOffset);
+    return true;
+}
+
+
+template <typename Map>
+static void
+indexSigs(Index &index, SigKind kind, const Map &map)
+{
+    for (unsigned id = 0; id < map.size(); ++id) {
+        if (map[id]) {
+            index.addSig(kind, id, map[id]->definitionOffset);
+        }
+    }
+}
+
+
+void Parser::getSigIndex(Index &sigIndex) const {
+    indexSigs(sigIndex, SIG_FUNCTION, functions);
+    indexSigs(sigIndex, SIG_STRUCT, structs);
+    indexSigs(sigIndex, SIG_ENUM, enums);
+    indexSigs(sigIndex, SIG_BITMASK, bitmasks);
+    indexSigs(sigIndex, SIG_FRAME, frames);
+}
+
+
 void Parser::getBookmark(ParseBookmark &bookmark) {
     bookmark.offset = file->currentOffset();
     bookmark.next_call_no = next_call_no;
@@ -232,9 +298,13 @@ Parser::parse_function_sig(void) {
     FunctionSigState *sig = lookup(functions, id);
 
     if (!sig) {
+        File::Offset resumeOffset;
+        bool resume = seek_sig_definition(SIG_FUNCTION, id, resumeOffset);
+
         /* parse the signature */
         sig = new FunctionSigState;
         sig->id = id;
+        sig->definitionOffset = file->currentOffset();
         sig->name = read_string();
         sig->num_args = read_uint();
         const char **arg_names = new const char *[sig->num_args];
@@ -281,6 +351,9 @@ Parser::parse_function_sig(void) {
             glGetErrorSig = sig;
         }
 
+        if (resume) {
+            file->setCurrentOffset(resumeOffset);
+        }
     } else if (file->currentOffset() < sig->fileOffset) {
         /* skip over the signature */
         skip_string(); /* name */
@@ -301,9 +374,13 @@ StructSig *Parser::parse_struct_sig() {
     StructSigState *sig = lookup(structs, id);
 
     if (!sig) {
+        File::Offset resumeOffset;
+        bool resume = seek_sig_definition(SIG_STRUCT, id, resumeOffset);
+
         /* parse the signature */
         sig = new StructSigState;
         sig->id = id;
+        sig->definitionOffset = file->currentOffset();
         sig->name = read_string();
         sig->num_members = read_uint();
         const char **member_names = new const char *[sig->num_members];
@@ -313,6 +390,10 @@ StructSig *Parser::parse_struct_sig() {
         sig->member_names = member_names;
         sig->fileOffset = file->currentOffset();
         structs[id] = sig;
+
+        if (resume) {
+            file->setCurrentOffset(resumeOffset);
+        }
     } else if (file->currentOffset() < sig->fileOffset) {
         /* skip over the signature */
         skip_string(); /* name */
@@ -340,8 +421,12 @@ EnumSig *Parser::parse_old_enum_sig() {
 
     if (!sig) {
         /* parse the signature */
+        File::Offset resumeOffset;
+        bool resume = seek_sig_definition(SIG_ENUM, id, resumeOffset);
+
         sig = new EnumSigState;
         sig->id = id;
+        sig->definitionOffset = file->currentOffset();
         sig->num_values = 1;
         EnumValue *values = new EnumValue[sig->num_values];
         values->name = read_string();
@@ -349,6 +434,10 @@ EnumSig *Parser::parse_old_enum_sig() {
         sig->values = values;
         sig->fileOffset = file->currentOffset();
         enums[id] = sig;
+
+        if (resume) {
+            file->setCurrentOffset(resumeOffset);
+        }
     } else if (file->currentOffset() < sig->fileOffset) {
         /* skip over the signature */
         skip_string(); /*name*/
@@ -367,8 +456,12 @@ EnumSig *Parser::parse_enum_sig() {
 
     if (!sig) {
         /* parse the signature */
+        File::Offset resumeOffset;
+        bool resume = seek_sig_definition(SIG_ENUM, id, resumeOffset);
+
         sig = new EnumSigState;
         sig->id = id;
+        sig->definitionOffset = file->currentOffset();
         sig->num_values = read_uint();
         EnumValue *values = new EnumValue[sig->num_values];
         for (EnumValue *it = values; it != values + sig->num_values; ++it) {
@@ -378,6 +471,10 @@ EnumSig *Parser::parse_enum_sig() {
         sig->values = values;
         sig->fileOffset = file->currentOffset();
         enums[id] = sig;
+
+        if (resume) {
+            file->setCurrentOffset(resumeOffset);
+        }
     } else if (file->currentOffset() < sig->fileOffset) {
         /* skip over the signature */
         int num_values = read_uint();
@@ -399,8 +496,12 @@ BitmaskSig *Parser::parse_bitmask_sig() {
 
     if (!sig) {
         /* parse the signature */
+        File::Offset resumeOffset;
+        bool resume = seek_sig_definition(SIG_BITMASK, id, resumeOffset);
+
         sig = new BitmaskSigState;
         sig->id = id;
+        sig->definitionOffset = file->currentOffset();
         sig->num_flags = read_uint();
         BitmaskFlag *flags = new BitmaskFlag[sig->num_flags];
         for (BitmaskFlag *it = flags; it != flags + sig->num_flags; ++it) {
@@ -413,6 +514,10 @@ BitmaskSig *Parser::parse_bitmask_sig() {
         sig->flags = flags;
         sig->fileOffset = file->currentOffset();
         bitmasks[id] = sig;
+
+        if (resume) {
+            file->setCurrentOffset(resumeOffset);
+        }
     } else if (file->currentOffset() < sig->fileOffset) {
         /* skip over the signature */
         int num_flags = read_uint();
@@ -482,6 +587,7 @@ Call *Parser::parse_leave(Mode mode) {
 
 
 bool Parser::parse_call_details(Call *call, Mode mode) {
+    arena = &call->arena;
     do {
         int c = read_byte();
         switch (c) {
@@ -508,6 +614,13 @@ bool Parser::parse_call_details(Call *call, Mode mode) {
 #endif
             parse_call_backtrace(call, mode);
             break;
+        case trace::CALL_TIME:
+#if TRACE_VERBOSE
+            std::cerr << "\tCALL_TIME\n";
+#endif
+            call->cpuStart = read_uint();
+            call->cpuDuration = read_uint();
+            break;
         default:
             std::cerr << "error: ("<<call->name()<< ") unknown call detail "
                       << c << "\n";
@@ -534,7 +647,11 @@ StackFrame * Parser::parse_backtrace_frame(Mode mode) {
     StackFrameState *frame = lookup(frames, id);
 
     if (!frame) {
+        File::Offset resumeOffset;
+        bool resume = seek_sig_definition(SIG_FRAME, id, resumeOffset);
+
         frame = new StackFrameState;
+        frame->definitionOffset = file->currentOffset();
         int c = read_byte();
         while (c != trace::BACKTRACE_END &&
                c != -1) {
@@ -564,6 +681,10 @@ StackFrame * Parser::parse_backtrace_frame(Mode mode) {
 
         frame->fileOffset = file->currentOffset();
         frames[id] = frame;
+
+        if (resume) {
+            file->setCurrentOffset(resumeOffset);
+        }
     } else if (file->currentOffset() < frame->fileOffset) {
         int c = read_byte();
         while (c != trace::BACKTRACE_END &&
@@ -629,13 +750,13 @@ Value *Parser::parse_value(void) {
     c = read_byte();
     switch (c) {
     case trace::TYPE_NULL:
-        value = new Null;
+        value = new (*arena) Null;
         break;
     case trace::TYPE_FALSE:
-        value = new Bool(false);
+        value = new (*arena) Bool(false);
         break;
     case trace::TYPE_TRUE:
-        value = new Bool(true);
+        value = new (*arena) Bool(true);
         break;
     case trace::TYPE_SINT:
         value = parse_sint();
@@ -744,7 +865,7 @@ void Parser::scan_value(void) {
 
 
 Value *Parser::parse_sint() {
-    return new SInt(-(signed long long)read_uint());
+    return new (*arena) SInt(-(signed long long)read_uint());
 }
 
 
@@ -754,7 +875,7 @@ void Parser::scan_sint() {
 
 
 Value *Parser::parse_uint() {
-    return new UInt(read_uint());
+    return new (*arena) UInt(read_uint());
 }
 
 
@@ -766,7 +887,7 @@ void Parser::scan_uint() {
 Value *Parser::parse_float() {
     float value;
     file->read(&value, sizeof value);
-    return new Float(value);
+    return new (*arena) Float(value);
 }
 
 
@@ -778,7 +899,7 @@ void Parser::scan_float() {
 Value *Parser::parse_double() {
     double value;
     file->read(&value, sizeof value);
-    return new Double(value);
+    return new (*arena) Double(value);
 }
 
 
@@ -788,7 +909,16 @@ void Parser::scan_double() {
 
 
 Value *Parser::parse_string() {
-    return new String(read_string());
+    size_t len = read_uint();
+    char *value = static_cast<char *>(arena->alloc(len + 1));
+    if (len) {
+        file->read(value, len);
+    }
+    value[len] = 0;
+#if TRACE_VERBOSE
+    std::cerr << "\tSTRING \"" << value << "\"\n";
+#endif
+    return new (*arena) String(value, false);
 }
 
 
@@ -808,7 +938,7 @@ Value *Parser::parse_enum() {
         assert(sig->num_values == 1);
         value = sig->values->value;
     }
-    return new Enum(sig, value);
+    return new (*arena) Enum(sig, value);
 }
 
 
@@ -827,7 +957,7 @@ Value *Parser::parse_bitmask() {
 
     unsigned long long value = read_uint();
 
-    return new Bitmask(sig, value);
+    return new (*arena) Bitmask(sig, value);
 }
 
 
@@ -839,7 +969,7 @@ void Parser::scan_bitmask() {
 
 Value *Parser::parse_array(void) {
     size_t len = read_uint();
-    Array *array = new Array(len);
+    Array *array = new (*arena) Array(len);
     for (size_t i = 0; i < len; ++i) {
         array->values[i] = parse_value();
     }
@@ -857,9 +987,17 @@ void Parser::scan_array(void) {
 
 Value *Parser::parse_blob(void) {
     size_t size = read_uint();
-    Blob *blob = new Blob(size);
-    if (size) {
-        file->read(blob->buf, size);
+    Blob *blob;
+    SharedBuffer *buffer = file->readBuffer();
+    if (size && buffer && size <= file->available()) {
+        // Refer to the decompressed data in place
+        blob = new (*arena) Blob(size, buffer, file->readPointer() - buffer->data);
+        file->advance(size);
+    } else {
+        blob = new (*arena) Blob(size);
+        if (size) {
+            file->read(blob->buf, size);
+        }
     }
     return blob;
 }
@@ -875,7 +1013,7 @@ void Parser::scan_blob(void) {
 
 Value *Parser::parse_struct() {
     StructSig *sig = parse_struct_sig();
-    Struct *value = new Struct(sig);
+    Struct *value = new (*arena) Struct(sig);
 
     for (size_t i = 0; i < sig->num_members; ++i) {
         value->members[i] = parse_value();
@@ -896,7 +1034,7 @@ void Parser::scan_struct() {
 Value *Parser::parse_opaque() {
     unsigned long long addr;
     addr = read_uint();
-    return new Pointer(addr);
+    return new (*arena) Pointer(addr);
 }
 
 
@@ -908,7 +1046,7 @@ void Parser::scan_opaque() {
 Value *Parser::parse_repr() {
     Value *humanValue = parse_value();
     Value *machineValue = parse_value();
-    return new Repr(humanValue, machineValue);
+    return new (*arena) Repr(humanValue, machineValue);
 }
 
 
@@ -969,6 +1107,28 @@ unsigned long long Parser::read_uint(void) {
     unsigned long long value = 0;
     int c;
     unsigned shift = 0;
+
+    // Fast path: decode straight from the file's buffer, unless the value
+    // straddles the end of it.
+    size_t available = file->available();
+    if (available) {
+        const unsigned char *start = (const unsigned char *)file->readPointer();
+        const unsigned char *end = start + std::min(available, MAX_UINT_LENGTH);
+        for (const unsigned char *p = start; p < end; shift += 7) {
+            c = *p++;
+            value |= (unsigned long long)(c & 0x7f) << shift;
+            if (!(c & 0x80)) {
+                file->advance(p - start);
+#if TRACE_VERBOSE
+                std::cerr << "\tUINT " << value << "\n";
+#endif
+                return value;
+            }
+        }
+        value = 0;
+        shift = 0;
+    }
+
     do {
         c = file->getc();
         if (c == -1) {
@@ -986,6 +1146,19 @@ unsigned long long Parser::read_uint(void) {
 
 void Parser::skip_uint(void) {
     int c;
+
+    size_t available = file->available();
+    if (available) {
+        const char *start = file->readPointer();
+        const char *end = start + std::min(available, MAX_UINT_LENGTH);
+        for (const char *p = start; p < end; ) {
+            if (!(*p++ & 0x80)) {
+                file->advance(p - start);
+                return;
+            }
+        }
+    }
+
     do {
         c = file->getc();
         if (c == -1) {
@@ -32,6 +32,7 @@
 
 #include "trace_file.hpp"
 #include "trace_format.hpp"
+#include "trace_index.hpp"
 #include "trace_model.hpp"
 #include "trace_api.hpp"
 
@@ -72,6 +73,10 @@ protected:
         // reparsing to determine whether the signature definition is to be
         // expected next or not.
         File::Offset fileOffset;
+
+        // Offset in the file of where the signature definition starts, right
+        // after its ID.
+        File::Offset definitionOffset;
     };
 
     typedef SigState<FunctionSigFlags> FunctionSigState;
@@ -96,6 +101,12 @@ protected:
 
     unsigned next_call_no;
 
+    Index index;
+    bool hasIndex;
+
+    // Arena of the call whose details are being parsed
+    Arena *arena;
+
 public:
     unsigned long long version;
     API api;
@@ -130,6 +141,22 @@ public:
         return parse_call(SCAN);
     }
 
+    /**
+     * Index stored in the trace file, if any.
+     */
+    const Index *getIndex() const {
+        return hasIndex ? &index : NULL;
+    }
+
+    /**
+     * Add the definition offsets of all signatures seen so far to the given
+     * index.
+     */
+    void getSigIndex(Index &sigIndex) const;
+
+    static CallFlags
+    lookupCallFlags(const char *name);
+
 protected:
     Call *parse_call(Mode mode);
 
@@ -138,9 +165,8 @@ protected:
     EnumSig *parse_old_enum_sig();
     EnumSig *parse_enum_sig();
     BitmaskSig *parse_bitmask_sig();
-    
-    static CallFlags
-    lookupCallFlags(const char *name);
+
+    bool seek_sig_definition(SigKind kind, size_t id, File::Offset &resumeOffset);
 
     Call *parse_Call(Mode mode);
 
@@ -25,12 +25,86 @@
  **************************************************************************/
 
 #include "trace_profiler.hpp"
+#include "trace_model.hpp"
 #include "os_time.hpp"
+#include "os_binary.hpp"
 #include <iostream>
 #include <string.h>
 #include <sstream>
 
 namespace trace {
+
+/*
+ * Binary profile format.
+ *
+ * After the header line, the stream is a sequence of records, each starting
+ * with one of the tags below.  Integers are LEB128 varints, with signed ones
+ * zigzag encoded.  Call numbers and start times are encoded as deltas from the
+ * previous call record, so most fit in a byte or two.
+ *
+ *   name:  id, length, chars
+ *   call:  no, program, pixels, gpuStart, gpuDuration, cpuStart, cpuDuration,
+ *          vsizeStart, vsizeDuration, rssStart, rssDuration, name id
+ *   frame: (nothing)
+ *   end:   (nothing)
+ */
+
+static const char binaryHeader[] = "#apitrace-profile 1\n";
+
+enum {
+    RECORD_NAME = 'N',
+    RECORD_CALL = 'C',
+    RECORD_FRAME_END = 'F',
+    RECORD_END = 'E',
+};
+
+#define PROFILE_BUFFER_SIZE (64*1024)
+
+
+static inline void
+writeUInt(std::string &buffer, uint64_t value)
+{
+    while (value >= 0x80) {
+        buffer += (char)(value | 0x80);
+        value >>= 7;
+    }
+    buffer += (char)value;
+}
+
+static inline void
+writeSInt(std::string &buffer, int64_t value)
+{
+    writeUInt(buffer, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+static inline bool
+readUInt(const unsigned char *&p, const unsigned char *end, uint64_t &value)
+{
+    value = 0;
+    unsigned shift = 0;
+    while (p < end && shift < 64) {
+        unsigned char c = *p++;
+        value |= (uint64_t)(c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            return true;
+        }
+        shift += 7;
+    }
+    return false;
+}
+
+static inline bool
+readSInt(const unsigned char *&p, const unsigned char *end, int64_t &value)
+{
+    uint64_t zigzag;
+    if (!readUInt(p, end, zigzag)) {
+        return false;
+    }
+    value = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+    return true;
+}
+
+
 Profiler::Profiler()
     : baseGpuTime(0),
       baseCpuTime(0),
@@ -40,7 +114,13 @@ Profiler::Profiler()
       cpuTimes(false),
       gpuTimes(true),
       pixelsDrawn(false),
-      memoryUsage(false)
+      memoryUsage(false),
+      binary(false),
+      lastNo(0),
+      lastGpuStart(0),
+      lastCpuStart(0),
+      lastVsizeStart(0),
+      lastRssStart(0)
 {
 }
 
@@ -48,16 +128,45 @@ Profiler::~Profiler()
 {
 }
 
-void Profiler::setup(bool cpuTimes_, bool gpuTimes_, bool pixelsDrawn_, bool memoryUsage_)
+void Profiler::setup(bool cpuTimes_, bool gpuTimes_, bool pixelsDrawn_, bool memoryUsage_, bool binary_)
 {
     cpuTimes = cpuTimes_;
     gpuTimes = gpuTimes_;
     pixelsDrawn = pixelsDrawn_;
     memoryUsage = memoryUsage_;
+    binary = binary_;
+
+    if (binary) {
+        std::cout.flush();
+        os::setBinaryMode(stdout);
+        std::cout << binaryHeader;
+        return;
+    }
 
     std::cout << "# call no gpu_start gpu_dura cpu_start cpu_dura vsize_start vsize_dura rss_start rss_dura pixels program name" << std::endl;
 }
 
+void Profiler::flush()
+{
+    std::cout.write(buffer.data(), buffer.size());
+    std::cout.flush();
+    buffer.clear();
+}
+
+void Profiler::finish()
+{
+    if (binary) {
+        buffer += (char)RECORD_END;
+        flush();
+    }
+}
+
+bool Profiler::isBinary(const char* data, size_t size)
+{
+    size_t length = sizeof binaryHeader - 1;
+    return size >= length && memcmp(data, binaryHeader, length) == 0;
+}
+
 int64_t Profiler::getBaseCpuTime()
 {
     return baseCpuTime;
@@ -141,6 +250,48 @@ void Profiler::addCall(unsigned no,
         rssDuration = 0;
     }
 
+    if (binary) {
+        std::map<const char *, unsigned>::iterator it = names.find(name);
+        unsigned nameId;
+        if (it == names.end()) {
+            nameId = unsigned(names.size());
+            names[name] = nameId;
+
+            size_t length = strlen(name);
+            buffer += (char)RECORD_NAME;
+            writeUInt(buffer, nameId);
+            writeUInt(buffer, length);
+            buffer.append(name, length);
+        } else {
+            nameId = it->second;
+        }
+
+        buffer += (char)RECORD_CALL;
+        writeSInt(buffer, (int64_t)no - lastNo);
+        writeUInt(buffer, program);
+        writeSInt(buffer, pixels);
+        writeSInt(buffer, gpuStart - lastGpuStart);
+        writeSInt(buffer, gpuDuration);
+        writeSInt(buffer, cpuStart - lastCpuStart);
+        writeSInt(buffer, cpuDuration);
+        writeSInt(buffer, vsizeStart - lastVsizeStart);
+        writeSInt(buffer, vsizeDuration);
+        writeSInt(buffer, rssStart - lastRssStart);
+        writeSInt(buffer, rssDuration);
+        writeUInt(buffer, nameId);
+
+        lastNo = no;
+        lastGpuStart = gpuStart;
+        lastCpuStart = cpuStart;
+        lastVsizeStart = vsizeStart;
+        lastRssStart = rssStart;
+
+        if (buffer.size() >= PROFILE_BUFFER_SIZE) {
+            flush();
+        }
+        return;
+    }
+
     std::cout << "call"
               << " " << no
               << " " << gpuStart
@@ -159,26 +310,126 @@ void Profiler::addCall(unsigned no,
 
 void Profiler::addFrameEnd()
 {
+    if (binary) {
+        buffer += (char)RECORD_FRAME_END;
+        if (buffer.size() >= PROFILE_BUFFER_SIZE) {
+            flush();
+        }
+        return;
+    }
+
     std::cout << "frame_end" << std::endl;
 }
 
+ProfileBuilder::ProfileBuilder(Profile *_profile)
+    : profile(_profile),
+      lastGpuTime(0),
+      lastCpuTime(0),
+      lastVsizeUsage(0),
+      lastRssUsage(0)
+{
+}
+
+void ProfileBuilder::addCall(const Profile::Call &call)
+{
+    if (lastGpuTime < call.gpuStart + call.gpuDuration) {
+        lastGpuTime = call.gpuStart + call.gpuDuration;
+    }
+
+    if (lastCpuTime < call.cpuStart + call.cpuDuration) {
+        lastCpuTime = call.cpuStart + call.cpuDuration;
+    }
+
+    if (lastVsizeUsage < call.vsizeStart + call.vsizeDuration) {
+        lastVsizeUsage = call.vsizeStart + call.vsizeDuration;
+    }
+
+    if (lastRssUsage < call.rssStart + call.rssDuration) {
+        lastRssUsage = call.rssStart + call.rssDuration;
+    }
+
+    profile->calls.push_back(call);
+
+    if (call.pixels >= 0) {
+        if (profile->programs.size() <= call.program) {
+            profile->programs.resize(call.program + 1);
+        }
+
+        Profile::Program& program = profile->programs[call.program];
+        program.cpuTotal += call.cpuDuration;
+        program.gpuTotal += call.gpuDuration;
+        program.pixelTotal += call.pixels;
+        program.vsizeTotal += call.vsizeDuration;
+        program.rssTotal += call.rssDuration;
+        program.calls.push_back((unsigned int)(profile->calls.size() - 1));
+    }
+}
+
+void ProfileBuilder::addFrameEnd()
+{
+    Profile::Frame frame;
+    frame.no = unsigned(profile->frames.size());
+
+    if (frame.no == 0) {
+        frame.gpuStart = 0;
+        frame.cpuStart = 0;
+        frame.vsizeStart = 0;
+        frame.rssStart = 0;
+        frame.calls.begin = 0;
+    } else {
+        frame.gpuStart = profile->frames.back().gpuStart + profile->frames.back().gpuDuration;
+        frame.cpuStart = profile->frames.back().cpuStart + profile->frames.back().cpuDuration;
+        frame.vsizeStart = profile->frames.back().vsizeStart + profile->frames.back().vsizeDuration;
+        frame.rssStart = profile->frames.back().rssStart + profile->frames.back().rssDuration;
+        frame.calls.begin = profile->frames.back().calls.end + 1;
+    }
+
+    frame.gpuDuration = lastGpuTime - frame.gpuStart;
+    frame.cpuDuration = lastCpuTime - frame.cpuStart;
+    frame.vsizeDuration = lastVsizeUsage - frame.vsizeStart;
+    frame.rssDuration = lastRssUsage - frame.rssStart;
+    frame.calls.end = (unsigned int)(profile->calls.size() - 1);
+
+    profile->frames.push_back(frame);
+}
+
+void ProfileBuilder::addTraceCall(const trace::Call &call)
+{
+    if (call.cpuDuration >= 0) {
+        Profile::Call profileCall;
+        profileCall.no = call.no;
+        profileCall.program = 0;
+        profileCall.gpuStart = 0;
+        profileCall.gpuDuration = 0;
+        profileCall.cpuStart = call.cpuStart;
+        profileCall.cpuDuration = call.cpuDuration;
+        profileCall.vsizeStart = 0;
+        profileCall.vsizeDuration = 0;
+        profileCall.rssStart = 0;
+        profileCall.rssDuration = 0;
+        /* Only draw calls count towards program totals */
+        profileCall.pixels = (call.flags & CALL_FLAG_RENDER) ? 0 : -1;
+        profileCall.name = call.name();
+
+        addCall(profileCall);
+    }
+
+    if (call.flags & CALL_FLAG_END_FRAME) {
+        addFrameEnd();
+    }
+}
+
 void Profiler::parseLine(const char* in, Profile* profile)
 {
     std::stringstream line(in, std::ios_base::in);
     std::string type;
-    static int64_t lastGpuTime;
-    static int64_t lastCpuTime;
-    static int64_t lastVsizeUsage;
-    static int64_t lastRssUsage;
+    static ProfileBuilder builder(NULL);
 
     if (in[0] == '#' || strlen(in) < 4)
         return;
 
     if (profile->programs.size() == 0 && profile->calls.size() == 0 && profile->frames.size() == 0) {
-        lastGpuTime = 0;
-        lastCpuTime = 0;
-        lastVsizeUsage = 0;
-        lastRssUsage = 0;
+        builder = ProfileBuilder(profile);
     }
 
     line >> type;
@@ -199,62 +450,122 @@ void Profiler::parseLine(const char* in, Profile* profile)
              >> call.program
              >> call.name;
 
-        if (lastGpuTime < call.gpuStart + call.gpuDuration) {
-            lastGpuTime = call.gpuStart + call.gpuDuration;
-        }
+        builder.addCall(call);
+    } else if (type.compare("frame_end") == 0) {
+        builder.addFrameEnd();
+    }
+}
 
-        if (lastCpuTime < call.cpuStart + call.cpuDuration) {
-            lastCpuTime = call.cpuStart + call.cpuDuration;
-        }
+ProfileReader::ProfileReader(Profile *profile)
+    : builder(profile),
+      headerRead(false),
+      finished(false),
+      lastNo(0),
+      lastGpuStart(0),
+      lastCpuStart(0),
+      lastVsizeStart(0),
+      lastRssStart(0)
+{
+}
 
-        if (lastVsizeUsage < call.vsizeStart + call.vsizeDuration) {
-            lastVsizeUsage = call.vsizeStart + call.vsizeDuration;
+size_t ProfileReader::parse(const char *data, size_t size)
+{
+    const unsigned char *begin = (const unsigned char *)data;
+    const unsigned char *end = begin + size;
+    const unsigned char *p = begin;
+
+    if (!headerRead) {
+        size_t length = sizeof binaryHeader - 1;
+        if (size < length) {
+            return 0;
         }
-
-        if (lastRssUsage < call.rssStart + call.rssDuration) {
-            lastRssUsage = call.rssStart + call.rssDuration;
+        if (!Profiler::isBinary(data, size)) {
+            finished = true;
+            return 0;
         }
+        p += length;
+        headerRead = true;
+    }
 
-        profile->calls.push_back(call);
-
-        if (call.pixels >= 0) {
-            if (profile->programs.size() <= call.program) {
-                profile->programs.resize(call.program + 1);
+    while (!finished && p < end) {
+        /* Start of the record, to rewind to on incomplete records */
+        const unsigned char *record = p;
+
+        switch (*p++) {
+        case RECORD_NAME:
+            {
+                uint64_t id, length;
+                if (!readUInt(p, end, id) ||
+                    !readUInt(p, end, length) ||
+                    (uint64_t)(end - p) < length) {
+                    return record - begin;
+                }
+                if (names.size() <= id) {
+                    names.resize(id + 1);
+                }
+                names[id].assign((const char *)p, length);
+                p += length;
             }
-
-            Profile::Program& program = profile->programs[call.program];
-            program.cpuTotal += call.cpuDuration;
-            program.gpuTotal += call.gpuDuration;
-            program.pixelTotal += call.pixels;
-            program.vsizeTotal += call.vsizeDuration;
-            program.rssTotal += call.rssDuration;
-            program.calls.push_back((unsigned int)(profile->calls.size() - 1));
-        }
-    } else if (type.compare("frame_end") == 0) {
-        Profile::Frame frame;
-        frame.no = unsigned(profile->frames.size());
-
-        if (frame.no == 0) {
-            frame.gpuStart = 0;
-            frame.cpuStart = 0;
-            frame.vsizeStart = 0;
-            frame.rssStart = 0;
-            frame.calls.begin = 0;
-        } else {
-            frame.gpuStart = profile->frames.back().gpuStart + profile->frames.back().gpuDuration;
-            frame.cpuStart = profile->frames.back().cpuStart + profile->frames.back().cpuDuration;
-            frame.vsizeStart = profile->frames.back().vsizeStart + profile->frames.back().vsizeDuration;
-            frame.rssStart = profile->frames.back().rssStart + profile->frames.back().rssDuration;
-            frame.calls.begin = profile->frames.back().calls.end + 1;
+            break;
+        case RECORD_CALL:
+            {
+                int64_t no, pixels;
+                int64_t gpuStart, gpuDuration;
+                int64_t cpuStart, cpuDuration;
+                int64_t vsizeStart, vsizeDuration;
+                int64_t rssStart, rssDuration;
+                uint64_t program, nameId;
+                if (!readSInt(p, end, no) ||
+                    !readUInt(p, end, program) ||
+                    !readSInt(p, end, pixels) ||
+                    !readSInt(p, end, gpuStart) ||
+                    !readSInt(p, end, gpuDuration) ||
+                    !readSInt(p, end, cpuStart) ||
+                    !readSInt(p, end, cpuDuration) ||
+                    !readSInt(p, end, vsizeStart) ||
+                    !readSInt(p, end, vsizeDuration) ||
+                    !readSInt(p, end, rssStart) ||
+                    !readSInt(p, end, rssDuration) ||
+                    !readUInt(p, end, nameId)) {
+                    return record - begin;
+                }
+
+                lastNo += no;
+                lastGpuStart += gpuStart;
+                lastCpuStart += cpuStart;
+                lastVsizeStart += vsizeStart;
+                lastRssStart += rssStart;
+
+                Profile::Call call;
+                call.no = unsigned(lastNo);
+                call.program = unsigned(program);
+                call.gpuStart = lastGpuStart;
+                call.gpuDuration = gpuDuration;
+                call.cpuStart = lastCpuStart;
+                call.cpuDuration = cpuDuration;
+                call.vsizeStart = lastVsizeStart;
+                call.vsizeDuration = vsizeDuration;
+                call.rssStart = lastRssStart;
+                call.rssDuration = rssDuration;
+                call.pixels = pixels;
+                if (nameId < names.size()) {
+                    call.name = names[nameId];
+                }
+
+                builder.addCall(call);
+            }
+            break;
+        case RECORD_FRAME_END:
+            builder.addFrameEnd();
+            break;
+        case RECORD_END:
+        default:
+            finished = true;
+            break;
         }
-
-        frame.gpuDuration = lastGpuTime - frame.gpuStart;
-        frame.cpuDuration = lastCpuTime - frame.cpuStart;
-        frame.vsizeDuration = lastVsizeUsage - frame.vsizeStart;
-        frame.rssDuration = lastRssUsage - frame.rssStart;
-        frame.calls.end = (unsigned int)(profile->calls.size() - 1);
-
-        profile->frames.push_back(frame);
     }
+
+    return p - begin;
 }
+
 }
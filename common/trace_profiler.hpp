@@ -27,6 +27,7 @@
 #ifndef TRACE_PROFILER_H
 #define TRACE_PROFILER_H
 
+#include <map>
 #include <string>
 #include <vector>
 #include <stdint.h>
@@ -34,6 +35,8 @@
 namespace trace
 {
 
+class Call;
+
 struct Profile {
     struct Call {
         unsigned no;
@@ -95,13 +98,90 @@ struct Profile {
     std::vector<Program> programs;
 };
 
+/**
+ * Accumulates per frame and per program totals as calls are added.
+ */
+class ProfileBuilder
+{
+public:
+    ProfileBuilder(Profile *profile);
+
+    void addCall(const Profile::Call &call);
+
+    void addFrameEnd();
+
+    /**
+     * Add the cpu time recorded for a traced call, if any, ending the frame
+     * as needed.  This allows profiling the original application without
+     * replaying it.
+     */
+    void addTraceCall(const trace::Call &call);
+
+private:
+    Profile *profile;
+
+    int64_t lastGpuTime;
+    int64_t lastCpuTime;
+    int64_t lastVsizeUsage;
+    int64_t lastRssUsage;
+};
+
+/**
+ * Decodes the binary profile format written by Profiler into a Profile.
+ *
+ * Data can be fed in chunks of any size, as it arrives.
+ */
+class ProfileReader
+{
+public:
+    ProfileReader(Profile *profile);
+
+    /**
+     * Parse as many whole records as possible, returning the number of bytes
+     * consumed.  The remaining bytes should be passed again, followed by more
+     * data.
+     */
+    size_t parse(const char *data, size_t size);
+
+    /**
+     * Whether the end of the profile was reached, or an invalid record was
+     * found.
+     */
+    bool isFinished() const {
+        return finished;
+    }
+
+private:
+    ProfileBuilder builder;
+
+    bool headerRead;
+    bool finished;
+
+    std::vector<std::string> names;
+
+    int64_t lastNo;
+    int64_t lastGpuStart;
+    int64_t lastCpuStart;
+    int64_t lastVsizeStart;
+    int64_t lastRssStart;
+};
+
 class Profiler
 {
 public:
     Profiler();
     ~Profiler();
 
-    void setup(bool cpuTimes_, bool gpuTimes_, bool pixelsDrawn_, bool memoryUsage_);
+    /**
+     * The binary format is much faster to write and parse than the text one,
+     * and is meant to be read with ProfileReader.
+     */
+    void setup(bool cpuTimes_, bool gpuTimes_, bool pixelsDrawn_, bool memoryUsage_, bool binary_ = false);
+
+    /**
+     * Write out any buffered records, and mark the end of the profile.
+     */
+    void finish();
 
     void addCall(unsigned no,
                  const char* name,
@@ -128,6 +208,11 @@ public:
 
     static void parseLine(const char* line, Profile* profile);
 
+    /**
+     * Whether the data starts with the binary profile header.
+     */
+    static bool isBinary(const char* data, size_t size);
+
 private:
     int64_t baseGpuTime;
     int64_t baseCpuTime;
@@ -139,6 +224,18 @@ private:
     bool gpuTimes;
     bool pixelsDrawn;
     bool memoryUsage;
+
+    bool binary;
+    std::string buffer;
+    std::map<const char *, unsigned> names;
+
+    int64_t lastNo;
+    int64_t lastGpuStart;
+    int64_t lastCpuStart;
+    int64_t lastVsizeStart;
+    int64_t lastRssStart;
+
+    void flush();
 };
 }
 
@@ -35,12 +35,16 @@
 #include "trace_file.hpp"
 #include "trace_writer.hpp"
 #include "trace_format.hpp"
+#include "trace_parser.hpp"
 
 namespace trace {
 
 
 Writer::Writer() :
-    call_no(0)
+    call_no(0),
+    indexing(false),
+    callTimes(false),
+    leavingFrameEnd(false)
 {
     m_file = File::createSnappy();
     close();
@@ -55,11 +59,16 @@ Writer::~Writer()
 
 void
 Writer::close(void) {
+    if (indexing) {
+        index.numCalls = call_no;
+        m_file->writeIndex(index);
+        indexing = false;
+    }
     m_file->close();
 }
 
 bool
-Writer::open(const char *filename) {
+Writer::open(const char *filename, bool _callTimes) {
     close();
 
     if (!m_file->open(filename, File::Write)) {
@@ -73,38 +82,20 @@ Writer::open(const char *filename) {
     bitmasks.clear();
     frames.clear();
 
-    _writeUInt(TRACE_VERSION);
-
-    return true;
-}
-
-void inline
-Writer::_write(const void *sBuffer, size_t dwBytesToWrite) {
-    m_file->write(sBuffer, dwBytesToWrite);
-}
-
-void inline
-Writer::_writeByte(char c) {
-    _write(&c, 1);
-}
+    index.clear();
+    frameEndFunctions.clear();
+    pendingFrameEnds.clear();
+    leavingFrameEnd = false;
 
-void inline
-Writer::_writeUInt(unsigned long long value) {
-    char buf[2 * sizeof value];
-    unsigned len;
+    callTimes = _callTimes;
+    _writeUInt(callTimes ? TRACE_VERSION_CALL_TIME : TRACE_VERSION);
 
-    len = 0;
-    do {
-        assert(len < sizeof buf);
-        buf[len] = 0x80 | (value & 0x7f);
-        value >>= 7;
-        ++len;
-    } while (value);
-
-    assert(len);
-    buf[len - 1] &= 0x7f;
+    indexing = m_file->supportsOffsets();
+    if (indexing) {
+        index.addFrame(0, m_file->currentOffset());
+    }
 
-    _write(buf, len);
+    return true;
 }
 
 void inline
@@ -135,6 +126,16 @@ inline bool lookup(std::vector<bool> &map, size_t index) {
     }
 }
 
+/*
+ * Note down where a signature definition starts.  Must be called right after
+ * writing its ID.
+ */
+void Writer::indexSig(SigKind kind, unsigned id) {
+    if (indexing) {
+        index.addSig(kind, id, m_file->currentOffset());
+    }
+}
+
 void Writer::beginBacktrace(unsigned num_frames) {
     if (num_frames) {
         _writeByte(trace::CALL_BACKTRACE);
@@ -142,9 +143,21 @@ void Writer::beginBacktrace(unsigned num_frames) {
     }
 }
 
+/*
+ * Note down when the real function was called, and for how long, in
+ * nanoseconds since the trace was opened.  Belongs to the leave event.
+ */
+void Writer::writeCallTime(unsigned long long start, unsigned long long duration) {
+    assert(callTimes);
+    _writeByte(trace::CALL_TIME);
+    _writeUInt(start);
+    _writeUInt(duration);
+}
+
 void Writer::writeStackFrame(const RawStackFrame *frame) {
     _writeUInt(frame->id);
     if (!lookup(frames, frame->id)) {
+        indexSig(SIG_FRAME, frame->id);
         if (frame->module != NULL) {
             _writeByte(trace::BACKTRACE_MODULE);
             _writeString(frame->module);
@@ -175,12 +188,24 @@ unsigned Writer::beginEnter(const FunctionSig *sig, unsigned thread_id) {
     _writeUInt(thread_id);
     _writeUInt(sig->id);
     if (!lookup(functions, sig->id)) {
+        indexSig(SIG_FUNCTION, sig->id);
         _writeString(sig->name);
         _writeUInt(sig->num_args);
         for (unsigned i = 0; i < sig->num_args; ++i) {
             _writeString(sig->arg_names[i]);
         }
         functions[sig->id] = true;
+        if (indexing) {
+            lookup(frameEndFunctions, sig->id);
+            frameEndFunctions[sig->id] =
+                (Parser::lookupCallFlags(sig->name) & CALL_FLAG_END_FRAME) != 0;
+        }
+    }
+
+    if (indexing &&
+        sig->id < frameEndFunctions.size() &&
+        frameEndFunctions[sig->id]) {
+        pendingFrameEnds.push_back(call_no);
     }
 
     return call_no++;
@@ -193,10 +218,25 @@ void Writer::endEnter(void) {
 void Writer::beginLeave(unsigned call) {
     _writeByte(trace::EVENT_LEAVE);
     _writeUInt(call);
+
+    for (std::vector<unsigned>::iterator it = pendingFrameEnds.begin();
+         it != pendingFrameEnds.end(); ++it) {
+        if (*it == call) {
+            pendingFrameEnds.erase(it);
+            leavingFrameEnd = true;
+            break;
+        }
+    }
 }
 
 void Writer::endLeave(void) {
     _writeByte(trace::CALL_END);
+
+    if (leavingFrameEnd) {
+        // next frame starts here
+        index.addFrame(call_no, m_file->currentOffset());
+        leavingFrameEnd = false;
+    }
 }
 
 void Writer::beginArg(unsigned index) {
@@ -217,6 +257,7 @@ void Writer::beginStruct(const StructSig *sig) {
     _writeByte(trace::TYPE_STRUCT);
     _writeUInt(sig->id);
     if (!lookup(structs, sig->id)) {
+        indexSig(SIG_STRUCT, sig->id);
         _writeString(sig->name);
         _writeUInt(sig->num_members);
         for (unsigned i = 0; i < sig->num_members; ++i) {
@@ -303,6 +344,7 @@ void Writer::writeEnum(const EnumSig *sig, signed long long value) {
     _writeByte(trace::TYPE_ENUM);
     _writeUInt(sig->id);
     if (!lookup(enums, sig->id)) {
+        indexSig(SIG_ENUM, sig->id);
         _writeUInt(sig->num_values);
         for (unsigned i = 0; i < sig->num_values; ++i) {
             _writeString(sig->values[i].name);
@@ -317,6 +359,7 @@ void Writer::writeBitmask(const BitmaskSig *sig, unsigned long long value) {
     _writeByte(trace::TYPE_BITMASK);
     _writeUInt(sig->id);
     if (!lookup(bitmasks, sig->id)) {
+        indexSig(SIG_BITMASK, sig->id);
         _writeUInt(sig->num_flags);
         for (unsigned i = 0; i < sig->num_flags; ++i) {
             if (i != 0 && sig->flags[i].value == 0) {
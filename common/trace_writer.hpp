@@ -31,14 +31,16 @@
 #define _TRACE_WRITER_HPP_
 
 
+#include <assert.h>
 #include <stddef.h>
 
 #include <vector>
 
+#include "trace_file.hpp"
+#include "trace_index.hpp"
 #include "trace_model.hpp"
 
 namespace trace {
-    class File;
 
     class Writer {
     protected:
@@ -51,13 +53,31 @@ namespace trace {
         std::vector<bool> bitmasks;
         std::vector<bool> frames;
 
+        /*
+         * Seek index, written as a footer when the file is closed.
+         */
+        bool indexing;
+        bool callTimes;
+        Index index;
+        std::vector<bool> frameEndFunctions;
+        std::vector<unsigned> pendingFrameEnds;
+        bool leavingFrameEnd;
+
+        void indexSig(SigKind kind, unsigned id);
+
     public:
         Writer();
         ~Writer();
 
-        bool open(const char *filename);
+        /* Pass callTimes if writeCallTime() will be used, which requires
+         * a newer trace version. */
+        bool open(const char *filename, bool callTimes = false);
         void close(void);
 
+        bool hasCallTimes(void) const {
+            return callTimes;
+        }
+
         unsigned beginEnter(const FunctionSig *sig, unsigned thread_id);
         void endEnter(void);
 
@@ -74,6 +94,8 @@ namespace trace {
         void writeStackFrame(const RawStackFrame *frame);
         inline void endBacktrace(void) {}
 
+        void writeCallTime(unsigned long long start, unsigned long long duration);
+
         void beginArray(size_t length);
         inline void endArray(void) {}
 
@@ -112,6 +134,35 @@ namespace trace {
 
     };
 
+    void inline
+    Writer::_write(const void *sBuffer, size_t dwBytesToWrite) {
+        m_file->write(sBuffer, dwBytesToWrite);
+    }
+
+    void inline
+    Writer::_writeByte(char c) {
+        _write(&c, 1);
+    }
+
+    void inline
+    Writer::_writeUInt(unsigned long long value) {
+        char buf[2 * sizeof value];
+        unsigned len;
+
+        len = 0;
+        do {
+            assert(len < sizeof buf);
+            buf[len] = 0x80 | (value & 0x7f);
+            value >>= 7;
+            ++len;
+        } while (value);
+
+        assert(len);
+        buf[len - 1] &= 0x7f;
+
+        _write(buf, len);
+    }
+
 } /* namespace trace */
 
 #endif /* _TRACE_WRITER_HPP_ */
@@ -30,9 +30,13 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <algorithm>
+#include <vector>
+
 #include "os.hpp"
 #include "os_thread.hpp"
 #include "os_string.hpp"
+#include "os_time.hpp"
 #include "trace_file.hpp"
 #include "trace_writer_local.hpp"
 #include "trace_format.hpp"
@@ -61,11 +65,229 @@ static void exceptionCallback(void)
 }
 
 
+/**
+ * Buffer into which the current thread is serializing a call record, or NULL
+ * if writes should go straight into the trace file.
+ */
+static OS_THREAD_SPECIFIC_PTR(std::vector<char>)
+record_buffer;
+
+
+/**
+ * File wrapper which diverts writes into the current thread's record buffer
+ * (if any).
+ */
+class ThreadBufferedFile : public File {
+public:
+    ThreadBufferedFile(File *file) :
+        File(),
+        m_file(file)
+    {}
+
+    virtual ~ThreadBufferedFile() {
+        close();
+        delete m_file;
+    }
+
+    virtual bool supportsOffsets() const { return false; }
+    virtual File::Offset currentOffset() { return File::Offset(); }
+
+protected:
+    virtual bool rawOpen(const std::string &filename, File::Mode mode) {
+        return m_file->open(filename, mode);
+    }
+
+    virtual bool rawWrite(const void *buffer, size_t length) {
+        std::vector<char> *record = record_buffer;
+        if (record) {
+            const char *data = static_cast<const char *>(buffer);
+            record->insert(record->end(), data, data + length);
+            return true;
+        }
+        return m_file->write(buffer, length);
+    }
+
+    virtual size_t rawRead(void *buffer, size_t length) { return 0; }
+    virtual int rawGetc() { return -1; }
+    virtual void rawClose() { m_file->close(); }
+    virtual void rawFlush() { m_file->flush(); }
+    virtual bool rawSkip(size_t length) { return false; }
+    virtual int rawPercentRead() { return 0; }
+
+private:
+    File *m_file;
+};
+
+
+/**
+ * Per-thread state when using thread buffers.
+ */
+struct LocalWriter::ThreadState {
+    unsigned thread_id;
+
+    /**
+     * Trace file generation the signature caches below refer to.
+     */
+    unsigned generation;
+
+    /**
+     * Call record being serialized.
+     */
+    std::vector<char> buffer;
+
+    /**
+     * Whether the mutex is held until the record is committed.  This is
+     * necessary when the record defines new signatures, so that no other
+     * thread references them before the definition is in the trace file.
+     */
+    bool locked;
+
+    /**
+     * Call numbers of the calls entered but not yet left by this thread.
+     * Enter records are numbered when committed, so this is what the call
+     * handles returned by beginEnter index.
+     */
+    std::vector<unsigned> calls;
+
+    /**
+     * Signatures known to be already defined in the trace file.
+     */
+    std::vector<bool> functions;
+    std::vector<bool> structs;
+    std::vector<bool> enums;
+    std::vector<bool> bitmasks;
+    std::vector<bool> frames;
+};
+
+
+static OS_THREAD_SPECIFIC_PTR(LocalWriter::ThreadState)
+thread_state;
+
+
+/**
+ * Start times of the calls entered but not yet left by the current thread,
+ * or -1 for fake calls, when recording call times.
+ */
+static OS_THREAD_SPECIFIC_PTR(std::vector<long long>)
+call_start_times;
+
+/**
+ * Per-thread states of exited threads, for new threads to reuse.  Protected
+ * by the mutex.
+ */
+static std::vector<LocalWriter::ThreadState *> free_thread_states;
+
+
+/*
+ * Thread exit notification, so that the per-thread state above is not
+ * leaked by applications which call from many short-lived threads.
+ *
+ * Fiber local storage is not available on Windows XP, in which case the
+ * state is still leaked.
+ */
+static bool writer_alive = false;
+
+#ifdef _WIN32
+
+typedef VOID (WINAPI *PFNFLSCALLBACK)(PVOID);
+typedef DWORD (WINAPI *PFNFLSALLOC)(PFNFLSCALLBACK);
+typedef BOOL (WINAPI *PFNFLSSETVALUE)(DWORD, PVOID);
+
+static PFNFLSSETVALUE pfnFlsSetValue = NULL;
+static DWORD thread_exit_index = 0xffffffff;
+
+static VOID WINAPI
+threadExitCallback(PVOID data) {
+    if (data && writer_alive) {
+        localWriter.releaseThreadState();
+    }
+}
+
+static void
+initThreadExit(void) {
+    HMODULE hKernel32 = GetModuleHandleA("kernel32");
+    PFNFLSALLOC pfnFlsAlloc =
+        (PFNFLSALLOC)GetProcAddress(hKernel32, "FlsAlloc");
+    pfnFlsSetValue =
+        (PFNFLSSETVALUE)GetProcAddress(hKernel32, "FlsSetValue");
+    if (pfnFlsAlloc && pfnFlsSetValue) {
+        thread_exit_index = pfnFlsAlloc(threadExitCallback);
+    }
+}
+
+static void
+watchThreadExit(void) {
+    if (thread_exit_index != 0xffffffff) {
+        pfnFlsSetValue(thread_exit_index, (PVOID)1);
+    }
+}
+
+#else
+
+static pthread_key_t thread_exit_key;
+
+static void
+threadExitCallback(void *data) {
+    if (writer_alive) {
+        localWriter.releaseThreadState();
+    }
+}
+
+static void
+initThreadExit(void) {
+    pthread_key_create(&thread_exit_key, threadExitCallback);
+}
+
+static void
+watchThreadExit(void) {
+    pthread_setspecific(thread_exit_key, (void *)1);
+}
+
+#endif
+
+
+static inline std::vector<long long> *
+getCallStartTimes(void) {
+    std::vector<long long> *times = call_start_times;
+    if (!times) {
+        times = new std::vector<long long>;
+        call_start_times = times;
+        watchThreadExit();
+    }
+    return times;
+}
+
+
 LocalWriter::LocalWriter() :
-    acquired(0)
+    acquired(0),
+    lockStats(false),
+    lockCount(0),
+    contendedCount(0),
+    contendedTime(0),
+    generation(0),
+    threadBuffers(false),
+    callTimes(false),
+    openTime(0)
 {
     os::log("apitrace: loaded\n");
 
+    const char *value = getenv("APITRACE_THREAD_BUFFERS");
+    if (value && atoi(value) > 0) {
+        threadBuffers = true;
+        m_file = new ThreadBufferedFile(m_file);
+    }
+
+    value = getenv("APITRACE_CALL_TIMES");
+    if (value && atoi(value) > 0) {
+        callTimes = true;
+    }
+
+    value = getenv("APITRACE_LOCK_STATS");
+    lockStats = threadBuffers || (value && atoi(value) > 0);
+
+    initThreadExit();
+    writer_alive = true;
+
     // Install the signal handlers as early as possible, to prevent
     // interfering with the application's signal handling.
     os::setExceptionCallback(exceptionCallback);
@@ -73,8 +295,15 @@ LocalWriter::LocalWriter() :
 
 LocalWriter::~LocalWriter()
 {
+    writer_alive = false;
     os::resetExceptionCallback();
     checkProcessId();
+
+    if (lockStats && lockCount) {
+        os::log("apitrace: %llu of %llu lock acquisitions contended, %.3f ms spent waiting\n",
+                contendedCount, lockCount,
+                contendedTime * (1000.0 / os::timeFrequency));
+    }
 }
 
 void
@@ -121,12 +350,14 @@ LocalWriter::open(void) {
 
     os::log("apitrace: tracing to %s\n", lpFileName);
 
-    if (!Writer::open(lpFileName)) {
+    if (!Writer::open(lpFileName, callTimes)) {
         os::log("apitrace: error: failed to open %s\n", lpFileName);
         os::abort();
     }
 
     pid = os::getCurrentProcessId();
+    ++generation;
+    openTime = os::getTime();
 
 #if 0
     // For debugging the exception handler
@@ -147,15 +378,46 @@ void LocalWriter::checkProcessId(void) {
         // file, as it may cause it to flush and corrupt the parent's
         // trace, so we effectively leak the old file object.
         m_file = File::createSnappy();
+        if (threadBuffers) {
+            m_file = new ThreadBufferedFile(m_file);
+        }
         // Don't want to open the same file again
         os::unsetEnvironment("TRACE_FILE");
         open();
     }
 }
 
-unsigned LocalWriter::beginEnter(const FunctionSig *sig, bool fake) {
-    mutex.lock();
+/**
+ * Acquire the mutex, keeping track of how often and for how long we had to
+ * wait for it.
+ */
+void LocalWriter::lock(void) {
+    if (!mutex.try_lock()) {
+        long long startTime = os::getTime();
+        mutex.lock();
+        contendedTime += os::getTime() - startTime;
+        ++contendedCount;
+    }
+    ++lockCount;
     ++acquired;
+}
+
+void LocalWriter::unlock(void) {
+    --acquired;
+    mutex.unlock();
+}
+
+unsigned LocalWriter::beginEnter(const FunctionSig *sig, bool fake) {
+    if (callTimes) {
+        // Fake calls are not timed, but still keep the stack balanced
+        getCallStartTimes()->push_back(fake ? -1 : 0);
+    }
+
+    if (threadBuffers) {
+        return beginThreadEnter(sig, fake);
+    }
+
+    lock();
 
     checkProcessId();
     if (!m_file->isOpened()) {
@@ -185,21 +447,298 @@ unsigned LocalWriter::beginEnter(const FunctionSig *sig, bool fake) {
 }
 
 void LocalWriter::endEnter(void) {
-    Writer::endEnter();
-    --acquired;
-    mutex.unlock();
+    if (threadBuffers) {
+        endThreadEnter();
+    } else {
+        Writer::endEnter();
+        unlock();
+    }
+
+    // Start the clock as late as possible, right before the real call
+    if (callTimes) {
+        long long &startTime = call_start_times->back();
+        if (startTime >= 0) {
+            startTime = os::getTime();
+        }
+    }
 }
 
 void LocalWriter::beginLeave(unsigned call) {
-    mutex.lock();
-    ++acquired;
-    Writer::beginLeave(call);
+    long long endTime = callTimes ? os::getTime() : 0;
+
+    if (threadBuffers) {
+        beginThreadLeave(call);
+    } else {
+        lock();
+        Writer::beginLeave(call);
+    }
+
+    if (callTimes) {
+        std::vector<long long> *times = call_start_times;
+        long long startTime = times->back();
+        times->pop_back();
+        if (startTime >= 0) {
+            // Calls in flight when a forked child reopens the trace start at 0
+            long long relativeStartTime = std::max(startTime - openTime, 0LL);
+            double scale = 1.0E9 / os::timeFrequency;
+            writeCallTime((unsigned long long)(relativeStartTime * scale),
+                          (unsigned long long)((endTime - startTime) * scale));
+        }
+    }
 }
 
 void LocalWriter::endLeave(void) {
+    if (threadBuffers) {
+        endThreadLeave();
+        return;
+    }
+
     Writer::endLeave();
-    --acquired;
-    mutex.unlock();
+    unlock();
+}
+
+
+static inline bool
+isKnown(std::vector<bool> &known, size_t index) {
+    if (index >= known.size()) {
+        known.resize(index + 1);
+        return false;
+    } else {
+        return known[index];
+    }
+}
+
+LocalWriter::ThreadState *
+LocalWriter::getThreadState(void) {
+    ThreadState *state = thread_state;
+    if (!state) {
+        lock();
+        if (free_thread_states.empty()) {
+            state = new ThreadState;
+            state->locked = false;
+            state->generation = generation;
+        } else {
+            // Signatures the exited thread knew about are still defined
+            state = free_thread_states.back();
+            free_thread_states.pop_back();
+        }
+        state->thread_id = next_thread_num++ - 1;
+        unlock();
+
+        thread_state = state;
+        watchThreadExit();
+    }
+
+    if (state->generation != generation ||
+        !m_file->isOpened() ||
+        os::getCurrentProcessId() != pid) {
+        lock();
+        checkProcessId();
+        if (!m_file->isOpened()) {
+            open();
+        }
+        unlock();
+    }
+
+    if (state->generation != generation) {
+        // The signatures we knew about were defined in another file
+        state->generation = generation;
+        state->functions.clear();
+        state->structs.clear();
+        state->enums.clear();
+        state->bitmasks.clear();
+        state->frames.clear();
+    }
+
+    return state;
+}
+
+void
+LocalWriter::releaseThreadState(void) {
+    std::vector<long long> *times = call_start_times;
+    if (times) {
+        call_start_times = NULL;
+        delete times;
+    }
+
+    ThreadState *state = thread_state;
+    if (state) {
+        thread_state = NULL;
+        record_buffer = NULL;
+
+        assert(!state->locked);
+        state->calls.clear();
+        std::vector<char>().swap(state->buffer);
+
+        lock();
+        free_thread_states.push_back(state);
+        unlock();
+    }
+}
+
+/**
+ * Hold the mutex until the current record is committed.
+ */
+void LocalWriter::lockRecord(ThreadState *state) {
+    if (!state->locked) {
+        lock();
+        state->locked = true;
+    }
+}
+
+/**
+ * Append the current record to the trace file.
+ */
+void LocalWriter::commitRecord(ThreadState *state) {
+    record_buffer = NULL;
+
+    if (!state->locked) {
+        lock();
+    }
+
+    if (!state->buffer.empty()) {
+        m_file->write(&state->buffer[0], state->buffer.size());
+    }
+
+    state->locked = false;
+    unlock();
+
+    // Don't hold on to the memory of exceptionally large records
+    if (state->buffer.capacity() > 1024*1024) {
+        std::vector<char>().swap(state->buffer);
+    } else {
+        state->buffer.clear();
+    }
+}
+
+/*
+ * Enter records are numbered when they are committed, so the value returned
+ * here is merely a handle for beginLeave.
+ */
+unsigned LocalWriter::beginThreadEnter(const FunctionSig *sig, bool fake) {
+    ThreadState *state = getThreadState();
+
+    assert(state->buffer.empty());
+    assert(!state->locked);
+    record_buffer = &state->buffer;
+
+    unsigned handle = state->calls.size();
+    if (isKnown(state->functions, sig->id)) {
+        _writeByte(trace::EVENT_ENTER);
+        _writeUInt(state->thread_id);
+        _writeUInt(sig->id);
+        state->calls.push_back(~0U);
+    } else {
+        lockRecord(state);
+        state->calls.push_back(Writer::beginEnter(sig, state->thread_id));
+        state->functions[sig->id] = true;
+    }
+
+    if (!fake && os::backtrace_is_needed(sig->name)) {
+        std::vector<RawStackFrame> backtrace = os::get_backtrace();
+        beginBacktrace(backtrace.size());
+        for (unsigned i = 0; i < backtrace.size(); ++i) {
+            writeStackFrame(&backtrace[i]);
+        }
+        endBacktrace();
+    }
+
+    return handle;
+}
+
+void LocalWriter::endThreadEnter(void) {
+    ThreadState *state = thread_state;
+    assert(state);
+
+    Writer::endEnter();
+
+    lockRecord(state);
+    if (state->calls.back() == ~0U) {
+        state->calls.back() = call_no++;
+    }
+    commitRecord(state);
+}
+
+void LocalWriter::beginThreadLeave(unsigned call) {
+    ThreadState *state = getThreadState();
+
+    assert(state->buffer.empty());
+    assert(!state->locked);
+    record_buffer = &state->buffer;
+
+    // Calls are left in the reverse order they are entered
+    assert(call + 1 == state->calls.size());
+    unsigned call_no = state->calls.back();
+    state->calls.pop_back();
+
+    Writer::beginLeave(call_no);
+}
+
+void LocalWriter::endThreadLeave(void) {
+    ThreadState *state = thread_state;
+    assert(state);
+
+    Writer::endLeave();
+
+    commitRecord(state);
+}
+
+
+void LocalWriter::beginStruct(const StructSig *sig) {
+    if (threadBuffers) {
+        ThreadState *state = thread_state;
+        if (isKnown(state->structs, sig->id)) {
+            _writeByte(trace::TYPE_STRUCT);
+            _writeUInt(sig->id);
+            return;
+        }
+        lockRecord(state);
+        state->structs[sig->id] = true;
+    }
+    Writer::beginStruct(sig);
+}
+
+void LocalWriter::writeEnum(const EnumSig *sig, signed long long value) {
+    if (threadBuffers) {
+        ThreadState *state = thread_state;
+        if (isKnown(state->enums, sig->id)) {
+            _writeByte(trace::TYPE_ENUM);
+            _writeUInt(sig->id);
+            writeSInt(value);
+            return;
+        }
+        lockRecord(state);
+        state->enums[sig->id] = true;
+    }
+    Writer::writeEnum(sig, value);
+}
+
+void LocalWriter::writeBitmask(const BitmaskSig *sig, unsigned long long value) {
+    if (threadBuffers) {
+        ThreadState *state = thread_state;
+        if (isKnown(state->bitmasks, sig->id)) {
+            _writeByte(trace::TYPE_BITMASK);
+            _writeUInt(sig->id);
+            _writeUInt(value);
+            return;
+        }
+        lockRecord(state);
+        state->bitmasks[sig->id] = true;
+    }
+    Writer::writeBitmask(sig, value);
+}
+
+void LocalWriter::writeStackFrame(const RawStackFrame *frame) {
+    if (threadBuffers) {
+        ThreadState *state = thread_state;
+        if (isKnown(state->frames, frame->id)) {
+            _writeUInt(frame->id);
+            return;
+        }
+        lockRecord(state);
+        state->frames[frame->id] = true;
+    }
+    Writer::writeStackFrame(frame);
 }
 
 void LocalWriter::flush(void) {
@@ -50,11 +50,16 @@ namespace trace {
      *
      * In particular:
      * - it creates a trace file based on the current process name
-     * - uses mutexes to allow tracing from multiple threades
+     * - uses mutexes to allow tracing from multiple threades, optionally
+     *   serializing each thread's calls into a thread-local buffer, so that
+     *   the mutex is only held while appending complete call records
      * - flushes the output to ensure the last call is traced in event of
      *   abnormal termination
      */
     class LocalWriter : public Writer {
+    public:
+        struct ThreadState;
+
     protected:
         /**
          * This mutex guarantees that only one thread writes to the trace file
@@ -71,13 +76,61 @@ namespace trace {
         os::recursive_mutex mutex;
         int acquired;
 
+        /**
+         * Lock contention statistics, protected by the mutex.  Only reported
+         * at exit when using thread buffers, or with the APITRACE_LOCK_STATS
+         * environment variable.
+         */
+        bool lockStats;
+        unsigned long long lockCount;
+        unsigned long long contendedCount;
+        long long contendedTime;
+
         /**
          * ID of the processed that opened the trace file.
          */
         os::ProcessId pid;
 
+        /**
+         * Incremented every time a new trace file is opened, so that
+         * per-thread state referring to a previous file can be discarded.
+         */
+        unsigned generation;
+
+        /**
+         * Whether each thread serializes its calls into a thread-local
+         * buffer, taking the mutex only to append complete call records to
+         * the trace file.  Enabled with the APITRACE_THREAD_BUFFERS
+         * environment variable.
+         */
+        bool threadBuffers;
+
+        /**
+         * Whether to record when and for how long each real function was
+         * called.  Enabled with the APITRACE_CALL_TIMES environment variable.
+         */
+        bool callTimes;
+
+        /**
+         * Time the trace file was opened, which recorded call times are
+         * relative to.
+         */
+        long long openTime;
+
         void checkProcessId();
 
+        void lock(void);
+        void unlock(void);
+
+        ThreadState *getThreadState(void);
+        void lockRecord(ThreadState *state);
+        void commitRecord(ThreadState *state);
+
+        unsigned beginThreadEnter(const FunctionSig *sig, bool fake);
+        void endThreadEnter(void);
+        void beginThreadLeave(unsigned call);
+        void endThreadLeave(void);
+
     public:
         /**
          * Should never called directly -- use localWriter singleton below
@@ -88,6 +141,11 @@ namespace trace {
 
         void open(void);
 
+        /**
+         * Release the current thread's state.  Called when a thread exits.
+         */
+        void releaseThreadState(void);
+
         /**
          * It will acquire the mutex.
          */
@@ -108,6 +166,16 @@ namespace trace {
          */
         void endLeave(void);
 
+        /*
+         * These hide the Writer methods which emit signatures, so that
+         * signatures already known to be in the trace file can be referenced
+         * without taking the mutex when using thread buffers.
+         */
+        void beginStruct(const StructSig *sig);
+        void writeEnum(const EnumSig *sig, signed long long value);
+        void writeBitmask(const BitmaskSig *sig, unsigned long long value);
+        void writeStackFrame(const RawStackFrame *frame);
+
         void flush(void);
     };
 
@@ -125,6 +125,9 @@ public:
         }
         writer.endEnter();
         writer.beginLeave(call_no);
+        if (call->cpuDuration >= 0 && writer.hasCallTimes()) {
+            writer.writeCallTime(call->cpuStart, call->cpuDuration);
+        }
         if (call->ret) {
             writer.beginReturn();
             _visit(call->ret);
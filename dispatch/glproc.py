@@ -501,6 +501,12 @@ extern void * _libGlHandle;
 
 void * _getPublicProcAddress(const char *procName);
 void * _getPrivateProcAddress(const char *procName);
+
+/*
+ * When set, used instead of the real OpenGL implementation to look up all
+ * functions (e.g., by glretrace --driver=null).
+ */
+extern void * (*_getProcAddressOverride)(const char *procName);
 '''
         
     def isFunctionPublic(self, module, function):
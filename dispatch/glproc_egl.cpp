@@ -43,6 +43,11 @@ void *_libGlHandle = NULL;
 #endif
 
 
+/*
+ * Lookup to use instead of the true OpenGL library, if set.
+ */
+void * (*_getProcAddressOverride)(const char *procName) = NULL;
+
 
 #if defined(_WIN32)
 
@@ -70,6 +75,10 @@ void *_libGlHandle = NULL;
 void *
 _getPublicProcAddress(const char *procName)
 {
+    if (_getProcAddressOverride) {
+        return _getProcAddressOverride(procName);
+    }
+
 #if defined(ANDROID)
     /*
      * Android does not support LD_PRELOAD.  It is assumed that applications
@@ -134,6 +143,10 @@ _getPublicProcAddress(const char *procName)
 void *
 _getPrivateProcAddress(const char *procName)
 {
+    if (_getProcAddressOverride) {
+        return _getProcAddressOverride(procName);
+    }
+
     void *proc;
     proc = _getPublicProcAddress(procName);
     if (!proc &&
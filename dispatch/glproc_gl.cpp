@@ -43,12 +43,21 @@ void *_libGlHandle = NULL;
 #endif
 
 
+/*
+ * Lookup to use instead of the true OpenGL library, if set.
+ */
+void * (*_getProcAddressOverride)(const char *procName) = NULL;
+
 
 #if defined(_WIN32)
 
 void *
 _getPublicProcAddress(const char *procName)
 {
+    if (_getProcAddressOverride) {
+        return _getProcAddressOverride(procName);
+    }
+
     if (!_libGlHandle) {
         char szDll[MAX_PATH] = {0};
         
@@ -71,6 +80,10 @@ _getPublicProcAddress(const char *procName)
 
 void *
 _getPrivateProcAddress(const char *procName) {
+    if (_getProcAddressOverride) {
+        return _getProcAddressOverride(procName);
+    }
+
     return (void *)_wglGetProcAddress(procName);
 }
 
@@ -132,12 +145,20 @@ void * _libgl_sym(const char *symbol)
 void *
 _getPublicProcAddress(const char *procName)
 {
+    if (_getProcAddressOverride) {
+        return _getProcAddressOverride(procName);
+    }
+
     return _libgl_sym(procName);
 }
 
 void *
 _getPrivateProcAddress(const char *procName)
 {
+    if (_getProcAddressOverride) {
+        return _getProcAddressOverride(procName);
+    }
+
     return _libgl_sym(procName);
 }
 
@@ -266,12 +287,20 @@ void * _libgl_sym(const char *symbol)
 void *
 _getPublicProcAddress(const char *procName)
 {
+    if (_getProcAddressOverride) {
+        return _getProcAddressOverride(procName);
+    }
+
     return _libgl_sym(procName);
 }
 
 void *
 _getPrivateProcAddress(const char *procName)
 {
+    if (_getProcAddressOverride) {
+        return _getProcAddressOverride(procName);
+    }
+
     return (void *)_glXGetProcAddressARB((const GLubyte *)procName);
 }
 
@@ -20,6 +20,7 @@
 #include "ui_retracerdialog.h"
 #include "ui_profilereplaydialog.h"
 #include "vertexdatainterpreter.h"
+#include "trace_parser.hpp"
 #include "trace_profiler.hpp"
 
 #include <QAction>
@@ -240,6 +241,42 @@ void MainWindow::replayProfile()
     }
 }
 
+void MainWindow::profileRecorded()
+{
+    trace::Parser parser;
+    if (!parser.open(m_trace->fileName().toLocal8Bit().constData())) {
+        QMessageBox::warning(
+            this,
+            tr("Profile Recorded Times"),
+            tr("Could not open %1.").arg(m_trace->fileName()));
+        return;
+    }
+
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+
+    trace::Profile *profile = new trace::Profile();
+    trace::ProfileBuilder builder(profile);
+    trace::Call *call;
+    while ((call = parser.parse_call())) {
+        builder.addTraceCall(*call);
+        delete call;
+    }
+
+    QApplication::restoreOverrideCursor();
+
+    if (profile->calls.empty()) {
+        delete profile;
+        QMessageBox::information(
+            this,
+            tr("Profile Recorded Times"),
+            tr("This trace has no recorded call times. Capture it with "
+               "APITRACE_CALL_TIMES=1 set in the environment."));
+        return;
+    }
+
+    replayProfileFound(profile);
+}
+
 void MainWindow::replayStop()
 {
     m_retracer->quit();
@@ -871,6 +908,8 @@ void MainWindow::initConnections()
             this, SLOT(replayStart()));
     connect(m_ui.actionProfile, SIGNAL(triggered()),
             this, SLOT(replayProfile()));
+    connect(m_ui.actionProfileRecorded, SIGNAL(triggered()),
+            this, SLOT(profileRecorded()));
     connect(m_ui.actionStop, SIGNAL(triggered()),
             this, SLOT(replayStop()));
     connect(m_ui.actionLookupState, SIGNAL(triggered()),
@@ -956,6 +995,7 @@ void MainWindow::updateActionsState(bool traceLoaded, bool stopped)
         }
 
         m_ui.actionProfile       ->setEnabled(true);
+        m_ui.actionProfileRecorded->setEnabled(true);
         m_ui.actionLookupState   ->setEnabled(true);
         m_ui.actionShowThumbnails->setEnabled(true);
         m_ui.actionTrim          ->setEnabled(true);
@@ -970,6 +1010,7 @@ void MainWindow::updateActionsState(bool traceLoaded, bool stopped)
         /* Trace */
         m_ui.actionReplay        ->setEnabled(false);
         m_ui.actionProfile       ->setEnabled(false);
+        m_ui.actionProfileRecorded->setEnabled(false);
         m_ui.actionStop          ->setEnabled(false);
         m_ui.actionLookupState   ->setEnabled(false);
         m_ui.actionShowThumbnails->setEnabled(false);
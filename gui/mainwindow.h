@@ -54,6 +54,7 @@ private slots:
     void openTrace();
     void replayStart();
     void replayProfile();
+    void profileRecorded();
     void replayStop();
     void replayFinished(const QString &message);
     void replayStateFound(ApiTraceState *state);
@@ -314,6 +314,8 @@ void Retracer::run()
         if (m_profilePixels) {
             arguments << QLatin1String("--ppd");
         }
+
+        arguments << QLatin1String("--profile-format=binary");
     } else {
         if (m_doubleBuffered) {
             arguments << QLatin1String("--db");
@@ -444,17 +446,23 @@ void Retracer::run()
             Q_ASSERT(process.state() != QProcess::Running);
         } else if (isProfiling()) {
             profile = new trace::Profile();
+            trace::ProfileReader reader(profile);
 
-            while (!io.atEnd()) {
-                char line[256];
-                qint64 lineLength;
-
-                lineLength = io.readLine(line, 256);
+            /*
+             * Feed the binary profile stream to the reader in chunks, keeping
+             * any incomplete record around until more data arrives.
+             */
+            QByteArray pending;
+            while (!reader.isFinished()) {
+                char chunk[64 * 1024];
+                qint64 chunkLength = io.read(chunk, sizeof chunk);
 
-                if (lineLength == -1)
+                if (chunkLength <= 0)
                     break;
 
-                trace::Profiler::parseLine(line, profile);
+                pending.append(chunk, chunkLength);
+                size_t consumed = reader.parse(pending.constData(), pending.size());
+                pending.remove(0, int(consumed));
             }
         } else {
             QByteArray output;
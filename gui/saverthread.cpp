@@ -346,12 +346,13 @@ void SaverThread::run()
         callIndexMap.insert(call->index(), call);
     }
 
-    trace::Writer writer;
-    writer.open(m_writeFileName.toLocal8Bit());
-
     trace::Parser parser;
     parser.open(m_readFileName.toLocal8Bit());
 
+    trace::Writer writer;
+    writer.open(m_writeFileName.toLocal8Bit(),
+                parser.version >= TRACE_VERSION_CALL_TIME);
+
     trace::Call *call;
     while ((call = parser.parse_call())) {
         if (callIndexMap.contains(call->no)) {
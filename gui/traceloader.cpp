@@ -123,6 +123,52 @@ void TraceLoader::scanTrace()
 
     m_parser.getBookmark(startBookmark);
 
+    const trace::Index *index = m_parser.getIndex();
+    if (index && !index->frames.empty()) {
+        // The index already tells where each frame starts, so there is no
+        // need to scan the whole trace.
+        for (unsigned i = 0; i < index->frames.size(); ++i) {
+            const trace::Index::FrameEntry &entry = index->frames[i];
+            bool last = i + 1 == index->frames.size();
+            unsigned endCallNo = last ? index->numCalls : index->frames[i + 1].callNo;
+            numOfCalls = endCallNo - entry.callNo;
+            if (last && !numOfCalls) {
+                break;
+            }
+
+            FrameBookmark frameBookmark;
+            frameBookmark.start.offset = entry.offset;
+            frameBookmark.start.next_call_no = entry.callNo;
+            frameBookmark.numberOfCalls = numOfCalls;
+
+            currentFrame = new ApiTraceFrame();
+            currentFrame->number = numOfFrames;
+            currentFrame->setNumChildren(numOfCalls);
+            if (!last) {
+                currentFrame->setLastCallIndex(endCallNo - 1);
+            }
+            frames.append(currentFrame);
+
+            m_createdFrames.append(currentFrame);
+            m_frameBookmarks[numOfFrames] = frameBookmark;
+            ++numOfFrames;
+        }
+
+        // Guess the API from the first frame
+        m_parser.setBookmark(startBookmark);
+        numOfCalls = numberOfCallsInFrame(0);
+        while (m_parser.api == trace::API_UNKNOWN &&
+               numOfCalls-- > 0 &&
+               (call = m_parser.scan_call())) {
+            delete call;
+        }
+
+        emit parsed(100);
+
+        emit framesLoaded(frames);
+        return;
+    }
+
     while ((call = m_parser.scan_call())) {
         ++numOfCalls;
 
@@ -119,6 +119,16 @@ public:
 
     bool
     writeRAW(const char *filename) const;
+
+    /**
+     * Only 8bit RGB and RGBA images can be written as QOI; false is returned
+     * without writing anything for others.
+     */
+    bool
+    writeQOI(std::ostream &os) const;
+
+    bool
+    writeQOI(const char *filename) const;
 };
 
 
@@ -129,6 +139,16 @@ Image *
 readPNG(const char *filename);
 
 
+Image *
+readQOI(const char *buffer, size_t size);
+
+Image *
+readQOI(std::istream &is);
+
+Image *
+readQOI(const char *filename);
+
+
 struct PNMInfo
 {
     unsigned width;
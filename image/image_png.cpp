@@ -196,6 +196,8 @@ readPNG(std::istream &is)
     if (bit_depth == 16)
         png_set_strip_16(png_ptr);
 
+    png_read_update_info(png_ptr, info_ptr);
+
     channels = png_get_channels(png_ptr, info_ptr);
     image = new Image(width, height, channels);
     if (!image)
@@ -225,7 +227,7 @@ readPNG(const char *filename)
     if (!is) {
         return NULL;
     }
-    return readPNG(filename);
+    return readPNG(is);
 }
 
 
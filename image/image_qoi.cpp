@@ -0,0 +1,359 @@
+/**************************************************************************
+ *
+ * Copyright 2014 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+/*
+ * Quite OK Image format, a simple lossless format which encodes and decodes
+ * several times faster than PNG, at comparable sizes.
+ *
+ * See also:
+ * - http://qoiformat.org/qoi-specification.pdf
+ */
+
+
+#include <assert.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+#include "image.hpp"
+
+
+namespace image {
+
+
+#define QOI_OP_INDEX 0x00 // 00xxxxxx
+#define QOI_OP_DIFF  0x40 // 01xxxxxx
+#define QOI_OP_LUMA  0x80 // 10xxxxxx
+#define QOI_OP_RUN   0xc0 // 11xxxxxx
+#define QOI_OP_RGB   0xfe // 11111110
+#define QOI_OP_RGBA  0xff // 11111111
+
+#define QOI_MASK_2   0xc0
+
+#define QOI_HEADER_SIZE 14
+
+static const unsigned char
+qoiPadding[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+
+
+union QOIPixel
+{
+    struct {
+        unsigned char r, g, b, a;
+    } rgba;
+    uint32_t v;
+};
+
+
+static inline unsigned
+qoiHash(const QOIPixel &px)
+{
+    return (px.rgba.r*3 + px.rgba.g*5 + px.rgba.b*7 + px.rgba.a*11) % 64;
+}
+
+
+static inline void
+qoiWrite32(unsigned char *&p, uint32_t v)
+{
+    *p++ = (v >> 24) & 0xff;
+    *p++ = (v >> 16) & 0xff;
+    *p++ = (v >>  8) & 0xff;
+    *p++ =  v        & 0xff;
+}
+
+
+static inline uint32_t
+qoiRead32(const unsigned char *p)
+{
+    return ((uint32_t)p[0] << 24) |
+           ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] <<  8) |
+            (uint32_t)p[3];
+}
+
+
+bool
+Image::writeQOI(std::ostream &os) const
+{
+    if (channelType != TYPE_UNORM8 ||
+        (channels != 3 && channels != 4)) {
+        return false;
+    }
+
+    // Worst case is one extra byte per pixel
+    std::vector<unsigned char> buffer(QOI_HEADER_SIZE + (size_t)width*height*(channels + 1) + sizeof qoiPadding);
+    unsigned char *p = &buffer[0];
+
+    *p++ = 'q';
+    *p++ = 'o';
+    *p++ = 'i';
+    *p++ = 'f';
+    qoiWrite32(p, width);
+    qoiWrite32(p, height);
+    *p++ = channels;
+    *p++ = 0; // sRGB with linear alpha
+
+    QOIPixel index[64];
+    memset(index, 0, sizeof index);
+
+    QOIPixel prev;
+    prev.rgba.r = 0;
+    prev.rgba.g = 0;
+    prev.rgba.b = 0;
+    prev.rgba.a = 255;
+
+    QOIPixel px = prev;
+    unsigned run = 0;
+
+    const unsigned char *row;
+    for (row = start(); row != end(); row += stride()) {
+        const unsigned char *src = row;
+        for (unsigned x = 0; x < width; ++x) {
+            px.rgba.r = src[0];
+            px.rgba.g = src[1];
+            px.rgba.b = src[2];
+            if (channels == 4) {
+                px.rgba.a = src[3];
+            }
+            src += channels;
+
+            if (px.v == prev.v) {
+                if (++run == 62) {
+                    *p++ = QOI_OP_RUN | (run - 1);
+                    run = 0;
+                }
+                continue;
+            }
+
+            if (run) {
+                *p++ = QOI_OP_RUN | (run - 1);
+                run = 0;
+            }
+
+            unsigned hash = qoiHash(px);
+            if (index[hash].v == px.v) {
+                *p++ = QOI_OP_INDEX | hash;
+            } else {
+                index[hash] = px;
+
+                if (px.rgba.a == prev.rgba.a) {
+                    signed char vr = px.rgba.r - prev.rgba.r;
+                    signed char vg = px.rgba.g - prev.rgba.g;
+                    signed char vb = px.rgba.b - prev.rgba.b;
+                    signed char vg_r = vr - vg;
+                    signed char vg_b = vb - vg;
+
+                    if (vr > -3 && vr < 2 &&
+                        vg > -3 && vg < 2 &&
+                        vb > -3 && vb < 2) {
+                        *p++ = QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
+                    } else if (vg_r > -9 && vg_r < 8 &&
+                               vg > -33 && vg < 32 &&
+                               vg_b > -9 && vg_b < 8) {
+                        *p++ = QOI_OP_LUMA | (vg + 32);
+                        *p++ = (vg_r + 8) << 4 | (vg_b + 8);
+                    } else {
+                        *p++ = QOI_OP_RGB;
+                        *p++ = px.rgba.r;
+                        *p++ = px.rgba.g;
+                        *p++ = px.rgba.b;
+                    }
+                } else {
+                    *p++ = QOI_OP_RGBA;
+                    *p++ = px.rgba.r;
+                    *p++ = px.rgba.g;
+                    *p++ = px.rgba.b;
+                    *p++ = px.rgba.a;
+                }
+            }
+
+            prev = px;
+        }
+    }
+
+    if (run) {
+        *p++ = QOI_OP_RUN | (run - 1);
+    }
+
+    memcpy(p, qoiPadding, sizeof qoiPadding);
+    p += sizeof qoiPadding;
+
+    assert(p <= &buffer[0] + buffer.size());
+    os.write((const char *)&buffer[0], p - &buffer[0]);
+
+    return true;
+}
+
+
+bool
+Image::writeQOI(const char *filename) const
+{
+    if (channelType != TYPE_UNORM8 ||
+        (channels != 3 && channels != 4)) {
+        return false;
+    }
+
+    std::ofstream os(filename, std::ofstream::binary);
+    if (!os) {
+        return false;
+    }
+    return writeQOI(os);
+}
+
+
+Image *
+readQOI(const char *buffer, size_t size)
+{
+    const unsigned char *p = (const unsigned char *)buffer;
+    const unsigned char *end = p + size;
+
+    if (size < QOI_HEADER_SIZE + sizeof qoiPadding ||
+        memcmp(p, "qoif", 4) != 0) {
+        return NULL;
+    }
+
+    unsigned width = qoiRead32(p + 4);
+    unsigned height = qoiRead32(p + 8);
+    unsigned channels = p[12];
+    if (!width || !height ||
+        (channels != 3 && channels != 4) ||
+        (size_t)width * height > (size_t)400000000) {
+        return NULL;
+    }
+    p += QOI_HEADER_SIZE;
+
+    // The padding is never part of an op
+    end -= sizeof qoiPadding;
+
+    Image *image = new Image(width, height, channels);
+
+    QOIPixel index[64];
+    memset(index, 0, sizeof index);
+
+    QOIPixel px;
+    px.rgba.r = 0;
+    px.rgba.g = 0;
+    px.rgba.b = 0;
+    px.rgba.a = 255;
+
+    unsigned run = 0;
+
+    unsigned char *dst = image->pixels;
+    unsigned char *dstEnd = dst + (size_t)width * height * channels;
+    while (dst < dstEnd) {
+        if (run) {
+            --run;
+        } else if (p < end) {
+            unsigned char b1 = *p++;
+
+            if (b1 == QOI_OP_RGB) {
+                if (end - p < 3) {
+                    break;
+                }
+                px.rgba.r = p[0];
+                px.rgba.g = p[1];
+                px.rgba.b = p[2];
+                p += 3;
+            } else if (b1 == QOI_OP_RGBA) {
+                if (end - p < 4) {
+                    break;
+                }
+                px.rgba.r = p[0];
+                px.rgba.g = p[1];
+                px.rgba.b = p[2];
+                px.rgba.a = p[3];
+                p += 4;
+            } else if ((b1 & QOI_MASK_2) == QOI_OP_INDEX) {
+                px = index[b1];
+            } else if ((b1 & QOI_MASK_2) == QOI_OP_DIFF) {
+                px.rgba.r += ((b1 >> 4) & 0x03) - 2;
+                px.rgba.g += ((b1 >> 2) & 0x03) - 2;
+                px.rgba.b += ( b1       & 0x03) - 2;
+            } else if ((b1 & QOI_MASK_2) == QOI_OP_LUMA) {
+                if (p >= end) {
+                    break;
+                }
+                unsigned char b2 = *p++;
+                int vg = (b1 & 0x3f) - 32;
+                px.rgba.r += vg - 8 + ((b2 >> 4) & 0x0f);
+                px.rgba.g += vg;
+                px.rgba.b += vg - 8 +  (b2       & 0x0f);
+            } else {
+                assert((b1 & QOI_MASK_2) == QOI_OP_RUN);
+                run = b1 & 0x3f;
+            }
+
+            index[qoiHash(px)] = px;
+        } else {
+            // Truncated stream
+            break;
+        }
+
+        dst[0] = px.rgba.r;
+        dst[1] = px.rgba.g;
+        dst[2] = px.rgba.b;
+        if (channels == 4) {
+            dst[3] = px.rgba.a;
+        }
+        dst += channels;
+    }
+
+    if (dst < dstEnd) {
+        delete image;
+        return NULL;
+    }
+
+    return image;
+}
+
+
+Image *
+readQOI(std::istream &is)
+{
+    std::vector<char> buffer((std::istreambuf_iterator<char>(is)),
+                             std::istreambuf_iterator<char>());
+    if (buffer.empty()) {
+        return NULL;
+    }
+    return readQOI(&buffer[0], buffer.size());
+}
+
+
+Image *
+readQOI(const char *filename)
+{
+    std::ifstream is(filename, std::ifstream::binary);
+    if (!is) {
+        return NULL;
+    }
+    return readQOI(is);
+}
+
+
+} /* namespace image */
@@ -0,0 +1,316 @@
+##########################################################################
+#
+# Copyright 2014 VMware, Inc.
+# All Rights Reserved.
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+# THE SOFTWARE.
+#
+##########################################################################/
+
+
+"""Generate a no-op OpenGL implementation, used by glretrace --driver=null.
+
+Most functions do nothing at all.  Buffer objects are emulated just enough
+for mappings to work, object names are handed out from a counter, and
+status queries report success, so that the replay goes through the same
+code paths as it would with a real driver.
+"""
+
+
+# Adjust path
+import os.path
+import sys
+sys.path.insert(0, os.path.join(os.path.dirname(__file__), '..'))
+
+
+import specs.stdapi as stdapi
+from specs.glapi import glapi
+from specs.glesapi import glesapi
+
+
+class NullGenerator:
+
+    def stubName(self, function):
+        return '_null_' + function.name
+
+    def generateFunction(self, function):
+        print 'static ' + function.prototype(self.stubName(function)) + ' {'
+        self.generateBody(function)
+        print '}'
+        print
+
+    def generateBody(self, function):
+        name = function.name
+        argNames = function.argNames()
+
+        if 'buffer' in argNames:
+            buffer = 'namedBuffer(buffer)'
+        elif 'target' in argNames:
+            buffer = 'boundBuffer(target)'
+        else:
+            buffer = None
+
+        if name.startswith('glBindBuffer') and buffer is not None:
+            print '    bindBuffer(target, buffer);'
+            return
+
+        if name in ('glBufferData', 'glBufferDataARB', 'glNamedBufferDataEXT'):
+            print '    bufferData(%s, size);' % buffer
+            return
+
+        if name in ('glDeleteBuffers', 'glDeleteBuffersARB'):
+            print '    for (GLsizei i = 0; i < n; ++i) {'
+            print '        deleteBuffer(%s[i]);' % function.args[1].name
+            print '    }'
+            return
+
+        if name.startswith('glMap') and 'Buffer' in name and buffer is not None:
+            if 'length' in argNames:
+                print '    return mapBuffer(%s, offset, length);' % buffer
+            else:
+                print '    return mapBuffer(%s, 0, -1);' % buffer
+            return
+
+        if name.startswith('glUnmap') and 'Buffer' in name and buffer is not None:
+            if function.type is stdapi.Void:
+                print '    unmapBuffer(%s);' % buffer
+            else:
+                print '    return unmapBuffer(%s);' % buffer
+            return
+
+        if name in ('glGetBufferParameteriv', 'glGetBufferParameterivARB', 'glGetNamedBufferParameterivEXT'):
+            print '    *params = getBufferParameter(%s, pname);' % buffer
+            return
+
+        if name in ('glGetBufferPointerv', 'glGetBufferPointervARB', 'glGetBufferPointervOES', 'glGetNamedBufferPointervEXT'):
+            print '    *params = getBufferPointer(%s, pname);' % buffer
+            return
+
+        if name in ('glGetString', 'glGetStringi'):
+            print '    return (const GLubyte *)"";'
+            return
+
+        if name.startswith('glCheck') and name.find('FramebufferStatus') >= 0:
+            print '    return GL_FRAMEBUFFER_COMPLETE;'
+            return
+
+        if name in ('glGetShaderiv', 'glGetProgramiv', 'glGetObjectParameterivARB'):
+            print '    *params = isStatus(pname) ? GL_TRUE : 0;'
+            return
+
+        if name == 'glGenLists':
+            print '    GLuint first = nextName;'
+            print '    nextName += range;'
+            print '    return first;'
+            return
+
+        if name.startswith('glGen') and len(function.args) == 2 and function.args[1].output:
+            print '    for (GLsizei i = 0; i < %s; ++i) {' % function.args[0].name
+            print '        %s[i] = nextName++;' % function.args[1].name
+            print '    }'
+            return
+
+        if name.startswith('glCreate') and \
+           function.type is not stdapi.Void and \
+           not isinstance(function.type, (stdapi.Pointer, stdapi.Opaque)) and \
+           function.type.expr != 'GLsync':
+            if function.type.expr == 'GLhandleARB':
+                # GLhandleARB is a pointer on MacOSX
+                print '    return (GLhandleARB)(size_t)nextName++;'
+            else:
+                print '    return nextName++;'
+            return
+
+        if function.type is not stdapi.Void:
+            print '    return 0;'
+
+    def generateTable(self, functions):
+        print 'static const ProcEntry'
+        print 'procEntries[] = {'
+        for function in functions:
+            print '    {"%s", (void *)&%s},' % (function.name, self.stubName(function))
+        print '};'
+        print
+
+
+if __name__ == '__main__':
+    print r'''
+#include <stdlib.h>
+#include <string.h>
+
+#include <map>
+
+#include "glimports.hpp"
+#include "glretrace.hpp"
+
+
+namespace glretrace {
+
+
+struct NullBuffer {
+    GLsizeiptr size;
+    char *data;
+    bool mapped;
+    GLintptr mapOffset;
+};
+
+typedef std::map<GLuint, NullBuffer> NullBufferMap;
+static NullBufferMap buffers;
+
+typedef std::map<GLenum, GLuint> NullBindingMap;
+static NullBindingMap bufferBindings;
+
+static GLuint nextName = 1;
+
+
+static NullBuffer *
+namedBuffer(GLuint name) {
+    NullBufferMap::iterator it = buffers.find(name);
+    if (it == buffers.end()) {
+        NullBuffer buffer;
+        buffer.size = 0;
+        buffer.data = NULL;
+        buffer.mapped = false;
+        buffer.mapOffset = 0;
+        it = buffers.insert(NullBufferMap::value_type(name, buffer)).first;
+    }
+    return &it->second;
+}
+
+static NullBuffer *
+boundBuffer(GLenum target) {
+    NullBindingMap::iterator it = bufferBindings.find(target);
+    if (it == bufferBindings.end() || !it->second) {
+        return NULL;
+    }
+    return namedBuffer(it->second);
+}
+
+static void
+bindBuffer(GLenum target, GLuint buffer) {
+    bufferBindings[target] = buffer;
+}
+
+static void
+deleteBuffer(GLuint name) {
+    NullBufferMap::iterator it = buffers.find(name);
+    if (it != buffers.end()) {
+        free(it->second.data);
+        buffers.erase(it);
+    }
+}
+
+static void
+bufferData(NullBuffer *buffer, GLsizeiptr size) {
+    if (buffer) {
+        buffer->data = (char *)realloc(buffer->data, size > 0 ? size : 1);
+        buffer->size = size;
+        buffer->mapped = false;
+    }
+}
+
+static void *
+mapBuffer(NullBuffer *buffer, GLintptr offset, GLsizeiptr length) {
+    if (!buffer || !buffer->data || offset < 0 || offset > buffer->size) {
+        return NULL;
+    }
+    if (length > buffer->size - offset) {
+        return NULL;
+    }
+    buffer->mapped = true;
+    buffer->mapOffset = offset;
+    return buffer->data + offset;
+}
+
+static GLboolean
+unmapBuffer(NullBuffer *buffer) {
+    if (!buffer || !buffer->mapped) {
+        return GL_FALSE;
+    }
+    buffer->mapped = false;
+    return GL_TRUE;
+}
+
+static GLint
+getBufferParameter(NullBuffer *buffer, GLenum pname) {
+    if (!buffer) {
+        return 0;
+    }
+    switch (pname) {
+    case GL_BUFFER_SIZE:
+        return (GLint)buffer->size;
+    case GL_BUFFER_MAPPED:
+        return buffer->mapped;
+    default:
+        return 0;
+    }
+}
+
+static GLvoid *
+getBufferPointer(NullBuffer *buffer, GLenum pname) {
+    if (!buffer || !buffer->mapped || pname != GL_BUFFER_MAP_POINTER) {
+        return NULL;
+    }
+    return buffer->data + buffer->mapOffset;
+}
+
+static inline bool
+isStatus(GLenum pname) {
+    return pname == GL_COMPILE_STATUS ||
+           pname == GL_LINK_STATUS ||
+           pname == GL_VALIDATE_STATUS;
+}
+
+
+struct ProcEntry {
+    const char *name;
+    void *proc;
+};
+
+static int
+compareProcEntry(const void *key, const void *entry) {
+    return strcmp((const char *)key, ((const ProcEntry *)entry)->name);
+}
+
+'''
+
+    functions = {}
+    for module in (glapi, glesapi):
+        for function in module.functions:
+            functions.setdefault(function.name, function)
+    functions = [functions[name] for name in sorted(functions.keys())]
+
+    generator = NullGenerator()
+    for function in functions:
+        generator.generateFunction(function)
+    generator.generateTable(functions)
+
+    print r'''
+void *
+getNullProcAddress(const char *procName) {
+    const ProcEntry *entry = (const ProcEntry *)bsearch(
+        procName, procEntries,
+        sizeof procEntries / sizeof procEntries[0], sizeof procEntries[0],
+        compareProcEntry);
+    return entry ? entry->proc : NULL;
+}
+
+
+} /* namespace glretrace */
+'''
@@ -32,12 +32,15 @@
 
 namespace glretrace {
 
+struct ContextQueries;
+
 struct Context {
     Context(glws::Context* context)
         : wsContext(context),
           drawable(0),
           activeProgram(0),
-          used(false)
+          used(false),
+          queries(0)
     {
     }
 
@@ -50,6 +53,9 @@ struct Context {
 
     GLuint activeProgram;
     bool used;
+
+    // Pending profiling queries
+    ContextQueries *queries;
     
     // Context must be current
     inline bool
@@ -105,9 +111,13 @@ void initContext();
 void updateDrawable(int width, int height);
 
 void flushQueries();
+void destroyQueries(Context *context);
 void beginProfile(trace::Call &call, bool isDraw);
 void endProfile(trace::Call &call, bool isDraw);
 
+/* No-op OpenGL implementation for --driver=null, generated by glnull.py */
+void *getNullProcAddress(const char *procName);
+
 } /* namespace glretrace */
 
 
@@ -25,8 +25,8 @@
  *
  **************************************************************************/
 
-
 #include <string.h>
+#include <vector>
 
 #include "retrace.hpp"
 #include "glproc.hpp"
@@ -54,9 +54,15 @@ enum {
     NUM_QUERIES,
 };
 
+/* Number of frames query results may lag behind the replay */
+#define QUERY_FRAME_LATENCY 3
+
+/* Number of query names to generate at once when a pool runs dry */
+#define QUERY_POOL_GROWTH 64
+
 struct CallQuery
 {
-    GLuint ids[NUM_QUERIES];
+    GLuint ids[NUM_QUERIES]; /* zero when unused */
     unsigned call;
     bool isDraw;
     GLuint program;
@@ -74,7 +80,62 @@ static bool supportsTimestamp = true;
 static bool supportsOcclusion = true;
 static bool supportsDebugOutput = true;
 
-static std::list<CallQuery> callQueries;
+typedef std::vector<CallQuery> CallQueries;
+
+/*
+ * Profiling queries of a context, as query objects are not shared between
+ * contexts.
+ */
+struct ContextQueries
+{
+    /*
+     * Ring of per-frame query lists.  The last slot in use collects the
+     * queries of the frame being replayed, while the preceding ones hold
+     * ended frames whose results are read once available, or at the latest
+     * after QUERY_FRAME_LATENCY frames.
+     */
+    CallQueries frames[QUERY_FRAME_LATENCY + 1];
+    unsigned oldestFrame;
+    unsigned pendingFrames;
+
+    /*
+     * Recycled query names, one pool per query type, since a query object's
+     * target is fixed on first use.
+     */
+    std::vector<GLuint> pool[NUM_QUERIES];
+
+    ContextQueries() :
+        oldestFrame(0),
+        pendingFrames(0)
+    {}
+
+    inline CallQueries &
+    current(void) {
+        return frames[(oldestFrame + pendingFrames) % (QUERY_FRAME_LATENCY + 1)];
+    }
+};
+
+/* For calls made while no context is current, which never issue queries */
+static ContextQueries noContextQueries;
+
+static unsigned long long queryNamesGenerated = 0;
+static unsigned long long queryStalls = 0;
+
+static ContextQueries &
+getQueries(Context *context) {
+    if (!context) {
+        return noContextQueries;
+    }
+    if (!context->queries) {
+        context->queries = new ContextQueries;
+    }
+    return *context->queries;
+}
+
+static inline ContextQueries &
+currentQueries(void) {
+    return getQueries(getCurrentContext());
+}
 
 static void APIENTRY
 debugOutputCallback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar* message, GLvoid* userParam);
@@ -155,21 +216,60 @@ getCurrentRss(int64_t& rss) {
     rss = os::getRss();
 }
 
+static GLuint
+allocQuery(ContextQueries &queries, unsigned type) {
+    std::vector<GLuint> &pool = queries.pool[type];
+    if (pool.empty()) {
+        pool.resize(QUERY_POOL_GROWTH);
+        glGenQueries(QUERY_POOL_GROWTH, &pool[0]);
+        queryNamesGenerated += QUERY_POOL_GROWTH;
+    }
+    GLuint id = pool.back();
+    pool.pop_back();
+    return id;
+}
+
 static void
-completeCallQuery(CallQuery& query) {
+releaseQueries(ContextQueries &queries, CallQuery& query) {
+    for (unsigned type = 0; type < NUM_QUERIES; ++type) {
+        if (query.ids[type]) {
+            queries.pool[type].push_back(query.ids[type]);
+        }
+    }
+}
+
+static bool
+isQueryAvailable(const CallQueries &queries) {
+    /* Results become available in order, so check the newest first */
+    for (CallQueries::const_reverse_iterator itr = queries.rbegin(); itr != queries.rend(); ++itr) {
+        for (unsigned type = 0; type < NUM_QUERIES; ++type) {
+            if (itr->ids[type]) {
+                GLuint available = GL_FALSE;
+                glGetQueryObjectuiv(itr->ids[type], GL_QUERY_RESULT_AVAILABLE, &available);
+                if (!available) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+static void
+completeCallQuery(ContextQueries &queries, CallQuery& query) {
     /* Get call start and duration */
     int64_t gpuStart = 0, gpuDuration = 0, cpuDuration = 0, pixels = 0, vsizeDuration = 0, rssDuration = 0;
 
     if (query.isDraw) {
-        if (retrace::profilingGpuTimes) {
-            if (supportsTimestamp) {
-                glGetQueryObjecti64vEXT(query.ids[GPU_START], GL_QUERY_RESULT, &gpuStart);
-            }
+        if (query.ids[GPU_START]) {
+            glGetQueryObjecti64vEXT(query.ids[GPU_START], GL_QUERY_RESULT, &gpuStart);
+        }
 
+        if (query.ids[GPU_DURATION]) {
             glGetQueryObjecti64vEXT(query.ids[GPU_DURATION], GL_QUERY_RESULT, &gpuDuration);
         }
 
-        if (retrace::profilingPixelsDrawn) {
+        if (query.ids[OCCLUSION]) {
             glGetQueryObjecti64vEXT(query.ids[OCCLUSION], GL_QUERY_RESULT, &pixels);
         }
 
@@ -188,59 +288,141 @@ completeCallQuery(CallQuery& query) {
         rssDuration = query.rssEnd - query.rssStart;
     }
 
-    glDeleteQueries(NUM_QUERIES, query.ids);
+    releaseQueries(queries, query);
 
     /* Add call to profile */
     retrace::profiler.addCall(query.call, query.sig->name, query.program, pixels, gpuStart, gpuDuration, query.cpuStart, cpuDuration, query.vsizeStart, vsizeDuration, query.rssStart, rssDuration);
 }
 
+static void
+completeQueries(ContextQueries &queries, CallQueries &calls) {
+    for (CallQueries::iterator itr = calls.begin(); itr != calls.end(); ++itr) {
+        completeCallQuery(queries, *itr);
+    }
+
+    calls.clear();
+}
+
+/**
+ * Complete the oldest ended frames, as long as their results are available,
+ * or unconditionally when more than `latency` frames are pending.
+ */
+static void
+completeFrames(ContextQueries &queries, unsigned latency) {
+    while (queries.pendingFrames) {
+        CallQueries &calls = queries.frames[queries.oldestFrame];
+
+        if (!isQueryAvailable(calls)) {
+            if (queries.pendingFrames <= latency) {
+                break;
+            }
+            ++queryStalls;
+        }
+
+        completeQueries(queries, calls);
+        retrace::profiler.addFrameEnd();
+
+        queries.oldestFrame = (queries.oldestFrame + 1) % (QUERY_FRAME_LATENCY + 1);
+        --queries.pendingFrames;
+    }
+}
+
+static void
+flushQueries(ContextQueries &queries) {
+    completeFrames(queries, 0);
+    completeQueries(queries, queries.current());
+}
+
+/**
+ * Complete the queries of the current context.  Must be called before
+ * another context is made current, as results can only be read from the
+ * context which issued the queries.
+ */
 void
 flushQueries() {
-    for (std::list<CallQuery>::iterator itr = callQueries.begin(); itr != callQueries.end(); ++itr) {
-        completeCallQuery(*itr);
+    flushQueries(noContextQueries);
+    flushQueries(currentQueries());
+}
+
+void
+destroyQueries(Context *context) {
+    ContextQueries *queries = context->queries;
+    if (!queries) {
+        return;
+    }
+
+    if (context == getCurrentContext()) {
+        flushQueries(*queries);
+        for (unsigned type = 0; type < NUM_QUERIES; ++type) {
+            if (!queries->pool[type].empty()) {
+                glDeleteQueries(queries->pool[type].size(), &queries->pool[type][0]);
+            }
+        }
+    } else {
+        /*
+         * The results can't be read without the context, so record the
+         * calls without them.  This shouldn't happen, as makeCurrent()
+         * flushes the queries before switching contexts.
+         */
+        for (unsigned i = 0; i <= QUERY_FRAME_LATENCY; ++i) {
+            CallQueries &calls = queries->frames[i];
+            for (CallQueries::iterator itr = calls.begin(); itr != calls.end(); ++itr) {
+                for (unsigned type = 0; type < NUM_QUERIES; ++type) {
+                    itr->ids[type] = 0;
+                }
+            }
+        }
+        completeFrames(*queries, 0);
+        completeQueries(*queries, queries->current());
     }
 
-    callQueries.clear();
+    delete queries;
+    context->queries = NULL;
 }
 
 void
 beginProfile(trace::Call &call, bool isDraw) {
     glretrace::Context *currentContext = glretrace::getCurrentContext();
+    ContextQueries &queries = getQueries(currentContext);
 
     /* Create call query */
     CallQuery query;
+    query.ids[GPU_START] = 0;
+    query.ids[GPU_DURATION] = 0;
+    query.ids[OCCLUSION] = 0;
     query.isDraw = isDraw;
     query.call = call.no;
     query.sig = call.sig;
     query.program = currentContext ? currentContext->activeProgram : 0;
 
-    glGenQueries(NUM_QUERIES, query.ids);
-
     /* GPU profiling only for draw calls */
     if (isDraw) {
         if (retrace::profilingGpuTimes) {
             if (supportsTimestamp) {
+                query.ids[GPU_START] = allocQuery(queries, GPU_START);
                 glQueryCounter(query.ids[GPU_START], GL_TIMESTAMP);
             }
 
+            query.ids[GPU_DURATION] = allocQuery(queries, GPU_DURATION);
             glBeginQuery(GL_TIME_ELAPSED, query.ids[GPU_DURATION]);
         }
 
         if (retrace::profilingPixelsDrawn) {
+            query.ids[OCCLUSION] = allocQuery(queries, OCCLUSION);
             glBeginQuery(GL_SAMPLES_PASSED, query.ids[OCCLUSION]);
         }
     }
 
-    callQueries.push_back(query);
+    queries.current().push_back(query);
 
     /* CPU profiling for all calls */
     if (retrace::profilingCpuTimes) {
-        CallQuery& query = callQueries.back();
+        CallQuery& query = queries.current().back();
         query.cpuStart = getCurrentTime();
     }
 
     if (retrace::profilingMemoryUsage) {
-        CallQuery& query = callQueries.back();
+        CallQuery& query = queries.current().back();
         query.vsizeStart = os::getVsize();
         query.rssStart = os::getRss();
     }
@@ -251,7 +433,7 @@ endProfile(trace::Call &call, bool isDraw) {
 
     /* CPU profiling for all calls */
     if (retrace::profilingCpuTimes) {
-        CallQuery& query = callQueries.back();
+        CallQuery& query = currentQueries().current().back();
         query.cpuEnd = getCurrentTime();
     }
 
@@ -267,7 +449,7 @@ endProfile(trace::Call &call, bool isDraw) {
     }
 
     if (retrace::profilingMemoryUsage) {
-        CallQuery& query = callQueries.back();
+        CallQuery& query = currentQueries().current().back();
         query.vsizeEnd = os::getVsize();
         query.rssEnd = os::getRss();
     }
@@ -339,11 +521,13 @@ initContext() {
 void
 frame_complete(trace::Call &call) {
     if (retrace::profiling) {
-        /* Complete any remaining queries */
-        flushQueries();
-
-        /* Indicate end of current frame */
-        retrace::profiler.addFrameEnd();
+        /*
+         * End the current frame, and complete those ended frames whose
+         * results are ready without waiting for the GPU.
+         */
+        ContextQueries &queries = currentQueries();
+        ++queries.pendingFrames;
+        completeFrames(queries, QUERY_FRAME_LATENCY);
     }
 
     retrace::frameComplete(call);
@@ -452,7 +636,12 @@ static GLDumper glDumper;
 
 void
 retrace::setUp(void) {
-    glws::init();
+    if (retrace::driver == retrace::DRIVER_NULL) {
+        // Route all OpenGL calls to the no-op implementation
+        _getProcAddressOverride = &glretrace::getNullProcAddress;
+    } else {
+        glws::init();
+    }
     dumper = &glDumper;
 }
 
@@ -484,6 +673,9 @@ retrace::waitForInput(void) {
         glretrace::flushQueries();
         glFlush();
     }
+    if (retrace::driver == retrace::DRIVER_NULL) {
+        return;
+    }
     while (glws::processEvents()) {
         os::sleep(100*1000);
     }
@@ -491,5 +683,8 @@ retrace::waitForInput(void) {
 
 void
 retrace::cleanUp(void) {
-    glws::cleanup();
+    if ((retrace::profilingGpuTimes || retrace::profilingPixelsDrawn) && retrace::profilingStats) {
+        std::cerr << "Profiling: " << glretrace::queryNamesGenerated << " query names generated, "
+                  << glretrace::queryStalls << " frames waited on query results\n";
+    }
 }
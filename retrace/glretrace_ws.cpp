@@ -45,11 +45,24 @@ static glws::Visual *
 visuals[glws::PROFILE_MAX];
 
 
+/*
+ * Whether to use the null window system rather than the real one.
+ */
+static inline bool
+nullDriver(void) {
+    return retrace::driver == retrace::DRIVER_NULL;
+}
+
+
 inline glws::Visual *
 getVisual(glws::Profile profile) {
     glws::Visual * & visual = visuals[profile];
     if (!visual) {
-        visual = glws::createVisual(retrace::doubleBuffer, profile);
+        if (nullDriver()) {
+            visual = glws::null::createVisual(retrace::doubleBuffer, profile);
+        } else {
+            visual = glws::createVisual(retrace::doubleBuffer, profile);
+        }
         if (!visual) {
             std::cerr << "error: failed to create OpenGL visual\n";
             exit(1);
@@ -73,7 +86,12 @@ getDefaultProfile(void)
 static glws::Drawable *
 createDrawableHelper(glws::Profile profile, int width = 32, int height = 32, bool pbuffer = false) {
     glws::Visual *visual = getVisual(profile);
-    glws::Drawable *draw = glws::createDrawable(visual, width, height, pbuffer);
+    glws::Drawable *draw;
+    if (nullDriver()) {
+        draw = glws::null::createDrawable(visual, width, height, pbuffer);
+    } else {
+        draw = glws::createDrawable(visual, width, height, pbuffer);
+    }
     if (!draw) {
         std::cerr << "error: failed to create OpenGL drawable\n";
         exit(1);
@@ -105,7 +123,12 @@ Context *
 createContext(Context *shareContext, glws::Profile profile) {
     glws::Visual *visual = getVisual(profile);
     glws::Context *shareWsContext = shareContext ? shareContext->wsContext : NULL;
-    glws::Context *ctx = glws::createContext(visual, shareWsContext, profile, retrace::debug);
+    glws::Context *ctx;
+    if (nullDriver()) {
+        ctx = glws::null::createContext(visual, shareWsContext, profile, retrace::debug);
+    } else {
+        ctx = glws::createContext(visual, shareWsContext, profile, retrace::debug);
+    }
     if (!ctx) {
         std::cerr << "error: failed to create OpenGL context\n";
         exit(1);
@@ -124,6 +147,8 @@ createContext(Context *shareContext) {
 
 Context::~Context()
 {
+    destroyQueries(this);
+
     //assert(this != getCurrentContext());
     if (this != getCurrentContext()) {
         delete wsContext;
@@ -154,7 +179,13 @@ makeCurrent(trace::Call &call, glws::Drawable *drawable, Context *context)
 
     flushQueries();
 
-    bool success = glws::makeCurrent(drawable, context ? context->wsContext : NULL);
+    glws::Context *wsContext = context ? context->wsContext : NULL;
+    bool success;
+    if (nullDriver()) {
+        success = glws::null::makeCurrent(drawable, wsContext);
+    } else {
+        success = glws::makeCurrent(drawable, wsContext);
+    }
 
     if (!success) {
         std::cerr << "error: failed to make current OpenGL context and drawable\n";
@@ -174,6 +174,27 @@ bool
 processEvents(void);
 
 
+/*
+ * Window system that creates no windows nor contexts at all, to replay without
+ * a driver.
+ */
+namespace null {
+
+Visual *
+createVisual(bool doubleBuffer, Profile profile);
+
+Drawable *
+createDrawable(const Visual *visual, int width, int height, bool pbuffer);
+
+Context *
+createContext(const Visual *visual, Context *shareContext, Profile profile, bool debug);
+
+bool
+makeCurrent(Drawable *drawable, Context *context);
+
+} /* namespace null */
+
+
 } /* namespace glws */
 
 
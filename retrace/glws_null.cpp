@@ -0,0 +1,103 @@
+/**************************************************************************
+ *
+ * Copyright 2014 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * Null window system, which creates no windows nor contexts, so that
+ * glretrace --driver=null can replay without a display or a GPU.
+ */
+
+
+#include "glws.hpp"
+
+
+namespace glws {
+
+
+namespace null {
+
+
+class NullVisual : public Visual
+{
+public:
+    NullVisual(bool _doubleBuffer) {
+        redMask = 0x000000ff;
+        greenMask = 0x0000ff00;
+        blueMask = 0x00ff0000;
+        alphaMask = 0xff000000;
+        doubleBuffer = _doubleBuffer;
+    }
+};
+
+
+class NullDrawable : public Drawable
+{
+public:
+    NullDrawable(const Visual *vis, int w, int h, bool pbuffer) :
+        Drawable(vis, w, h, pbuffer)
+    {}
+
+    void
+    swapBuffers(void) {
+    }
+};
+
+
+class NullContext : public Context
+{
+public:
+    NullContext(const Visual *vis, Profile prof) :
+        Context(vis, prof)
+    {}
+};
+
+
+Visual *
+createVisual(bool doubleBuffer, Profile profile) {
+    return new NullVisual(doubleBuffer);
+}
+
+Drawable *
+createDrawable(const Visual *visual, int width, int height, bool pbuffer)
+{
+    return new NullDrawable(visual, width, height, pbuffer);
+}
+
+Context *
+createContext(const Visual *visual, Context *shareContext, Profile profile, bool debug)
+{
+    return new NullContext(visual, profile);
+}
+
+bool
+makeCurrent(Drawable *drawable, Context *context)
+{
+    return true;
+}
+
+
+} /* namespace null */
+
+
+} /* namespace glws */
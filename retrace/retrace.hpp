@@ -97,6 +97,11 @@ extern bool profilingGpuTimes;
 extern bool profilingPixelsDrawn;
 extern bool profilingMemoryUsage;
 
+/**
+ * Report profiling overheads on exit (set by -v in any position).
+ */
+extern bool profilingStats;
+
 /**
  * State dumping.
  */
@@ -0,0 +1,215 @@
+/**************************************************************************
+ *
+ * Copyright 2014 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * Open addressing hash map for integer keys.
+ */
+
+#ifndef _RETRACE_HASHMAP_HPP_
+#define _RETRACE_HASHMAP_HPP_
+
+
+#include <assert.h>
+#include <stddef.h>
+
+#include <vector>
+
+
+namespace retrace {
+
+
+/**
+ * Hash map from 64bit integers (handles, traced addresses) to small values.
+ *
+ * Slots are kept in a single flat array and collisions are resolved by
+ * linear probing, so most lookups touch a single cache line.  Erasing shifts
+ * the following slots back instead of leaving tombstones behind, so lookups
+ * don't degrade as objects are created and destroyed.
+ */
+template <class V>
+class HashMap
+{
+public:
+    typedef unsigned long long key_type;
+
+private:
+    struct Slot
+    {
+        key_type key;
+        V value;
+        bool used;
+    };
+
+    std::vector<Slot> slots;
+    size_t count;
+    unsigned shift;
+
+    inline size_t
+    home(key_type key) const {
+        // Fibonacci hashing
+        return (size_t)((key * 0x9e3779b97f4a7c15ULL) >> shift);
+    }
+
+    inline size_t
+    mask(void) const {
+        return slots.size() - 1;
+    }
+
+    size_t
+    findSlot(key_type key) const {
+        size_t i = home(key);
+        while (slots[i].used) {
+            if (slots[i].key == key) {
+                return i;
+            }
+            i = (i + 1) & mask();
+        }
+        return i;
+    }
+
+    void
+    rehash(size_t capacity) {
+        std::vector<Slot> old(capacity);
+        old.swap(slots);
+
+        shift = 64;
+        while (capacity > 1) {
+            capacity >>= 1;
+            --shift;
+        }
+
+        for (size_t j = 0; j < old.size(); ++j) {
+            if (old[j].used) {
+                slots[findSlot(old[j].key)] = old[j];
+            }
+        }
+    }
+
+public:
+    HashMap() :
+        count(0),
+        shift(64)
+    {}
+
+    inline size_t
+    size(void) const {
+        return count;
+    }
+
+    V *
+    find(key_type key) {
+        if (!count) {
+            return NULL;
+        }
+        Slot &slot = slots[findSlot(key)];
+        return slot.used ? &slot.value : NULL;
+    }
+
+    /**
+     * Lookup the value for key, inserting defaultValue if missing.
+     *
+     * The returned reference is invalidated by subsequent insertions or
+     * removals.
+     */
+    V &
+    lookup(key_type key, const V &defaultValue) {
+        if ((count + 1) * 2 > slots.size()) {
+            rehash(slots.empty() ? 16 : slots.size() * 2);
+        }
+
+        Slot &slot = slots[findSlot(key)];
+        if (!slot.used) {
+            slot.key = key;
+            slot.value = defaultValue;
+            slot.used = true;
+            ++count;
+        }
+        return slot.value;
+    }
+
+    void
+    erase(key_type key) {
+        if (!count) {
+            return;
+        }
+
+        size_t i = findSlot(key);
+        if (!slots[i].used) {
+            return;
+        }
+
+        // Move back any following slot which would otherwise become
+        // unreachable from its home slot.
+        size_t j = i;
+        while (true) {
+            j = (j + 1) & mask();
+            if (!slots[j].used) {
+                break;
+            }
+            size_t k = home(slots[j].key);
+            bool movable = i <= j ? (k <= i || k > j) : (k <= i && k > j);
+            if (movable) {
+                slots[i] = slots[j];
+                i = j;
+            }
+        }
+
+        slots[i].used = false;
+        slots[i].value = V();
+        --count;
+    }
+
+    /*
+     * Slot iteration, for the rare cases where all entries need to be
+     * visited.
+     */
+
+    inline size_t
+    capacity(void) const {
+        return slots.size();
+    }
+
+    inline bool
+    occupied(size_t i) const {
+        return slots[i].used;
+    }
+
+    inline key_type
+    keyAt(size_t i) const {
+        assert(slots[i].used);
+        return slots[i].key;
+    }
+
+    inline V &
+    valueAt(size_t i) {
+        assert(slots[i].used);
+        return slots[i].value;
+    }
+};
+
+
+} /* namespace retrace */
+
+#endif /* _RETRACE_HASHMAP_HPP_ */
@@ -28,6 +28,8 @@
 
 #include <string.h>
 #include <limits.h> // for CHAR_MAX
+#include <algorithm>
+#include <deque>
 #include <iostream>
 #include <getopt.h>
 #ifndef _WIN32
@@ -46,15 +48,20 @@
 
 static bool waitOnFinish = false;
 static bool loopOnFinish = false;
+static unsigned loopCount = 0;
+static unsigned loopFirstFrame = ~0U;
+static unsigned loopLastFrame = ~0U;
+static bool pipelineCalls = false;
+static bool profilingBinary = false;
 
 static const char *snapshotPrefix = NULL;
 static enum {
     PNM_FMT,
-    RAW_RGB
+    RAW_RGB,
+    QOI_FMT
 } snapshotFormat = PNM_FMT;
 
 static trace::CallSet snapshotFrequency;
-static trace::ParseBookmark lastFrameStart;
 
 static unsigned dumpStateCallNo = ~0;
 
@@ -83,6 +90,7 @@ bool profilingGpuTimes = false;
 bool profilingCpuTimes = false;
 bool profilingPixelsDrawn = false;
 bool profilingMemoryUsage = false;
+bool profilingStats = false;
 bool useCallNos = true;
 bool singleThread = false;
 
@@ -101,6 +109,218 @@ static Dumper defaultDumper;
 Dumper *dumper = &defaultDumper;
 
 
+/**
+ * Pool of threads encoding and writing snapshot images, so that the replay
+ * doesn't have to wait for zlib.
+ *
+ * Only a few images may be queued at a time, so that memory usage stays
+ * bounded when the replay outpaces the writers.
+ */
+class SnapshotWriter
+{
+private:
+    struct Job
+    {
+        image::Image *image;
+
+        /**
+         * File name, without extension.
+         */
+        os::String filename;
+    };
+
+    os::mutex mutex;
+    os::condition_variable not_empty_cond;
+    os::condition_variable not_full_cond;
+
+    /**
+     * These are protected by the mutex.
+     */
+    std::deque<Job> jobs;
+    size_t maxJobs;
+    bool stopped;
+
+    /**
+     * Images queued or being written.  Updated with the mutex held, but
+     * also read without it from the exception handler.
+     */
+    volatile size_t pending;
+
+    /**
+     * Serializes the messages printed by the writers.
+     */
+    os::mutex log_mutex;
+
+    std::vector<os::thread> threads;
+
+    static void *
+    writerThread(SnapshotWriter *_this);
+
+    void
+    runWriter(void);
+
+public:
+    SnapshotWriter(unsigned numThreads);
+
+    /**
+     * Write all queued images before returning.
+     */
+    ~SnapshotWriter();
+
+    /**
+     * Queue the image to be written, taking ownership of it, waiting for
+     * room in the queue if necessary.
+     */
+    void
+    write(image::Image *image, const os::String &filename);
+
+    /**
+     * Number of images not yet written, without locking.
+     */
+    size_t
+    unwritten(void) const {
+        return pending;
+    }
+};
+
+
+SnapshotWriter::SnapshotWriter(unsigned numThreads) :
+    maxJobs(2 * numThreads),
+    stopped(false),
+    pending(0)
+{
+    for (unsigned i = 0; i < numThreads; ++i) {
+        threads.push_back(os::thread(writerThread, this));
+    }
+}
+
+
+SnapshotWriter::~SnapshotWriter() {
+    mutex.lock();
+    stopped = true;
+    mutex.unlock();
+    not_empty_cond.signal();
+
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+    }
+
+    assert(jobs.empty());
+}
+
+
+void *
+SnapshotWriter::writerThread(SnapshotWriter *_this) {
+    _this->runWriter();
+    return 0;
+}
+
+
+void
+SnapshotWriter::runWriter(void) {
+    while (true) {
+        Job job;
+
+        {
+            os::unique_lock<os::mutex> lock(mutex);
+
+            while (!stopped && jobs.empty()) {
+                not_empty_cond.wait(lock);
+            }
+
+            if (jobs.empty()) {
+                assert(stopped);
+                break;
+            }
+
+            job = jobs.front();
+            jobs.pop_front();
+        }
+
+        not_full_cond.signal();
+
+        os::String filename = job.filename;
+        bool written = false;
+        if (snapshotFormat == QOI_FMT) {
+            /* Images QOI can't represent are still written as PNG */
+            filename.append(".qoi");
+            written = job.image->writeQOI(filename);
+            if (!written) {
+                filename = job.filename;
+            }
+        }
+        if (!written) {
+            filename.append(".png");
+            written = job.image->writePNG(filename);
+        }
+        delete job.image;
+
+        if (written && retrace::verbosity >= 0) {
+            log_mutex.lock();
+            std::cout << "Wrote " << filename << "\n";
+            log_mutex.unlock();
+        }
+
+        mutex.lock();
+        --pending;
+        mutex.unlock();
+    }
+
+    /* Wake the next writer, so that it notices too */
+    not_empty_cond.signal();
+}
+
+
+void
+SnapshotWriter::write(image::Image *image, const os::String &filename) {
+    Job job;
+    job.image = image;
+    job.filename = filename;
+
+    {
+        os::unique_lock<os::mutex> lock(mutex);
+
+        while (jobs.size() >= maxJobs) {
+            not_full_cond.wait(lock);
+        }
+
+        jobs.push_back(job);
+        ++pending;
+    }
+
+    not_empty_cond.signal();
+}
+
+
+static SnapshotWriter *snapshotWriter = NULL;
+
+
+/**
+ * Wait for all snapshots to be written.
+ *
+ * Also called at exit, so that the snapshots taken before the window system
+ * gives up still make it to disk.
+ */
+static void
+flushSnapshots(void) {
+    delete snapshotWriter;
+    snapshotWriter = NULL;
+}
+
+
+/**
+ * Number of snapshots taken but not yet written.
+ *
+ * Safe to call from the exception handler, where waiting for the writers
+ * could deadlock on locks held by the crashed thread.
+ */
+static size_t
+unwrittenSnapshots(void) {
+    SnapshotWriter *writer = snapshotWriter;
+    return writer ? writer->unwritten() : 0;
+}
+
+
 /**
  * Take snapshots.
  */
@@ -123,15 +343,25 @@ takeSnapshot(unsigned call_no) {
                      useCallNos ? call_no : snapshot_no);
             if (snapshotFormat == RAW_RGB)
                 src->writeRAW(std::cout);
-            else
+            else if (snapshotFormat != QOI_FMT || !src->writeQOI(std::cout))
                 src->writePNM(std::cout, comment);
         } else {
-            os::String filename = os::String::format("%s%010u.png",
+            os::String filename = os::String::format("%s%010u",
                                                      snapshotPrefix,
                                                      useCallNos ? call_no : snapshot_no);
-            if (src->writePNG(filename) && retrace::verbosity >= 0) {
-                std::cout << "Wrote " << filename << "\n";
+            if (!snapshotWriter) {
+                unsigned numThreads = os::thread::hardware_concurrency();
+                numThreads = numThreads > 1 ? std::min(numThreads - 1, 8U) : 1;
+                snapshotWriter = new SnapshotWriter(numThreads);
+
+                static bool registered = false;
+                if (!registered) {
+                    atexit(flushSnapshots);
+                    registered = true;
+                }
             }
+            snapshotWriter->write(src, filename);
+            src = NULL;
         }
     }
 
@@ -177,14 +407,388 @@ retraceCall(trace::Call *call) {
 
     if (call->no >= dumpStateCallNo &&
         dumper->dumpState(std::cout)) {
+        flushSnapshots();
         exit(0);
     }
 }
 
 
+/**
+ * Parse the next call.
+ */
+static inline trace::Call *
+parseCall(void) {
+    return parser.parse_call();
+}
+
+
+/**
+ * In-memory copy of the looped frames.
+ *
+ * Calls of the looped frames are kept after being replayed for the first
+ * time, and from then on replayed straight from memory, so that looping
+ * measures the time spent dispatching calls to the driver, and not the time
+ * spent decompressing and parsing the trace.
+ *
+ * Calls are released by whichever runner holds the baton, so there is never
+ * more than one thread using the cache at a time.
+ */
+class FrameCache
+{
+private:
+    std::vector<trace::Call *> calls;
+
+    /**
+     * Whether calls are being served from the cache.
+     */
+    bool replaying;
+
+    /**
+     * Frame of the next call released while recording.
+     */
+    unsigned frame;
+
+    /**
+     * When looping the final frame, the cached calls are discarded as soon
+     * as another frame starts.
+     */
+    bool clearPending;
+
+    size_t position;
+    unsigned frameCount;
+    long long iterationStart;
+    std::vector<long long> iterationTimes;
+
+    inline bool
+    lastFrameOnly(void) const {
+        return loopFirstFrame == ~0U;
+    }
+
+    void
+    clear(void) {
+        for (size_t i = 0; i < calls.size(); ++i) {
+            delete calls[i];
+        }
+        calls.clear();
+    }
+
+public:
+    FrameCache() :
+        replaying(false),
+        frame(0),
+        clearPending(false),
+        position(0),
+        frameCount(0),
+        iterationStart(0)
+    {}
+
+    ~FrameCache() {
+        clear();
+    }
+
+    inline bool
+    isReplaying(void) const {
+        return replaying;
+    }
+
+    /**
+     * Stop recording, and start replaying the cached calls.
+     */
+    void
+    startReplay(void) {
+        assert(!replaying);
+        replaying = true;
+        position = 0;
+        frameCount = 0;
+        for (size_t i = 0; i < calls.size(); ++i) {
+            if (calls[i]->flags & trace::CALL_FLAG_END_FRAME) {
+                ++frameCount;
+            }
+        }
+        if (calls.empty()) {
+            std::cerr << "warning: no frames to loop\n";
+        }
+    }
+
+    /**
+     * Next cached call, or NULL once all iterations are done.
+     */
+    trace::Call *
+    getCall(void) {
+        assert(replaying);
+
+        if (calls.empty()) {
+            return NULL;
+        }
+
+        if (position == calls.size()) {
+            iterationTimes.push_back(os::getTime() - iterationStart);
+            position = 0;
+            if (loopCount && iterationTimes.size() >= loopCount) {
+                return NULL;
+            }
+        }
+
+        if (position == 0) {
+            iterationStart = os::getTime();
+        }
+
+        return calls[position++];
+    }
+
+    /**
+     * Take ownership of a call which has just been replayed.
+     */
+    void
+    releaseCall(trace::Call *call) {
+        if (replaying) {
+            /* Calls from the cache are kept */
+            return;
+        }
+
+        bool endFrame = call->flags & trace::CALL_FLAG_END_FRAME;
+
+        if (lastFrameOnly()) {
+            if (clearPending) {
+                clear();
+                clearPending = false;
+            }
+            calls.push_back(call);
+        } else if (frame >= loopFirstFrame && frame <= loopLastFrame) {
+            calls.push_back(call);
+        } else {
+            delete call;
+        }
+
+        if (endFrame) {
+            if (lastFrameOnly()) {
+                clearPending = true;
+            } else if (frame == loopLastFrame) {
+                startReplay();
+            }
+            ++frame;
+        }
+    }
+
+    void
+    dumpStatistics(void) {
+        for (size_t i = 0; i < iterationTimes.size(); ++i) {
+            float timeInterval = iterationTimes[i] * (1.0 / os::timeFrequency);
+            std::cout <<
+                "Loop " << (i + 1) << ": " << frameCount << " frames"
+                " in " << timeInterval << " secs";
+            if (frameCount) {
+                std::cout << ", " << (timeInterval * 1000.0 / frameCount) << " ms per frame";
+            }
+            std::cout << "\n";
+        }
+    }
+};
+
+
+static FrameCache *frameCache = NULL;
+
+
+/**
+ * Bounded queue of calls, filled ahead of the replay by a dedicated parser
+ * thread, so that the time spent decompressing and parsing the trace is not
+ * added to the time spent in the driver.
+ *
+ * Calls are consumed in order by whichever runner holds the baton, so there
+ * is never more than one consumer at a time.
+ */
+class CallPipeline
+{
+private:
+    enum {
+        DEPTH = 256
+    };
+
+    os::mutex mutex;
+    os::condition_variable not_empty_cond;
+    os::condition_variable not_full_cond;
+
+    /**
+     * There are protected by the mutex.
+     */
+    trace::Call *calls[DEPTH];
+    unsigned head;
+    unsigned count;
+    bool finished;
+    bool stopped;
+
+    os::thread thread;
+
+    static void *
+    parserThread(CallPipeline *_this);
+
+    void
+    runParser(void);
+
+public:
+    CallPipeline() :
+        head(0),
+        count(0),
+        finished(false),
+        stopped(false)
+    {
+        thread = os::thread(parserThread, this);
+    }
+
+    ~CallPipeline();
+
+    /**
+     * Get the next parsed call, waiting for it if necessary, or NULL at the
+     * end of the trace.
+     */
+    trace::Call *
+    getCall(void);
+};
+
+
+void *
+CallPipeline::parserThread(CallPipeline *_this) {
+    _this->runParser();
+    return 0;
+}
+
+
+void
+CallPipeline::runParser(void) {
+    while (true) {
+        trace::Call *call = parseCall();
+
+        os::unique_lock<os::mutex> lock(mutex);
+
+        while (!stopped && count == DEPTH) {
+            not_full_cond.wait(lock);
+        }
+
+        if (stopped) {
+            delete call;
+            break;
+        }
+
+        if (!call) {
+            finished = true;
+            not_empty_cond.signal();
+            break;
+        }
+
+        calls[(head + count) % DEPTH] = call;
+        if (count++ == 0) {
+            not_empty_cond.signal();
+        }
+    }
+}
+
+
+trace::Call *
+CallPipeline::getCall(void) {
+    os::unique_lock<os::mutex> lock(mutex);
+
+    while (!finished && count == 0) {
+        not_empty_cond.wait(lock);
+    }
+
+    if (count == 0) {
+        assert(finished);
+        return NULL;
+    }
+
+    trace::Call *call = calls[head];
+    head = (head + 1) % DEPTH;
+    if (count-- == DEPTH) {
+        not_full_cond.signal();
+    }
+
+    return call;
+}
+
+
+CallPipeline::~CallPipeline() {
+    mutex.lock();
+    stopped = true;
+    mutex.unlock();
+    not_full_cond.signal();
+
+    thread.join();
+
+    while (count) {
+        delete calls[head];
+        head = (head + 1) % DEPTH;
+        --count;
+    }
+}
+
+
+static CallPipeline *pipeline = NULL;
+
+
+/**
+ * Get the next call to retrace.
+ */
+static inline trace::Call *
+nextCall(void) {
+    if (frameCache && frameCache->isReplaying()) {
+        return frameCache->getCall();
+    }
+
+    trace::Call *call;
+    if (pipeline) {
+        call = pipeline->getCall();
+    } else {
+        call = parseCall();
+    }
+
+    if (!call && frameCache) {
+        /* Reached the end of the trace, so loop what was recorded */
+        frameCache->startReplay();
+        call = frameCache->getCall();
+    }
+
+    return call;
+}
+
+
+/**
+ * Dispose of a call after it has been retraced.
+ */
+static inline void
+releaseCall(trace::Call *call) {
+    if (frameCache) {
+        frameCache->releaseCall(call);
+    } else {
+        delete call;
+    }
+}
+
+
 class RelayRunner;
 
 
+/**
+ * How many times a runner polls for the baton before blocking.  Spinning
+ * only pays off when the passing thread can run concurrently, so it's
+ * disabled on single processor systems.
+ */
+#define RELAY_SPIN_COUNT 4096
+
+static unsigned relaySpinCount = 0;
+
+
+static inline void
+cpuRelax(void) {
+#if defined(_MSC_VER)
+    YieldProcessor();
+#elif defined(__i386__) || defined(__x86_64__)
+    __asm__ __volatile__ ("pause");
+#else
+    __asm__ __volatile__ ("" : : : "memory");
+#endif
+}
+
+
 /**
  * Implement multi-threading by mimicking a relay race.
  */
@@ -221,6 +825,9 @@ public:
 
     void
     stopRunners();
+
+    void
+    dumpStatistics(void);
 };
 
 
@@ -243,10 +850,23 @@ private:
     os::condition_variable wake_cond;
 
     /**
-     * There are protected by the mutex.
+     * These are protected by the mutex, but may be polled without it while
+     * spinning.
      */
-    bool finished;
-    trace::Call *baton;
+    volatile bool finished;
+    trace::Call * volatile baton;
+
+    /**
+     * Whether the runner is blocked on wake_cond.  Protected by the mutex.
+     */
+    bool parked;
+
+    /**
+     * Statistics, only updated by the runner itself.
+     */
+    unsigned long long handoffs;
+    unsigned long long spinHits;
+    unsigned long long parks;
 
     os::thread thread;
 
@@ -258,7 +878,11 @@ public:
         race(race),
         leg(_leg),
         finished(false),
-        baton(0)
+        baton(0),
+        parked(false),
+        handoffs(0),
+        spinHits(0),
+        parks(0)
     {
         /* The fore runner does not need a new thread */
         if (leg) {
@@ -277,21 +901,8 @@ public:
      */
     void
     runRace(void) {
-        os::unique_lock<os::mutex> lock(mutex);
-
-        while (1) {
-            while (!finished && !baton) {
-                wake_cond.wait(lock);
-            }
-
-            if (finished) {
-                break;
-            }
-
-            assert(baton);
-            trace::Call *call = baton;
-            baton = 0;
-
+        trace::Call *call;
+        while ((call = waitBaton())) {
             runLeg(call);
         }
 
@@ -302,6 +913,50 @@ public:
         }
     }
 
+    /**
+     * Wait for the baton, or NULL once the race is finished.
+     *
+     * Threads in a trace often switch every few calls, so spin for a while
+     * before blocking, to avoid paying a wake up and a context switch on
+     * every switch.
+     */
+    trace::Call *
+    waitBaton(void) {
+        bool spinHit = true;
+
+        for (unsigned i = 0; i < relaySpinCount && !baton && !finished; ++i) {
+            cpuRelax();
+        }
+
+        os::unique_lock<os::mutex> lock(mutex);
+
+        if (!finished && !baton) {
+            spinHit = false;
+            parked = true;
+            do {
+                wake_cond.wait(lock);
+            } while (!finished && !baton);
+            parked = false;
+        }
+
+        if (finished) {
+            return NULL;
+        }
+
+        assert(baton);
+        trace::Call *call = baton;
+        baton = 0;
+
+        ++handoffs;
+        if (spinHit) {
+            ++spinHits;
+        } else {
+            ++parks;
+        }
+
+        return call;
+    }
+
     /**
      * Interpret successive calls.
      */
@@ -310,30 +965,12 @@ public:
 
         /* Consume successive calls for this thread. */
         do {
-            bool callEndsFrame = false;
-            static trace::ParseBookmark frameStart;
-
             assert(call);
             assert(call->thread_id == leg);
 
-            if (loopOnFinish && call->flags & trace::CALL_FLAG_END_FRAME) {
-                callEndsFrame = true;
-                parser.getBookmark(frameStart);
-            }
-
             retraceCall(call);
-            delete call;
-            call = parser.parse_call();
-
-            /* Restart last frame if looping is requested. */
-            if (loopOnFinish) {
-                if (!call) {
-                    parser.setBookmark(lastFrameStart);
-                    call = parser.parse_call();
-                } else if (callEndsFrame) {
-                    lastFrameStart = frameStart;
-                }
-            }
+            releaseCall(call);
+            call = nextCall();
 
         } while (call && call->thread_id == leg);
 
@@ -345,6 +982,7 @@ public:
         } else {
             /* Reached the finish line */
             if (0) std::cerr << "finished on leg " << leg << "\n";
+            flushRendering();
             if (leg) {
                 /* Notify the fore runner */
                 race->finishLine();
@@ -364,9 +1002,12 @@ public:
 
         mutex.lock();
         baton = call;
+        bool wake = parked;
         mutex.unlock();
 
-        wake_cond.signal();
+        if (wake) {
+            wake_cond.signal();
+        }
     }
 
     /**
@@ -378,9 +1019,12 @@ public:
 
         mutex.lock();
         finished = true;
+        bool wake = parked;
         mutex.unlock();
 
-        wake_cond.signal();
+        if (wake) {
+            wake_cond.signal();
+        }
     }
 };
 
@@ -436,20 +1080,12 @@ RelayRace::getRunner(unsigned leg) {
 void
 RelayRace::run(void) {
     trace::Call *call;
-    call = parser.parse_call();
+    call = nextCall();
     if (!call) {
         /* Nothing to do */
         return;
     }
 
-    /* If the user wants to loop we need to get a bookmark target. We
-     * usually get this after replaying a call that ends a frame, but
-     * for a trace that has only one frame we need to get it at the
-     * beginning. */
-    if (loopOnFinish) {
-        parser.getBookmark(lastFrameStart);
-    }
-
     RelayRunner *foreRunner = getForeRunner();
     if (call->thread_id == 0) {
         /* We are the forerunner thread, so no need to pass baton */
@@ -502,6 +1138,32 @@ RelayRace::stopRunners(void) {
 }
 
 
+/**
+ * Print how the baton was passed between threads.
+ */
+void
+RelayRace::dumpStatistics(void) {
+    unsigned long long handoffs = 0;
+    unsigned long long spinHits = 0;
+    unsigned long long parks = 0;
+
+    std::vector<RelayRunner*>::const_iterator it;
+    for (it = runners.begin(); it != runners.end(); ++it) {
+        RelayRunner* runner = *it;
+        if (runner) {
+            handoffs += runner->handoffs;
+            spinHits += runner->spinHits;
+            parks += runner->parks;
+        }
+    }
+
+    std::cout <<
+        "Relayed " << handoffs << " batons between " << runners.size() << " threads:"
+        " " << spinHits << " caught without parking,"
+        " " << parks << " parked\n";
+}
+
+
 static void
 mainLoop() {
     addCallbacks(retracer);
@@ -509,23 +1171,57 @@ mainLoop() {
     long long startTime = 0; 
     frameNo = 0;
 
+    if (loopOnFinish) {
+        frameCache = new FrameCache;
+    }
+
+    /* Dumping state exits straight from the replay, with the parser thread
+     * still running, so don't use it then. */
+    if (pipelineCalls && !dumpingState) {
+        pipeline = new CallPipeline;
+    }
+
     startTime = os::getTime();
 
     if (singleThread) {
         trace::Call *call;
-        while ((call = parser.parse_call())) {
+        while ((call = nextCall())) {
             retraceCall(call);
-            delete call;
+            releaseCall(call);
         };
         flushRendering();
     } else {
+        relaySpinCount = os::thread::hardware_concurrency() > 1 ? RELAY_SPIN_COUNT : 0;
+
         RelayRace race;
         race.run();
+
+        if (retrace::verbosity >= 1) {
+            race.dumpStatistics();
+        }
     }
 
+    flushSnapshots();
+
     long long endTime = os::getTime();
+
+    delete pipeline;
+    pipeline = NULL;
+
+    if (frameCache) {
+        if ((retrace::verbosity >= -1) || (retrace::profiling)) {
+            frameCache->dumpStatistics();
+        }
+        delete frameCache;
+        frameCache = NULL;
+    }
+
     float timeInterval = (endTime - startTime) * (1.0 / os::timeFrequency);
 
+    if (retrace::profiling) {
+        retrace::profiler.finish();
+    }
+
     if ((retrace::verbosity >= -1) || (retrace::profiling)) {
         std::cout << 
             "Rendered " << frameNo << " frames"
@@ -555,19 +1251,23 @@ usage(const char *argv0) {
         "      --pgpu              gpu profiling (gpu times per draw call)\n"
         "      --ppd               pixels drawn profiling (pixels drawn per draw call)\n"
         "      --pmem              memory usage profiling (vsize rss per call)\n"
+        "      --profile-format=FMT  write profile as `text` (default) or compact `binary` records\n"
         "      --call-nos[=BOOL]   use call numbers in snapshot filenames\n"
         "      --core              use core profile\n"
         "      --db                use a double buffer visual (default)\n"
         "      --driver=DRIVER     force driver type (`hw`, `sw`, `ref`, `null`, or driver module name)\n"
         "      --sb                use a single buffer visual\n"
         "  -s, --snapshot-prefix=PREFIX    take snapshots; `-` for PNM stdout output\n"
-        "      --snapshot-format=FMT       use (PNM or RGB; default is PNM) when writing to stdout output\n"
+        "      --snapshot-format=FMT       use (PNM, RGB or QOI; default is PNM) when writing to stdout output,\n"
+        "                                  and QOI instead of PNG when writing to files\n"
         "  -S, --snapshot=CALLSET  calls to snapshot (default is every frame)\n"
         "  -v, --verbose           increase output verbosity\n"
         "  -D, --dump-state=CALL   dump state at specific call no\n"
         "  -w, --wait              waitOnFinish on final frame\n"
-        "      --loop              continuously loop, replaying final frame.\n"
-        "      --singlethread      use a single thread to replay command stream\n";
+        "      --loop[=N]          loop N times (or continuously), replaying final frame from memory\n"
+        "      --loop-frames=F[-L] frames to loop (numbered from 0) instead of the final one\n"
+        "      --singlethread      use a single thread to replay command stream\n"
+        "      --pipeline          parse the trace on a separate thread, ahead of the replay\n";
 }
 
 enum {
@@ -579,10 +1279,13 @@ enum {
     PGPU_OPT,
     PPD_OPT,
     PMEM_OPT,
+    PROFILE_FORMAT_OPT,
     SB_OPT,
     SNAPSHOT_FORMAT_OPT,
     LOOP_OPT,
-    SINGLETHREAD_OPT
+    LOOP_FRAMES_OPT,
+    SINGLETHREAD_OPT,
+    PIPELINE_OPT
 };
 
 const static char *
@@ -601,14 +1304,17 @@ longOptions[] = {
     {"pgpu", no_argument, 0, PGPU_OPT},
     {"ppd", no_argument, 0, PPD_OPT},
     {"pmem", no_argument, 0, PMEM_OPT},
+    {"profile-format", required_argument, 0, PROFILE_FORMAT_OPT},
     {"sb", no_argument, 0, SB_OPT},
     {"snapshot-prefix", required_argument, 0, 's'},
     {"snapshot-format", required_argument, 0, SNAPSHOT_FORMAT_OPT},
     {"snapshot", required_argument, 0, 'S'},
     {"verbose", no_argument, 0, 'v'},
     {"wait", no_argument, 0, 'w'},
-    {"loop", no_argument, 0, LOOP_OPT},
+    {"loop", optional_argument, 0, LOOP_OPT},
+    {"loop-frames", required_argument, 0, LOOP_FRAMES_OPT},
     {"singlethread", no_argument, 0, SINGLETHREAD_OPT},
+    {"pipeline", no_argument, 0, PIPELINE_OPT},
     {0, 0, 0, 0}
 };
 
@@ -616,6 +1322,10 @@ longOptions[] = {
 static void exceptionCallback(void)
 {
     std::cerr << retrace::callNo << ": error: caught an unhandled exception\n";
+    size_t unwritten = retrace::unwrittenSnapshots();
+    if (unwritten) {
+        std::cerr << "warning: " << unwritten << " snapshots were not written\n";
+    }
 }
 
 
@@ -671,6 +1381,9 @@ int main(int argc, char **argv)
         case SINGLETHREAD_OPT:
             retrace::singleThread = true;
             break;
+        case PIPELINE_OPT:
+            pipelineCalls = true;
+            break;
         case 's':
             snapshotPrefix = optarg;
             if (snapshotFrequency.empty()) {
@@ -701,6 +1414,8 @@ int main(int argc, char **argv)
 	case SNAPSHOT_FORMAT_OPT:
             if (strcmp(optarg, "RGB") == 0)
                 snapshotFormat = RAW_RGB;
+            else if (strcmp(optarg, "QOI") == 0)
+                snapshotFormat = QOI_FMT;
             else
                 snapshotFormat = PNM_FMT;
             break;
@@ -712,12 +1427,40 @@ int main(int argc, char **argv)
             break;
         case 'v':
             ++retrace::verbosity;
+            // Profiling options reset the verbosity, so remember -v apart
+            retrace::profilingStats = true;
             break;
         case 'w':
             waitOnFinish = true;
             break;
         case LOOP_OPT:
             loopOnFinish = true;
+            loopCount = 0;
+            if (optarg) {
+                char *end = NULL;
+                long count = strtol(optarg, &end, 0);
+                if (end == optarg || *end != '\0' || count <= 0 ||
+                    (unsigned long)count > ~0U) {
+                    std::cerr << "error: invalid loop count `" << optarg << "`\n";
+                    return 1;
+                }
+                loopCount = count;
+            }
+            break;
+        case LOOP_FRAMES_OPT:
+            {
+                char *end = NULL;
+                loopOnFinish = true;
+                loopFirstFrame = strtoul(optarg, &end, 0);
+                loopLastFrame = loopFirstFrame;
+                if (*end == '-') {
+                    loopLastFrame = strtoul(end + 1, &end, 0);
+                }
+                if (end == optarg || *end != '\0' || loopLastFrame < loopFirstFrame) {
+                    std::cerr << "error: invalid frame range `" << optarg << "`\n";
+                    return 1;
+                }
+            }
             break;
         case PGPU_OPT:
             retrace::debug = false;
@@ -747,6 +1490,16 @@ int main(int argc, char **argv)
 
             retrace::profilingMemoryUsage = true;
             break;
+        case PROFILE_FORMAT_OPT:
+            if (strcmp(optarg, "binary") == 0) {
+                profilingBinary = true;
+            } else if (strcmp(optarg, "text") == 0) {
+                profilingBinary = false;
+            } else {
+                std::cerr << "error: unknown profile format " << optarg << "\n";
+                return 1;
+            }
+            break;
         default:
             std::cerr << "error: unknown option " << opt << "\n";
             usage(argv[0]);
@@ -762,7 +1515,7 @@ int main(int argc, char **argv)
 
     retrace::setUp();
     if (retrace::profiling) {
-        retrace::profiler.setup(retrace::profilingCpuTimes, retrace::profilingGpuTimes, retrace::profilingPixelsDrawn, retrace::profilingMemoryUsage);
+        retrace::profiler.setup(retrace::profilingCpuTimes, retrace::profilingGpuTimes, retrace::profilingPixelsDrawn, retrace::profilingMemoryUsage, profilingBinary);
     }
 
     os::setExceptionCallback(exceptionCallback);
@@ -779,8 +1532,7 @@ int main(int argc, char **argv)
     
     os::resetExceptionCallback();
 
-    // XXX: X often hangs on XCloseDisplay
-    //retrace::cleanUp();
+    retrace::cleanUp();
 
     return 0;
 }
@@ -53,7 +53,9 @@ static void retrace_malloc(trace::Call &call) {
 
 static void retrace_memcpy(trace::Call &call) {
     void * dest = retrace::toPointer(call.arg(0));
-    void * src  = retrace::toPointer(call.arg(1));
+    // memcpy needs no alignment, so read blobs in place
+    const trace::Blob *blob = call.arg(1).toBlob();
+    void * src  = blob ? blob->buf : retrace::toPointer(call.arg(1));
     size_t n    = call.arg(2).toUInt();
 
     if (!dest || !src || !n) {
@@ -28,6 +28,10 @@
 
 #include <string.h>
 
+#include <algorithm>
+#include <functional>
+#include <vector>
+
 #include "retrace.hpp"
 #include "retrace_swizzle.hpp"
 
@@ -35,38 +39,78 @@
 namespace retrace {
 
 
+/*
+ * Regions of traced memory, and the replay buffers they translate to.
+ *
+ * Regions are kept in a vector sorted by traced address, which is much more
+ * cache friendly to binary search than a tree, and a second vector sorted by
+ * buffer pointer is kept alongside, so that regions can be found by buffer
+ * without walking all of them.
+ */
 struct Region
 {
-    void *buffer;
+    unsigned long long address;
     unsigned long long size;
+    void *buffer;
+};
+
+typedef std::vector<Region> RegionList;
+static RegionList regions;
+
+struct RegionRef
+{
+    void *buffer;
+    unsigned long long address;
 };
 
-typedef std::map<unsigned long long, Region> RegionMap;
-static RegionMap regionMap;
+typedef std::vector<RegionRef> RegionRefList;
+static RegionRefList regionRefs;
+
+
+static inline bool
+operator < (const Region &region, unsigned long long address) {
+    return region.address < address;
+}
+
+static inline bool
+operator < (unsigned long long address, const Region &region) {
+    return address < region.address;
+}
+
+static inline bool
+operator < (const RegionRef &one, const RegionRef &two) {
+    std::less<void *> less;
+    if (one.buffer != two.buffer) {
+        return less(one.buffer, two.buffer);
+    }
+    return one.address < two.address;
+}
 
 
 static inline bool
-contains(RegionMap::iterator &it, unsigned long long address) {
-    return it->first <= address && (it->first + it->second.size) > address;
+contains(RegionList::iterator &it, unsigned long long address) {
+    return it->address <= address && (it->address + it->size) > address;
 }
 
 
+#ifndef NDEBUG
+
 static inline bool
-intersects(RegionMap::iterator &it, unsigned long long start, unsigned long long size) {
-    unsigned long it_start = it->first;
-    unsigned long it_stop  = it->first + it->second.size;
+intersects(RegionList::iterator &it, unsigned long long start, unsigned long long size) {
+    unsigned long it_start = it->address;
+    unsigned long it_stop  = it->address + it->size;
     unsigned long stop = start + size;
     return it_start < stop && start < it_stop;
 }
 
 
 // Iterator to the first region that contains the address, or the first after
-static RegionMap::iterator
+static RegionList::iterator
 lowerBound(unsigned long long address) {
-    RegionMap::iterator it = regionMap.lower_bound(address);
+    RegionList::iterator it = std::lower_bound(regions.begin(), regions.end(), address);
 
-    while (it != regionMap.begin()) {
-        RegionMap::iterator pred = it;
+    while (it != regions.begin()) {
+        RegionList::iterator pred = it;
         --pred;
         if (contains(pred, address)) {
             it = pred;
@@ -75,29 +119,47 @@ lowerBound(unsigned long long address) {
         }
     }
 
-#ifndef NDEBUG
-    if (it != regionMap.end()) {
-        assert(contains(it, address) || it->first > address);
+    if (it != regions.end()) {
+        assert(contains(it, address) || it->address > address);
     }
-#endif
 
     return it;
 }
 
 // Iterator to the first region that starts after the address
-static RegionMap::iterator
+static RegionList::iterator
 upperBound(unsigned long long address) {
-    RegionMap::iterator it = regionMap.upper_bound(address);
+    RegionList::iterator it = std::upper_bound(regions.begin(), regions.end(), address);
 
-#ifndef NDEBUG
-    if (it != regionMap.end()) {
-        assert(it->first >= address);
+    if (it != regions.end()) {
+        assert(it->address >= address);
     }
-#endif
 
     return it;
 }
 
+#endif /* !NDEBUG */
+
+
+static void
+addRegionRef(void *buffer, unsigned long long address) {
+    RegionRef ref;
+    ref.buffer = buffer;
+    ref.address = address;
+    RegionRefList::iterator it = std::lower_bound(regionRefs.begin(), regionRefs.end(), ref);
+    regionRefs.insert(it, ref);
+}
+
+static void
+delRegionRef(void *buffer, unsigned long long address) {
+    RegionRef ref;
+    ref.buffer = buffer;
+    ref.address = address;
+    RegionRefList::iterator it = std::lower_bound(regionRefs.begin(), regionRefs.end(), ref);
+    assert(it != regionRefs.end() && it->buffer == buffer && it->address == address);
+    regionRefs.erase(it);
+}
+
 void
 addRegion(unsigned long long address, void *buffer, unsigned long long size)
 {
@@ -119,16 +181,16 @@ addRegion(unsigned long long address, void *buffer, unsigned long long size)
     }
 
 #ifndef NDEBUG
-    RegionMap::iterator start = lowerBound(address);
-    RegionMap::iterator stop = upperBound(address + size - 1);
+    RegionList::iterator start = lowerBound(address);
+    RegionList::iterator stop = upperBound(address + size - 1);
     if (0) {
         // Forget all regions that intersect this new one.
-        regionMap.erase(start, stop);
+        regions.erase(start, stop);
     } else {
-        for (RegionMap::iterator it = start; it != stop; ++it) {
+        for (RegionList::iterator it = start; it != stop; ++it) {
             std::cerr << std::hex << "warning: "
                 "region 0x" << address << "-0x" << (address + size) << " "
-                "intersects existing region 0x" << it->first << "-0x" << (it->first + it->second.size) << "\n" << std::dec;
+                "intersects existing region 0x" << it->address << "-0x" << (it->address + it->size) << "\n" << std::dec;
             assert(intersects(it, address, size));
         }
     }
@@ -137,24 +199,29 @@ addRegion(unsigned long long address, void *buffer, unsigned long long size)
     assert(buffer);
 
     Region region;
-    region.buffer = buffer;
+    region.address = address;
     region.size = size;
+    region.buffer = buffer;
 
-    regionMap[address] = region;
+    RegionList::iterator it = std::lower_bound(regions.begin(), regions.end(), address);
+    if (it != regions.end() && it->address == address) {
+        // Replace the region starting at the same address
+        delRegionRef(it->buffer, address);
+        *it = region;
+    } else {
+        regions.insert(it, region);
+    }
+    addRegionRef(buffer, address);
 }
 
-static RegionMap::iterator
+static RegionList::iterator
 lookupRegion(unsigned long long address) {
-    RegionMap::iterator it = regionMap.lower_bound(address);
+    RegionList::iterator it = std::upper_bound(regions.begin(), regions.end(), address);
 
-    if (it == regionMap.end() ||
-        it->first > address) {
-        if (it == regionMap.begin()) {
-            return regionMap.end();
-        } else {
-            --it;
-        }
+    if (it == regions.begin()) {
+        return regions.end();
     }
+    --it;
 
     assert(contains(it, address));
     return it;
@@ -162,9 +229,10 @@ lookupRegion(unsigned long long address) {
 
 void
 delRegion(unsigned long long address) {
-    RegionMap::iterator it = lookupRegion(address);
-    if (it != regionMap.end()) {
-        regionMap.erase(it);
+    RegionList::iterator it = lookupRegion(address);
+    if (it != regions.end()) {
+        delRegionRef(it->buffer, it->address);
+        regions.erase(it);
     } else {
         assert(0);
     }
@@ -173,22 +241,27 @@ delRegion(unsigned long long address) {
 
 void
 delRegionByPointer(void *ptr) {
-    for (RegionMap::iterator it = regionMap.begin(); it != regionMap.end(); ++it) {
-        if (it->second.buffer == ptr) {
-            regionMap.erase(it);
-            return;
-        }
+    RegionRef ref;
+    ref.buffer = ptr;
+    ref.address = 0;
+    RegionRefList::iterator refIt = std::lower_bound(regionRefs.begin(), regionRefs.end(), ref);
+    if (refIt != regionRefs.end() && refIt->buffer == ptr) {
+        RegionList::iterator it = std::lower_bound(regions.begin(), regions.end(), refIt->address);
+        assert(it != regions.end() && it->address == refIt->address);
+        regions.erase(it);
+        regionRefs.erase(refIt);
+        return;
     }
     assert(0);
 }
 
 void *
 lookupAddress(unsigned long long address) {
-    RegionMap::iterator it = lookupRegion(address);
-    if (it != regionMap.end()) {
-        unsigned long long offset = address - it->first;
-        assert(offset < it->second.size);
-        void *addr = (char *)it->second.buffer + offset;
+    RegionList::iterator it = lookupRegion(address);
+    if (it != regions.end()) {
+        unsigned long long offset = address - it->address;
+        assert(offset < it->size);
+        void *addr = (char *)it->buffer + offset;
 
         if (retrace::verbosity >= 2) {
             std::cout
@@ -252,7 +325,7 @@ toPointer(trace::Value &value, bool bind) {
 
 
 
-static std::map<unsigned long long, void *> _obj_map;
+static HashMap<void *> _obj_map;
 
 void
 addObj(trace::Call &call, trace::Value &value, void *obj) {
@@ -269,7 +342,7 @@ addObj(trace::Call &call, trace::Value &value, void *obj) {
         warning(call) << "got null for object 0x" << std::hex << address << std::dec << "\n";
     }
 
-    _obj_map[address] = obj;
+    _obj_map.lookup(address, obj) = obj;
     
     if (retrace::verbosity >= 2) {
         std::cout << std::hex << "obj 0x" << address << " -> 0x" << size_t(obj) << std::dec << "\n";
@@ -291,7 +364,8 @@ toObjPointer(trace::Call &call, trace::Value &value) {
 
     void *obj;
     if (address) {
-        obj = _obj_map[address];
+        void **slot = _obj_map.find(address);
+        obj = slot ? *slot : NULL;
         if (!obj) {
             warning(call) << "unknown object 0x" << std::hex << address << std::dec << "\n";
         }
@@ -27,14 +27,34 @@
 #define _RETRACE_SWIZZLE_HPP_
 
 
+#include <stddef.h>
+
 #include <map>
+#include <vector>
 
 #include "trace_model.hpp"
+#include "retrace_hashmap.hpp"
 
 
 namespace retrace {
 
 
+/*
+ * Integer key of a handle.
+ */
+template <class T>
+inline unsigned long long
+handleKey(T handle) {
+    return (unsigned long long)handle;
+}
+
+template <class T>
+inline unsigned long long
+handleKey(T *handle) {
+    return (unsigned long long)(size_t)handle;
+}
+
+
 /**
  * Handle map.
  *
@@ -45,6 +65,11 @@ namespace retrace {
  * the implementation to generate an unique name, or pick a value never used
  * before.
  *
+ * Handles are looked up on nearly every call, and are usually small dense
+ * integers, so small keys index a vector directly, and only large or sparse
+ * keys (negative values, pointers) go to a hash table.  References returned
+ * are invalidated by subsequent insertions.
+ *
  * XXX: In some cases, instead of returning the key, it would make more sense
  * to return an unused data value (e.g., container count).
  */
@@ -52,27 +77,56 @@ template <class T>
 class map
 {
 private:
-    typedef std::map<T, T> base_type;
-    base_type base;
+    enum {
+        DENSE_LIMIT = 1 << 16
+    };
+
+    struct Entry
+    {
+        T value;
+        bool used;
+    };
+
+    std::vector<Entry> dense;
+    HashMap<T> sparse;
+
+    T *
+    find(const T &key) {
+        unsigned long long k = handleKey(key);
+        if (k < dense.size()) {
+            Entry &entry = dense[k];
+            return entry.used ? &entry.value : NULL;
+        }
+        return sparse.find(k);
+    }
 
 public:
 
     T & operator[] (const T &key) {
-        typename base_type::iterator it;
-        it = base.find(key);
-        if (it == base.end()) {
-            return (base[key] = key);
+        unsigned long long k = handleKey(key);
+        if (k < DENSE_LIMIT) {
+            size_t i = (size_t)k;
+            if (i >= dense.size()) {
+                size_t size = dense.size() * 2;
+                if (size <= i) {
+                    size = i + 1;
+                }
+                if (size < 64) {
+                    size = 64;
+                }
+                if (size > DENSE_LIMIT) {
+                    size = DENSE_LIMIT;
+                }
+                dense.resize(size);
+            }
+            Entry &entry = dense[i];
+            if (!entry.used) {
+                entry.value = key;
+                entry.used = true;
+            }
+            return entry.value;
         }
-        return it->second;
-    }
-    
-    const T & operator[] (const T &key) const {
-        typename base_type::const_iterator it;
-        it = base.find(key);
-        if (it == base.end()) {
-            return (base[key] = key);
-        }
-        return it->second;
+        return sparse.lookup(k, key);
     }
 
     /*
@@ -85,14 +139,43 @@ public:
      * "myMatrix[0]"), etc.
      */
     T lookupUniformLocation(const T &key) {
-        typename base_type::const_iterator it;
-        it = base.upper_bound(key);
-        if (it != base.begin()) {
-            --it;
-        } else {
-            return (base[key] = key);
+        T *value = find(key);
+        if (value) {
+            return *value;
         }
-        T t = it->second + (key - it->first);
+
+        // Find the greatest key below
+        bool found = false;
+        T predKey = T();
+        T predValue = T();
+
+        unsigned long long k = handleKey(key);
+        size_t i = k < dense.size() ? (size_t)k : dense.size();
+        while (i-- > 0) {
+            if (dense[i].used && T(i) < key) {
+                predKey = T(i);
+                predValue = dense[i].value;
+                found = true;
+                break;
+            }
+        }
+
+        for (size_t j = 0; j < sparse.capacity(); ++j) {
+            if (sparse.occupied(j)) {
+                T sparseKey = T(sparse.keyAt(j));
+                if (sparseKey < key && (!found || sparseKey > predKey)) {
+                    predKey = sparseKey;
+                    predValue = sparse.valueAt(j);
+                    found = true;
+                }
+            }
+        }
+
+        if (!found) {
+            return ((*this)[key] = key);
+        }
+
+        T t = predValue + (key - predKey);
         return t;
     }
 };
@@ -0,0 +1,140 @@
+/**************************************************************************
+ *
+ * Copyright 2014 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+/*
+ * Memory region churn micro-benchmark.
+ *
+ * Mimics buffer mapping during retrace: each iteration unmaps a random live
+ * region, maps it again, and translates a few traced pointers into random
+ * live regions, reporting the average time per iteration.
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <iostream>
+#include <vector>
+
+#include "os_time.hpp"
+#include "trace_model.hpp"
+#include "retrace.hpp"
+#include "retrace_swizzle.hpp"
+
+
+// retrace_swizzle.cpp only needs these from retrace_main.cpp and retrace.cpp,
+// which would otherwise drag in a second main().
+namespace retrace {
+
+int verbosity = 0;
+bool debug = false;
+
+std::ostream &warning(trace::Call &call) {
+    std::cerr << call.no << ": ";
+    std::cerr << "warning: ";
+    return std::cerr;
+}
+
+} /* namespace retrace */
+
+
+static bool
+parseCount(const char *arg, unsigned &count)
+{
+    char *endptr;
+    unsigned long value = strtoul(arg, &endptr, 0);
+    if (*endptr || !value) {
+        fprintf(stderr, "error: invalid count %s\n", arg);
+        return false;
+    }
+    count = value;
+    return true;
+}
+
+
+int
+main(int argc, char **argv)
+{
+    if (argc > 3) {
+        fprintf(stderr, "usage: %s [REGIONS [ITERATIONS]]\n", argv[0]);
+        return 1;
+    }
+
+    unsigned numRegions = 1000;
+    unsigned numIterations = 200000;
+    if ((argc > 1 && !parseCount(argv[1], numRegions)) ||
+        (argc > 2 && !parseCount(argv[2], numIterations))) {
+        return 1;
+    }
+
+    static const unsigned regionSize = 256;
+    static const unsigned lookupsPerIteration = 4;
+
+    std::vector<char *> buffers(numRegions);
+    std::vector<unsigned long long> addresses(numRegions);
+    for (unsigned i = 0; i < numRegions; ++i) {
+        buffers[i] = new char[regionSize];
+        addresses[i] = 0x10000000ULL + (unsigned long long)i * 0x1000;
+        retrace::addRegion(addresses[i], buffers[i], regionSize);
+    }
+
+    srand(1);
+
+    unsigned long long mismatches = 0;
+    long long startTime = os::getTime();
+
+    for (unsigned n = 0; n < numIterations; ++n) {
+        unsigned i = rand() % numRegions;
+        retrace::delRegionByPointer(buffers[i]);
+        retrace::addRegion(addresses[i], buffers[i], regionSize);
+
+        for (unsigned k = 0; k < lookupsPerIteration; ++k) {
+            unsigned j = rand() % numRegions;
+            trace::Pointer pointer(addresses[j] + 17);
+            if (retrace::toPointer(pointer) != buffers[j] + 17) {
+                ++mismatches;
+            }
+        }
+    }
+
+    long long endTime = os::getTime();
+
+    if (mismatches) {
+        fprintf(stderr, "error: %llu pointers were translated incorrectly\n", mismatches);
+        return 1;
+    }
+
+    double nanoseconds = double(endTime - startTime) * 1.0e9 / os::timeFrequency;
+    printf("%u regions: %.1f ns/iteration\n",
+           numRegions, nanoseconds / numIterations);
+
+    for (unsigned i = 0; i < numRegions; ++i) {
+        retrace::delRegionByPointer(buffers[i]);
+        delete [] buffers[i];
+    }
+
+    return 0;
+}
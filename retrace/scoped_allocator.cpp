@@ -0,0 +1,112 @@
+/**************************************************************************
+ *
+ * Copyright 2014 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+#include <algorithm>
+
+#include "os_thread.hpp"
+#include "scoped_allocator.hpp"
+
+
+/*
+ * Pages of this size are kept around for reuse.  Larger pages are only
+ * allocated for large arrays, and freed as soon as they are released.
+ */
+#define ARENA_PAGE_SIZE (64*1024)
+
+
+static OS_THREAD_SPECIFIC_PTR(ScopedArena)
+threadArena;
+
+
+ScopedArena *
+ScopedArena::get(void)
+{
+    ScopedArena *arena = threadArena;
+    if (!arena) {
+        arena = new ScopedArena;
+        threadArena = arena;
+    }
+    return arena;
+}
+
+
+ScopedArena::~ScopedArena()
+{
+    while (first) {
+        Page *next = first->next;
+        free(first);
+        first = next;
+    }
+}
+
+
+void *
+ScopedArena::allocSlow(size_t size)
+{
+    // Worst case alignment padding included
+    size_t needed = size + sizeof(size_t) + 15;
+
+    Page *next = current ? current->next : first;
+    if (!next || next->size < needed) {
+        size_t pageSize = std::max(needed, size_t(ARENA_PAGE_SIZE));
+        Page *page = static_cast<Page *>(malloc(sizeof(Page) + pageSize));
+        if (!page) {
+            return NULL;
+        }
+        page->size = pageSize;
+        page->next = next;
+        if (current) {
+            current->next = page;
+        } else {
+            first = page;
+        }
+        next = page;
+    }
+
+    current = next;
+    current->used = 0;
+
+    return alloc(size);
+}
+
+
+/**
+ * Free the oversized pages past the current one.
+ */
+void
+ScopedArena::trim(void)
+{
+    Page **link = current ? &current->next : &first;
+    while (*link) {
+        Page *page = *link;
+        if (page->size > ARENA_PAGE_SIZE) {
+            *link = page->next;
+            free(page);
+        } else {
+            link = &page->next;
+        }
+    }
+}
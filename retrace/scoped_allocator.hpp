@@ -30,20 +30,116 @@
 #include <assert.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 
 /**
- * Similar to alloca(), but implemented with malloc.
+ * Per-thread stack of memory pages, from which ScopedAllocator allocations
+ * are carved.
+ *
+ * Pages are kept once allocated, so after the first few calls temporary
+ * arrays no longer touch the heap at all.
+ */
+class ScopedArena
+{
+private:
+    struct Page
+    {
+        Page *next;
+        size_t size;
+        size_t used;
+    };
+
+    Page *first;
+    Page *current;
+
+    void *
+    allocSlow(size_t size);
+
+    void
+    trim(void);
+
+public:
+    struct Mark
+    {
+        Page *page;
+        size_t used;
+    };
+
+    ScopedArena() :
+        first(NULL),
+        current(NULL)
+    {}
+
+    ~ScopedArena();
+
+    /**
+     * Arena of the calling thread.
+     */
+    static ScopedArena *
+    get(void);
+
+    inline Mark
+    mark(void) const {
+        Mark m;
+        m.page = current;
+        m.used = current ? current->used : 0;
+        return m;
+    }
+
+    /**
+     * Free everything allocated since the mark was taken.
+     */
+    inline void
+    release(const Mark &m) {
+        if (current != m.page) {
+            current = m.page;
+            trim();
+        }
+        if (current) {
+            current->used = m.used;
+        }
+    }
+
+    /**
+     * Allocate size bytes, suitably aligned for any type, and recording the
+     * size just before the returned pointer.
+     */
+    inline void *
+    alloc(size_t size) {
+        if (current) {
+            uintptr_t base = reinterpret_cast<uintptr_t>(current + 1);
+            uintptr_t ptr = (base + current->used + sizeof(size_t) + 15) & ~uintptr_t(15);
+            if (ptr + size <= base + current->size) {
+                reinterpret_cast<size_t *>(ptr)[-1] = size;
+                current->used = ptr + size - base;
+                return reinterpret_cast<void *>(ptr);
+            }
+        }
+        return allocSlow(size);
+    }
+
+    static inline size_t
+    allocSize(const void *ptr) {
+        return static_cast<const size_t *>(ptr)[-1];
+    }
+};
+
+
+/**
+ * Similar to alloca(), but allocating from the per-thread ScopedArena.
  */
 class ScopedAllocator
 {
 private:
-    uintptr_t next;
+    ScopedArena *arena;
+    ScopedArena::Mark start;
 
 public:
     inline
     ScopedAllocator() :
-        next(0) {
+        arena(ScopedArena::get()),
+        start(arena->mark()) {
     }
 
     inline void *
@@ -51,16 +147,7 @@ public:
         /* Always return valid address, even when size is zero */
         size = std::max(size, sizeof(uintptr_t));
 
-        uintptr_t * buf = static_cast<uintptr_t *>(malloc(sizeof(uintptr_t) + size));
-        if (!buf) {
-            return NULL;
-        }
-
-        *buf = next;
-        next = reinterpret_cast<uintptr_t>(buf);
-        assert((next & 1) == 0);
-
-        return static_cast<void *>(&buf[1]);
+        return arena->alloc(size);
     }
     
     template< class T >
@@ -70,30 +157,25 @@ public:
     }
 
     /**
-     * Prevent this pointer from being automatically freed.
+     * Prevent this pointer from being automatically freed, by moving its
+     * contents to the heap.
      */
     template< class T >
     inline void
-    bind(T *ptr) {
+    bind(T * &ptr) {
         if (ptr) {
-            reinterpret_cast<uintptr_t *>(ptr)[-1] |= 1;
+            size_t size = ScopedArena::allocSize(ptr);
+            void *buf = malloc(size);
+            if (buf) {
+                memcpy(buf, ptr, size);
+            }
+            ptr = static_cast<T *>(buf);
         }
     }
 
     inline
     ~ScopedAllocator() {
-        while (next) {
-            uintptr_t temp = *reinterpret_cast<uintptr_t *>(next);
-
-            bool bind = temp & 1;
-            temp &= ~1;
-
-            if (!bind) {
-                free(reinterpret_cast<void *>(next));
-            }
-
-            next = temp;
-        }
+        arena->release(start);
     }
 };
 
@@ -28,32 +28,95 @@
 import sys
 
 
-def process(stream):
-    times = {}
-
-    # call no gpu_start gpu_dura cpu_start cpu_dura pixels program name
-
-    for line in stream:
+BINARY_HEADER = '#apitrace-profile 1\n'
+
+
+def readUInt(data, pos):
+    value = 0
+    shift = 0
+    while True:
+        c = ord(data[pos])
+        pos += 1
+        value |= (c & 0x7f) << shift
+        if not c & 0x80:
+            return value, pos
+        shift += 7
+
+
+def readSInt(data, pos):
+    value, pos = readUInt(data, pos)
+    return (value >> 1) ^ -(value & 1), pos
+
+
+def readBinaryCalls(data):
+    '''Yield (no, gpu_dura, program, name) from a binary profile.'''
+
+    names = {}
+    no = 0
+    starts = [0, 0, 0, 0]
+
+    pos = len(BINARY_HEADER)
+    while pos < len(data):
+        tag = data[pos]
+        pos += 1
+        if tag == 'N':
+            id, pos = readUInt(data, pos)
+            length, pos = readUInt(data, pos)
+            names[id] = data[pos:pos + length]
+            pos += length
+        elif tag == 'C':
+            delta, pos = readSInt(data, pos)
+            no += delta
+            program, pos = readUInt(data, pos)
+            pixels, pos = readSInt(data, pos)
+            durations = []
+            for i in range(4):
+                delta, pos = readSInt(data, pos)
+                starts[i] += delta
+                duration, pos = readSInt(data, pos)
+                durations.append(duration)
+            id, pos = readUInt(data, pos)
+            yield no, durations[0], program, names.get(id, '')
+        elif tag == 'F':
+            pass
+        else:
+            break
+
+
+def readTextCalls(data):
+    '''Yield (no, gpu_dura, program, name) from a text profile.'''
+
+    # call no gpu_start gpu_dura cpu_start cpu_dura vsize_start vsize_dura rss_start rss_dura pixels program name
+
+    for line in data.splitlines():
         words = line.split(' ')
 
         if line.startswith('#'):
             continue
 
         if words[0] == 'call':
-            id = long(words[1])
-            duration = long(words[3])
-            shader = long(words[7])
-            func = words[8]
+            yield long(words[1]), long(words[3]), long(words[11]), words[12]
+
+
+def process(stream):
+    times = {}
+
+    data = stream.read()
+    if data.startswith(BINARY_HEADER):
+        calls = readBinaryCalls(data)
+    else:
+        calls = readTextCalls(data)
 
-            if times.has_key(shader):
-                times[shader]['draws'] += 1
-                times[shader]['duration'] += duration
+    for id, duration, shader, func in calls:
+        if times.has_key(shader):
+            times[shader]['draws'] += 1
+            times[shader]['duration'] += duration
 
-                if duration > times[shader]['longestDuration']:
-                    times[shader]['longest'] = id
-                    times[shader]['longestDuration'] = duration
-            else:
-                times[shader] = {'draws': 1, 'duration': duration, 'longest': id, 'longestDuration': duration}
+            if duration > times[shader]['longestDuration']:
+                times[shader]['longest'] = id
+                times[shader]['longestDuration'] = duration
+        else:
+            times[shader] = {'draws': 1, 'duration': duration, 'longest': id, 'longestDuration': duration}
 
     times = sorted(times.items(), key=lambda x: x[1]['duration'], reverse=True)
 
@@ -75,7 +138,7 @@ def process(stream):
 def main():
     if len(sys.argv) > 1:
         for arg in sys.argv[1:]:
-            process(open(arg, 'rt'))
+            process(open(arg, 'rb'))
     else:
         process(sys.stdin)
 
@@ -46,17 +46,84 @@ thumbSize = 320
 
 gaussian_kernel = ImageFilter.Kernel((3, 3), [1, 2, 1, 2, 4, 2, 1, 2, 1], 16)
 
+
+def read_qoi(filename):
+    '''Decode a QOI image, as written by `glretrace --snapshot-format=QOI`.
+
+    See http://qoiformat.org/qoi-specification.pdf'''
+
+    data = bytearray(open(filename, 'rb').read())
+    if data[0:4] != bytearray(b'qoif'):
+        raise ValueError('%s: not a QOI image' % filename)
+    width = (data[4] << 24) | (data[5] << 16) | (data[6] << 8) | data[7]
+    height = (data[8] << 24) | (data[9] << 16) | (data[10] << 8) | data[11]
+    channels = data[12]
+
+    pixels = bytearray(width*height*channels)
+    index = [(0, 0, 0, 0)]*64
+    r, g, b, a = 0, 0, 0, 255
+    p = 14
+    end = len(data) - 8
+    run = 0
+    for offset in range(0, len(pixels), channels):
+        if run:
+            run -= 1
+        elif p < end:
+            b1 = data[p]
+            p += 1
+            if b1 == 0xfe:
+                r, g, b = data[p], data[p + 1], data[p + 2]
+                p += 3
+            elif b1 == 0xff:
+                r, g, b, a = data[p], data[p + 1], data[p + 2], data[p + 3]
+                p += 4
+            elif b1 & 0xc0 == 0x00:
+                r, g, b, a = index[b1]
+            elif b1 & 0xc0 == 0x40:
+                r = (r + ((b1 >> 4) & 3) - 2) & 0xff
+                g = (g + ((b1 >> 2) & 3) - 2) & 0xff
+                b = (b + (b1 & 3) - 2) & 0xff
+            elif b1 & 0xc0 == 0x80:
+                b2 = data[p]
+                p += 1
+                vg = (b1 & 0x3f) - 32
+                r = (r + vg - 8 + ((b2 >> 4) & 0x0f)) & 0xff
+                g = (g + vg) & 0xff
+                b = (b + vg - 8 + (b2 & 0x0f)) & 0xff
+            else:
+                run = b1 & 0x3f
+            index[(r*3 + g*5 + b*7 + a*11) % 64] = (r, g, b, a)
+        pixels[offset] = r
+        pixels[offset + 1] = g
+        pixels[offset + 2] = b
+        if channels == 4:
+            pixels[offset + 3] = a
+
+    mode = channels == 4 and 'RGBA' or 'RGB'
+    try:
+        frombytes = Image.frombytes
+    except AttributeError:
+        frombytes = Image.fromstring
+    return frombytes(mode, (width, height), bytes(pixels))
+
+
+def open_image(filename):
+    if filename.endswith('.qoi'):
+        return read_qoi(filename)
+    return Image.open(filename)
+
+
 class Comparer:
     '''Image comparer.'''
 
     def __init__(self, ref_image, src_image, alpha = False):
         if isinstance(ref_image, basestring):
-            self.ref_im = Image.open(ref_image)
+            self.ref_im = open_image(ref_image)
         else:
             self.ref_im = ref_image
 
         if isinstance(src_image, basestring):
-            self.src_im = Image.open(src_image)
+            self.src_im = open_image(src_image)
         else:
             self.src_im = src_image
 
@@ -115,13 +182,22 @@ class Comparer:
 
 
 def surface(html, image):
+    if image.endswith('.qoi'):
+        # Browsers can't show QOI images, so link to a PNG copy instead
+        png = image + '.png'
+        if os.path.exists(image) \
+           and (not os.path.exists(png) \
+                or os.path.getmtime(png) < os.path.getmtime(image)):
+            read_qoi(image).save(png)
+        image = png
+
     if True:
         name, ext = os.path.splitext(image)
         thumb = name + '.thumb' + ext
         if os.path.exists(image) \
            and (not os.path.exists(thumb) \
                 or os.path.getmtime(thumb) < os.path.getmtime(image)):
-            im = Image.open(image)
+            im = open_image(image)
             imageWidth, imageHeight = im.size
             if imageWidth <= thumbSize and imageHeight <= thumbSize:
                 if imageWidth >= imageHeight:
@@ -144,7 +220,7 @@ def is_image(path):
     name = os.path.basename(path)
     name, ext1 = os.path.splitext(name)
     name, ext2 = os.path.splitext(name)
-    return ext1 in ('.png', '.bmp') and ext2 not in ('.diff', '.thumb')
+    return ext1 in ('.png', '.bmp', '.qoi') and ext2 not in ('.diff', '.thumb', '.qoi')
 
 
 def find_images(prefix):